@@ -0,0 +1,292 @@
+#include "arena.h"
+
+gearman_arena_stats g_ArenaStats;
+
+#define GEARMAN_ARENA_LARGE		GEARMAN_ARENA_CLASSES
+
+union GearmanArena::BlockHeader {
+	struct {
+		GearmanArena *owner;		/* NULL for AllocShared memory */
+		unsigned int cls;			/* Size class, or GEARMAN_ARENA_LARGE */
+		unsigned int size;			/* Bytes asked for */
+	} info;
+	BlockHeader *next;				/* While on a free list */
+	char align[16];
+};
+
+static inline size_t Arena_ClassSize(unsigned int cls) {
+	return (size_t) 1 << (cls + GEARMAN_ARENA_MIN_SHIFT);
+}
+
+static inline unsigned int Arena_ClassOf(size_t size) {
+	unsigned int cls = 0;
+	while(cls < GEARMAN_ARENA_CLASSES && Arena_ClassSize(cls) < size)
+		cls++;
+	return cls;
+}
+
+static inline unsigned int Arena_CacheLimit(unsigned int cls) {
+	size_t limit = GEARMAN_ARENA_CACHE_BYTES / Arena_ClassSize(cls);
+	return (limit < 4) ? 4 : (unsigned int) limit;
+}
+
+// libgearman's hooks, context is the arena that was installed
+
+static void *Arena_Malloc(size_t size, void *context) {
+	return ((GearmanArena *) context)->Alloc(size);
+}
+
+static void *Arena_Realloc(void *ptr, size_t size, void *context) {
+	return ((GearmanArena *) context)->Realloc(ptr, size);
+}
+
+static void *Arena_Calloc(size_t nelm, size_t size, void *context) {
+	void *ptr = ((GearmanArena *) context)->Alloc(nelm * size);
+	if(ptr != NULL)
+		memset(ptr, 0, nelm * size);
+	return ptr;
+}
+
+static void Arena_Free(void *ptr, void *context) {
+	((GearmanArena *) context)->Free(ptr);
+}
+
+GearmanArena::GearmanArena() : m_Remote(NULL), m_Refs(1) {
+	for(unsigned int i = 0; i < GEARMAN_ARENA_CLASSES; i++) {
+		m_Free[i] = NULL;
+		m_FreeCount[i] = 0;
+	}
+	__sync_add_and_fetch(&g_ArenaStats.arenas, 1);
+}
+
+GearmanArena::~GearmanArena() {
+	// Nobody else can reach the arena anymore
+	ReclaimRemote();
+
+	for(unsigned int i = 0; i < GEARMAN_ARENA_CLASSES; i++) {
+		while(m_Free[i] != NULL) {
+			BlockHeader *block = m_Free[i];
+			m_Free[i] = block->next;
+			__sync_sub_and_fetch(&g_ArenaStats.cached, Arena_ClassSize(i));
+			block->info.cls = i;
+			ToSystem(block);
+		}
+	}
+	__sync_sub_and_fetch(&g_ArenaStats.arenas, 1);
+}
+
+GearmanArena *GearmanArena::Create() {
+	return new GearmanArena();
+}
+
+void GearmanArena::Install(gearman_client_st *client) {
+	gearman_client_set_memory_allocators(client, Arena_Malloc, Arena_Free, Arena_Realloc, Arena_Calloc, this);
+}
+
+void GearmanArena::Install(gearman_worker_st *worker) {
+	gearman_worker_set_memory_allocators(worker, Arena_Malloc, Arena_Free, Arena_Realloc, Arena_Calloc, this);
+}
+
+void GearmanArena::Close() {
+	Unref();
+}
+
+void GearmanArena::Unref() {
+	if(__sync_sub_and_fetch(&m_Refs, 1) == 0)
+		delete this;
+}
+
+GearmanArena::BlockHeader *GearmanArena::HeaderOf(void *ptr) {
+	return ((BlockHeader *) ptr) - 1;
+}
+
+void *GearmanArena::FromSystem(GearmanArena *owner, unsigned int cls, size_t size) {
+	const size_t total = (cls == GEARMAN_ARENA_LARGE) ? sizeof(BlockHeader) + size : Arena_ClassSize(cls);
+
+	BlockHeader *block = (BlockHeader *) malloc(total);
+	if(block == NULL)
+		return NULL;
+
+	__sync_add_and_fetch(&g_ArenaStats.system, total);
+
+	block->info.owner = owner;
+	block->info.cls = cls;
+	block->info.size = size;
+	return block + 1;
+}
+
+void GearmanArena::ToSystem(BlockHeader *block) {
+	const size_t total = (block->info.cls == GEARMAN_ARENA_LARGE) ? sizeof(BlockHeader) + block->info.size : Arena_ClassSize(block->info.cls);
+
+	__sync_sub_and_fetch(&g_ArenaStats.system, total);
+	free(block);
+}
+
+void *GearmanArena::Alloc(size_t size) {
+	__sync_add_and_fetch(&g_ArenaStats.allocs, 1);
+
+	const unsigned int cls = Arena_ClassOf(size + sizeof(BlockHeader));
+	void *ptr;
+
+	if(cls == GEARMAN_ARENA_LARGE) {
+		__sync_add_and_fetch(&g_ArenaStats.large, 1);
+		if((ptr = FromSystem(this, cls, size)) == NULL)
+			return NULL;
+		__sync_add_and_fetch(&g_ArenaStats.inUse, size);
+	} else {
+		if(m_Free[cls] == NULL)
+			ReclaimRemote();
+
+		BlockHeader *block = m_Free[cls];
+		if(block != NULL) {
+			m_Free[cls] = block->next;
+			m_FreeCount[cls]--;
+			__sync_sub_and_fetch(&g_ArenaStats.cached, Arena_ClassSize(cls));
+			__sync_add_and_fetch(&g_ArenaStats.hits, 1);
+
+			block->info.owner = this;
+			block->info.cls = cls;
+			block->info.size = size;
+			ptr = block + 1;
+		} else if((ptr = FromSystem(this, cls, size)) == NULL) {
+			return NULL;
+		}
+		__sync_add_and_fetch(&g_ArenaStats.inUse, Arena_ClassSize(cls));
+	}
+
+	__sync_add_and_fetch(&g_ArenaStats.requested, size);
+	__sync_add_and_fetch(&m_Refs, 1);
+	return ptr;
+}
+
+void *GearmanArena::Realloc(void *ptr, size_t size) {
+	if(ptr == NULL)
+		return Alloc(size);
+
+	if(size == 0) {
+		Free(ptr);
+		return NULL;
+	}
+
+	BlockHeader *block = HeaderOf(ptr);
+	const unsigned int cls = block->info.cls;
+
+	// Still fits, which is the common case for the terminator added to taken data
+	if(cls != GEARMAN_ARENA_LARGE && size + sizeof(BlockHeader) <= Arena_ClassSize(cls)) {
+		__sync_add_and_fetch(&g_ArenaStats.requested, size - block->info.size);
+		block->info.size = size;
+		return ptr;
+	}
+
+	void *grown = Alloc(size);
+	if(grown == NULL)
+		return NULL;
+
+	memcpy(grown, ptr, (block->info.size < size) ? block->info.size : size);
+	Free(ptr);
+	return grown;
+}
+
+void GearmanArena::Free(void *ptr) {
+	if(ptr == NULL)
+		return;
+
+	BlockHeader *block = HeaderOf(ptr);
+
+	// Blocks always go back to the arena they came from
+	if(block->info.owner != this) {
+		Release(ptr);
+		return;
+	}
+
+	Recycle(block);
+	Unref();
+}
+
+// Owning side, block belongs to this arena
+void GearmanArena::Recycle(BlockHeader *block) {
+	const unsigned int cls = block->info.cls;
+
+	__sync_sub_and_fetch(&g_ArenaStats.requested, block->info.size);
+
+	if(cls == GEARMAN_ARENA_LARGE) {
+		__sync_sub_and_fetch(&g_ArenaStats.inUse, block->info.size);
+		ToSystem(block);
+		return;
+	}
+
+	__sync_sub_and_fetch(&g_ArenaStats.inUse, Arena_ClassSize(cls));
+
+	if(m_FreeCount[cls] >= Arena_CacheLimit(cls)) {
+		ToSystem(block);
+		return;
+	}
+
+	block->next = m_Free[cls];
+	m_Free[cls] = block;
+	m_FreeCount[cls]++;
+	__sync_add_and_fetch(&g_ArenaStats.cached, Arena_ClassSize(cls));
+}
+
+void GearmanArena::ReclaimRemote() {
+	// Take the whole list at once, so there's nothing for a concurrent push to race with.
+	// The list links payloads, see Release.
+	BlockHeader *link = (BlockHeader *) __sync_lock_test_and_set(&m_Remote, NULL);
+
+	while(link != NULL) {
+		BlockHeader *next = link->next;
+		Recycle(HeaderOf(link));
+		link = next;
+	}
+}
+
+void *GearmanArena::AllocShared(size_t size) {
+	return FromSystem(NULL, GEARMAN_ARENA_LARGE, size);
+}
+
+void GearmanArena::Release(void *ptr) {
+	if(ptr == NULL)
+		return;
+
+	BlockHeader *block = HeaderOf(ptr);
+	GearmanArena *owner = block->info.owner;
+
+	if(owner == NULL) {
+		ToSystem(block);
+		return;
+	}
+
+	// Large blocks don't go on a free list, no need to bother the owner
+	if(block->info.cls == GEARMAN_ARENA_LARGE) {
+		owner->Recycle(block);
+		owner->Unref();
+		return;
+	}
+
+	// The remote list links the payloads, the header has to keep its size class
+	BlockHeader *link = (BlockHeader *) ptr;
+	BlockHeader *head;
+	do {
+		head = owner->m_Remote;
+		link->next = head;
+	} while(!__sync_bool_compare_and_swap(&owner->m_Remote, head, link));
+
+	owner->Unref();
+}
+
+void *GearmanArena::Resize(void *ptr, size_t size) {
+	if(ptr == NULL)
+		return AllocShared(size);
+
+	BlockHeader *block = HeaderOf(ptr);
+	if(block->info.owner != NULL)
+		return block->info.owner->Realloc(ptr, size);
+
+	BlockHeader *grown = (BlockHeader *) realloc(block, sizeof(BlockHeader) + size);
+	if(grown == NULL)
+		return NULL;
+
+	__sync_add_and_fetch(&g_ArenaStats.system, size - grown->info.size);
+	grown->info.size = size;
+	return grown + 1;
+}
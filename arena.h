@@ -0,0 +1,84 @@
+#ifndef _INCLUDE_GEARMAN_ARENA_H_
+#define _INCLUDE_GEARMAN_ARENA_H_
+
+#include "smsdk_ext.h"
+
+#include <libgearman-1.0/gearman.h>
+#include <string.h>
+
+/* Size classes go from 64 bytes up to 64KB, anything bigger comes straight from malloc */
+#define GEARMAN_ARENA_CLASSES		11
+#define GEARMAN_ARENA_MIN_SHIFT		6
+
+/* Free blocks one arena keeps per size class, in bytes (at least 4 blocks) */
+#define GEARMAN_ARENA_CACHE_BYTES	(256 * 1024)
+
+/* Totals over every arena, for the memory report */
+struct gearman_arena_stats {
+	volatile unsigned int arenas;
+	volatile unsigned int allocs;		/* Requests from libgearman */
+	volatile unsigned int hits;			/* ... served from a free list */
+	volatile unsigned int large;		/* ... too big for any size class */
+	volatile size_t requested;			/* Live bytes asked for */
+	volatile size_t inUse;				/* Live bytes handed out, including rounding */
+	volatile size_t cached;				/* Free bytes kept for reuse */
+	volatile size_t system;				/* Bytes currently taken from malloc */
+};
+
+extern gearman_arena_stats g_ArenaStats;
+
+/**
+ * Size-class pool allocator for one libgearman client or worker.
+ *
+ * libgearman allocates packet arguments and payloads (task results, job workloads)
+ * through it. Those calls are already serialized per client/worker (its I/O thread, or
+ * the worker lock), so the free lists need no locking. Payloads taken over with
+ * gearman_task_take_data or gearman_job_take_workload end up being freed anywhere;
+ * Release pushes those onto a lock-free list the owning side reclaims on its next
+ * allocation.
+ *
+ * Every block records its arena, and the arena lives until its client/worker is gone
+ * and every block it handed out came back.
+ */
+class GearmanArena {
+public:
+	static GearmanArena *Create();
+
+	void Install(gearman_client_st *client);
+	void Install(gearman_worker_st *worker);
+
+	/* The client/worker was freed, the arena goes once its last block is released */
+	void Close();
+public:
+	/* Owning side, as called by libgearman */
+	void *Alloc(size_t size);
+	void *Realloc(void *ptr, size_t size);
+	void Free(void *ptr);
+public:
+	/* Memory that isn't owned by any arena but can be released like arena memory */
+	static void *AllocShared(size_t size);
+
+	/* Any thread, for memory that was taken from libgearman (or AllocShared) */
+	static void Release(void *ptr);
+
+	/* Owning side only, like Realloc but also works on AllocShared memory */
+	static void *Resize(void *ptr, size_t size);
+private:
+	GearmanArena();
+	~GearmanArena();
+private:
+	union BlockHeader;
+	static BlockHeader *HeaderOf(void *ptr);
+	static void *FromSystem(GearmanArena *owner, unsigned int cls, size_t size);
+	static void ToSystem(BlockHeader *block);
+	void Recycle(BlockHeader *block);
+	void ReclaimRemote();
+	void Unref();
+private:
+	BlockHeader *m_Free[GEARMAN_ARENA_CLASSES];
+	unsigned int m_FreeCount[GEARMAN_ARENA_CLASSES];
+	BlockHeader * volatile m_Remote;	/* Released elsewhere, waiting for the owning side */
+	volatile int m_Refs;				/* 1 for the client/worker, 1 per live block */
+};
+
+#endif // _INCLUDE_GEARMAN_ARENA_H_
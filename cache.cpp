@@ -0,0 +1,217 @@
+#include "cache.h"
+
+#include <string.h>
+
+#include "dispatch.h"
+
+GearmanCache g_Cache;
+
+GearmanCache::GearmanCache() : m_LruHead(NULL), m_LruTail(NULL), m_Count(0), m_Used(0), m_Limit(GEARMAN_CACHE_DEFAULT_LIMIT) {
+	for(unsigned int i = 0; i < GEARMAN_CACHE_BUCKETS; i++)
+		m_Buckets[i] = NULL;
+}
+
+GearmanCache::~GearmanCache() {
+	Clear();
+}
+
+// FNV-1a over the function's config, which is unique per name, and the workload
+uint32_t GearmanCache::HashOf(gearman_cache_fn *function, const char *key, size_t keySize) {
+	uint32_t hash = 2166136261u;
+	const unsigned char *c = (const unsigned char *) &function;
+	for(size_t i = 0; i < sizeof(function); i++) {
+		hash ^= c[i];
+		hash *= 16777619u;
+	}
+
+	c = (const unsigned char *) key;
+	for(size_t i = 0; i < keySize; i++) {
+		hash ^= c[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+gearman_cache_fn *GearmanCache::GetFunction(const char *name) const {
+	for(size_t i = 0; i < m_Functions.size(); i++) {
+		if(m_Functions[i]->ttl != 0 && strcmp(m_Functions[i]->name, name) == 0)
+			return m_Functions[i];
+	}
+	return NULL;
+}
+
+void GearmanCache::SetFunction(const char *name, uint64_t ttl) {
+	gearman_cache_fn *function = NULL;
+	for(size_t i = 0; i < m_Functions.size() && function == NULL; i++) {
+		if(strcmp(m_Functions[i]->name, name) == 0)
+			function = m_Functions[i];
+	}
+
+	if(function == NULL) {
+		if(ttl == 0)
+			return;
+
+		// Tasks keep a pointer to it, so it isn't freed when turned off
+		function = new gearman_cache_fn;
+		function->name = strdup(name);
+		function->stats = g_Stats.Find(name);
+		m_Functions.push_back(function);
+	}
+
+	function->ttl = ttl;
+	if(ttl == 0)
+		Purge(function);
+}
+
+gearman_cache_entry *GearmanCache::Find(gearman_cache_fn *function, uint32_t hash, const char *key, size_t keySize) const {
+	for(gearman_cache_entry *entry = m_Buckets[hash & (GEARMAN_CACHE_BUCKETS - 1)]; entry != NULL; entry = entry->next) {
+		if(entry->hash == hash && entry->function == function && entry->keySize == keySize && memcmp(entry->key, key, keySize) == 0)
+			return entry;
+	}
+	return NULL;
+}
+
+const gearman_cache_entry *GearmanCache::Lookup(gearman_cache_fn *function, const char *key, size_t keySize) {
+	gearman_cache_entry *entry = Find(function, HashOf(function, key, keySize), key, keySize);
+
+	if(entry != NULL && entry->expires <= Gearman_GetMicroseconds()) {
+		Remove(entry);
+		entry = NULL;
+	}
+
+	if(entry == NULL) {
+		__sync_add_and_fetch(&function->stats->counters[GearmanStat_CacheMisses], 1);
+		return NULL;
+	}
+
+	__sync_add_and_fetch(&function->stats->counters[GearmanStat_CacheHits], 1);
+	Touch(entry);
+	return entry;
+}
+
+void GearmanCache::Store(gearman_cache_fn *function, const char *key, size_t keySize, const char *data, size_t dataSize) {
+	if(function->ttl == 0)
+		return;
+
+	const size_t size = sizeof(gearman_cache_entry) + keySize + dataSize + 1;
+	if(size > m_Limit)
+		return;
+
+	const uint32_t hash = HashOf(function, key, keySize);
+	gearman_cache_entry *entry = Find(function, hash, key, keySize);
+	if(entry != NULL)
+		Remove(entry);
+
+	while(m_Used + size > m_Limit && m_LruTail != NULL) {
+		__sync_add_and_fetch(&m_LruTail->function->stats->counters[GearmanStat_CacheEvictions], 1);
+		Remove(m_LruTail);
+	}
+
+	entry = (gearman_cache_entry *) malloc(size);
+	entry->function = function;
+	entry->hash = hash;
+	entry->expires = Gearman_GetMicroseconds() + function->ttl;
+	entry->size = size;
+
+	entry->key = (char *) (entry + 1);
+	entry->keySize = keySize;
+	memcpy(entry->key, key, keySize);
+
+	entry->data = entry->key + keySize;
+	entry->dataSize = dataSize;
+	memcpy(entry->data, data, dataSize);
+	entry->data[dataSize] = '\0';
+
+	gearman_cache_entry **bucket = &m_Buckets[hash & (GEARMAN_CACHE_BUCKETS - 1)];
+	entry->next = *bucket;
+	*bucket = entry;
+
+	entry->lruPrev = NULL;
+	entry->lruNext = NULL;
+	Touch(entry);
+
+	m_Count++;
+	m_Used += size;
+}
+
+void GearmanCache::Unlink(gearman_cache_entry *entry) {
+	if(entry->lruPrev != NULL)
+		entry->lruPrev->lruNext = entry->lruNext;
+	else if(m_LruHead == entry)
+		m_LruHead = entry->lruNext;
+
+	if(entry->lruNext != NULL)
+		entry->lruNext->lruPrev = entry->lruPrev;
+	else if(m_LruTail == entry)
+		m_LruTail = entry->lruPrev;
+
+	entry->lruPrev = NULL;
+	entry->lruNext = NULL;
+}
+
+// Moves the entry to the front of the LRU list
+void GearmanCache::Touch(gearman_cache_entry *entry) {
+	Unlink(entry);
+
+	entry->lruNext = m_LruHead;
+	if(m_LruHead != NULL)
+		m_LruHead->lruPrev = entry;
+	m_LruHead = entry;
+
+	if(m_LruTail == NULL)
+		m_LruTail = entry;
+}
+
+void GearmanCache::Remove(gearman_cache_entry *entry) {
+	gearman_cache_entry **link = &m_Buckets[entry->hash & (GEARMAN_CACHE_BUCKETS - 1)];
+	while(*link != entry)
+		link = &(*link)->next;
+	*link = entry->next;
+
+	Unlink(entry);
+	m_Count--;
+	m_Used -= entry->size;
+	free(entry);
+}
+
+void GearmanCache::Purge(gearman_cache_fn *function) {
+	gearman_cache_entry *entry = m_LruHead;
+	while(entry != NULL) {
+		gearman_cache_entry *next = entry->lruNext;
+		if(function == NULL || entry->function == function)
+			Remove(entry);
+		entry = next;
+	}
+}
+
+void GearmanCache::SetMemoryLimit(size_t bytes) {
+	m_Limit = bytes;
+
+	while(m_Used > m_Limit && m_LruTail != NULL) {
+		__sync_add_and_fetch(&m_LruTail->function->stats->counters[GearmanStat_CacheEvictions], 1);
+		Remove(m_LruTail);
+	}
+}
+
+size_t GearmanCache::GetMemoryLimit() const {
+	return m_Limit;
+}
+
+size_t GearmanCache::GetMemoryUsed() const {
+	return m_Used;
+}
+
+size_t GearmanCache::GetCount() const {
+	return m_Count;
+}
+
+// The stats entries the functions point to are cleared after this
+void GearmanCache::Clear() {
+	Purge(NULL);
+
+	for(size_t i = 0; i < m_Functions.size(); i++) {
+		free(m_Functions[i]->name);
+		delete m_Functions[i];
+	}
+	m_Functions.clear();
+}
@@ -0,0 +1,87 @@
+#ifndef _INCLUDE_GEARMAN_CACHE_H_
+#define _INCLUDE_GEARMAN_CACHE_H_
+
+#include "smsdk_ext.h"
+
+#include <sh_vector.h>
+
+#include "stats.h"
+
+/* Hash chains, a power of two */
+#define GEARMAN_CACHE_BUCKETS		4096
+
+/* Bytes all cached results (with their keys) may take together */
+#define GEARMAN_CACHE_DEFAULT_LIMIT	(4 * 1024 * 1024)
+
+/* A function whose results are cached, lives until the extension unloads */
+struct gearman_cache_fn {
+	char *name;
+	uint64_t ttl;							/* Microseconds, 0 once caching was turned off */
+	gearman_function_stats *stats;
+};
+
+struct gearman_cache_entry {
+	gearman_cache_entry *next;				/* Same bucket */
+	gearman_cache_entry *lruPrev;			/* Towards the most recently used */
+	gearman_cache_entry *lruNext;
+	gearman_cache_fn *function;
+	uint32_t hash;
+	uint64_t expires;
+	size_t size;							/* Everything the entry takes, for the limit */
+
+	char *key;								/* The workload, the data follows it in the same block */
+	size_t keySize;
+	char *data;								/* NUL terminated */
+	size_t dataSize;
+};
+
+/**
+ * Results of tasks for functions that were opted in, keyed by function and workload.
+ *
+ * Game thread only. Entries expire after their function's TTL, and the least recently
+ * used ones are evicted to stay under the memory limit. Hits, misses and evictions are
+ * counted in the function's GearmanStats entry.
+ */
+class GearmanCache {
+public:
+	GearmanCache();
+	~GearmanCache();
+public:
+	/* NULL unless results of the function are cached */
+	gearman_cache_fn *GetFunction(const char *name) const;
+
+	/* ttl in microseconds, 0 turns caching off and drops the function's entries */
+	void SetFunction(const char *name, uint64_t ttl);
+
+	/* NULL on a miss. The entry is valid until the cache is changed. */
+	const gearman_cache_entry *Lookup(gearman_cache_fn *function, const char *key, size_t keySize);
+	void Store(gearman_cache_fn *function, const char *key, size_t keySize, const char *data, size_t dataSize);
+
+	/* NULL for every function */
+	void Purge(gearman_cache_fn *function);
+
+	void SetMemoryLimit(size_t bytes);
+	size_t GetMemoryLimit() const;
+	size_t GetMemoryUsed() const;
+	size_t GetCount() const;
+
+	void Clear();
+private:
+	static uint32_t HashOf(gearman_cache_fn *function, const char *key, size_t keySize);
+	gearman_cache_entry *Find(gearman_cache_fn *function, uint32_t hash, const char *key, size_t keySize) const;
+	void Remove(gearman_cache_entry *entry);
+	void Touch(gearman_cache_entry *entry);
+	void Unlink(gearman_cache_entry *entry);
+private:
+	gearman_cache_entry *m_Buckets[GEARMAN_CACHE_BUCKETS];
+	gearman_cache_entry *m_LruHead;			/* Most recently used */
+	gearman_cache_entry *m_LruTail;
+	SourceHook::CVector<gearman_cache_fn *> m_Functions;
+	size_t m_Count;
+	size_t m_Used;
+	size_t m_Limit;
+};
+
+extern GearmanCache g_Cache;
+
+#endif // _INCLUDE_GEARMAN_CACHE_H_
@@ -0,0 +1,98 @@
+#include "coalesce.h"
+
+#include <string.h>
+
+GearmanFlights g_Flights;
+
+static inline uint32_t Flight_Hash(uint32_t hash, const void *data, size_t size) {
+	const unsigned char *c = (const unsigned char *) data;
+	for(size_t i = 0; i < size; i++) {
+		hash ^= c[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+GearmanFlights::GearmanFlights() : m_Count(0) {
+	for(unsigned int i = 0; i < GEARMAN_FLIGHT_BUCKETS; i++)
+		m_Buckets[i] = NULL;
+}
+
+GearmanFlights::~GearmanFlights() {
+	Clear();
+}
+
+// FNV-1a over everything that makes two tasks the same
+uint32_t GearmanFlights::HashOf(gearman_client_ctx *client, const char *function, const char *key, size_t keySize, bool unique) {
+	uint32_t hash = 2166136261u;
+	hash = Flight_Hash(hash, &client, sizeof(client));
+	hash = Flight_Hash(hash, function, strlen(function) + 1);
+	hash = Flight_Hash(hash, &unique, sizeof(unique));
+	return Flight_Hash(hash, key, keySize);
+}
+
+gearman_flight *GearmanFlights::Find(gearman_client_ctx *client, const char *function, const char *key, size_t keySize, bool unique) const {
+	const uint32_t hash = HashOf(client, function, key, keySize, unique);
+
+	for(gearman_flight *flight = m_Buckets[hash & (GEARMAN_FLIGHT_BUCKETS - 1)]; flight != NULL; flight = flight->next) {
+		if(flight->hash == hash && flight->client == client && flight->unique == unique && flight->keySize == keySize
+			&& strcmp(flight->function, function) == 0 && memcmp(flight->key, key, keySize) == 0)
+			return flight;
+	}
+	return NULL;
+}
+
+gearman_flight *GearmanFlights::Create(gearman_client_ctx *client, const char *function, const char *key, size_t keySize, bool unique, gearman_function_stats *stats) {
+	gearman_flight *flight = new gearman_flight;
+	flight->hash = HashOf(client, function, key, keySize, unique);
+	flight->client = client;
+	flight->function = strdup(function);
+	flight->key = (char *) malloc(keySize > 0 ? keySize : 1);
+	memcpy(flight->key, key, keySize);
+	flight->keySize = keySize;
+	flight->unique = unique;
+	flight->stats = stats;
+
+	gearman_flight **bucket = &m_Buckets[flight->hash & (GEARMAN_FLIGHT_BUCKETS - 1)];
+	flight->next = *bucket;
+	*bucket = flight;
+	m_Count++;
+
+	return flight;
+}
+
+void GearmanFlights::Remove(gearman_flight *flight) {
+	gearman_flight **link = &m_Buckets[flight->hash & (GEARMAN_FLIGHT_BUCKETS - 1)];
+	while(*link != flight)
+		link = &(*link)->next;
+	*link = flight->next;
+	m_Count--;
+
+	free(flight->function);
+	free(flight->key);
+	delete flight;
+}
+
+void GearmanFlights::Detach(gearman_client_ctx *client) {
+	if(m_Count == 0)
+		return;
+
+	for(unsigned int i = 0; i < GEARMAN_FLIGHT_BUCKETS; i++) {
+		for(gearman_flight *flight = m_Buckets[i]; flight != NULL; flight = flight->next) {
+			if(flight->client == client)
+				flight->client = NULL;
+		}
+	}
+}
+
+size_t GearmanFlights::GetCount() const {
+	return m_Count;
+}
+
+// Only once no result can arrive for a flight anymore
+void GearmanFlights::Clear() {
+	for(unsigned int i = 0; i < GEARMAN_FLIGHT_BUCKETS; i++) {
+		while(m_Buckets[i] != NULL)
+			Remove(m_Buckets[i]);
+	}
+}
@@ -0,0 +1,64 @@
+#ifndef _INCLUDE_GEARMAN_COALESCE_H_
+#define _INCLUDE_GEARMAN_COALESCE_H_
+
+#include "smsdk_ext.h"
+
+#include <sh_vector.h>
+
+#include "stats.h"
+
+/* Hash chains, a power of two */
+#define GEARMAN_FLIGHT_BUCKETS	1024
+
+struct gearman_client_ctx;
+
+/**
+ * A task in flight that later identical tasks of the same client wait on instead of
+ * going to the server themselves. Identical means the same function and unique, or the
+ * same workload when there's no unique.
+ */
+struct gearman_flight {
+	gearman_flight *next;					/* Same bucket */
+	uint32_t hash;
+	gearman_client_ctx *client;				/* NULL once the client is closed, nobody joins anymore */
+	char *function;
+	char *key;								/* The unique, or the workload */
+	size_t keySize;
+	bool unique;
+	gearman_function_stats *stats;
+	SourceHook::CVector<Handle_t> waiters;	/* Task handles that get a copy of the result */
+};
+
+/**
+ * The flights of all clients, game thread only.
+ *
+ * A flight is created with its first task and stays in the table until that task's
+ * result was dispatched, then the result is handed to every waiter and the flight is
+ * freed. The table owns flights whose result never arrived.
+ */
+class GearmanFlights {
+public:
+	GearmanFlights();
+	~GearmanFlights();
+public:
+	gearman_flight *Find(gearman_client_ctx *client, const char *function, const char *key, size_t keySize, bool unique) const;
+	gearman_flight *Create(gearman_client_ctx *client, const char *function, const char *key, size_t keySize, bool unique, gearman_function_stats *stats);
+
+	/* Takes the flight out of the table and frees it */
+	void Remove(gearman_flight *flight);
+
+	/* Keeps new tasks from joining the client's flights, which are about to fail */
+	void Detach(gearman_client_ctx *client);
+
+	size_t GetCount() const;
+	void Clear();
+private:
+	static uint32_t HashOf(gearman_client_ctx *client, const char *function, const char *key, size_t keySize, bool unique);
+private:
+	gearman_flight *m_Buckets[GEARMAN_FLIGHT_BUCKETS];
+	size_t m_Count;
+};
+
+extern GearmanFlights g_Flights;
+
+#endif // _INCLUDE_GEARMAN_COALESCE_H_
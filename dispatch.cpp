@@ -0,0 +1,243 @@
+#include "extension.h"
+
+GearmanDispatcher g_Dispatcher;
+
+static __thread GearmanDispatcher::ResultSource *t_pSource = NULL;
+
+GearmanDispatcher::GearmanDispatcher() : m_pLock(NULL), m_NextLane(0), m_FrameBudget(GEARMAN_DEFAULT_FRAME_BUDGET),
+	m_Backlog(0), m_LastFrameTime(0), m_PeakFrameTime(0), m_Dispatching(false) {
+}
+
+void GearmanDispatcher::Init() {
+	m_pLock = g_pThreader->MakeMutex();
+}
+
+void GearmanDispatcher::Shutdown() {
+	if(m_pLock == NULL)
+		return;
+
+	m_pLock->Lock();
+	while(!m_Inbound.empty()) {
+		FreeCallback(m_Inbound.first());
+		m_Inbound.pop();
+	}
+	for(size_t i = 0; i < m_Sources.size(); i++) {
+		gearman_callback cb;
+		while(m_Sources[i]->ring.pop(cb))
+			FreeCallback(cb);
+		delete m_Sources[i];
+	}
+	m_Sources.clear();
+	m_pLock->Unlock();
+
+	for(size_t i = 0; i < m_Lanes.size(); i++) {
+		DispatchLane *lane = m_Lanes[i];
+		while(!lane->pending.empty()) {
+			FreeCallback(lane->pending.first());
+			lane->pending.pop();
+		}
+		delete lane;
+	}
+	m_Lanes.clear();
+	m_Backlog = 0;
+
+	m_pLock->DestroyThis();
+	m_pLock = NULL;
+}
+
+GearmanDispatcher::ResultSource *GearmanDispatcher::AttachThread(volatile bool *running) {
+	ResultSource *source = new ResultSource(running);
+
+	m_pLock->Lock();
+	m_Sources.push_back(source);
+	m_pLock->Unlock();
+
+	t_pSource = source;
+	return source;
+}
+
+void GearmanDispatcher::Push(const gearman_callback &cb) {
+	ResultSource *source = t_pSource;
+
+	if(source != NULL) {
+		// Let the game thread catch up instead of growing without bound
+		while(*source->pRunning) {
+			if(source->ring.try_push(cb)) {
+				source->pushed++;
+				__sync_add_and_fetch(&m_Backlog, 1);
+				return;
+			}
+			g_pThreader->ThreadSleep(1);
+		}
+	}
+
+	m_pLock->Lock();
+	m_Inbound.push(cb);
+	m_pLock->Unlock();
+
+	__sync_add_and_fetch(&m_Backlog, 1);
+}
+
+GearmanDispatcher::DispatchLane *GearmanDispatcher::FindLane(IPluginContext *pContext) {
+	for(size_t i = 0; i < m_Lanes.size(); i++) {
+		if(m_Lanes[i]->pContext == pContext)
+			return m_Lanes[i];
+	}
+
+	DispatchLane *lane = new DispatchLane;
+	lane->pContext = pContext;
+	m_Lanes.push_back(lane);
+	return lane;
+}
+
+void GearmanDispatcher::FreeCallback(gearman_callback &cb) {
+	if(cb.job != NULL) {
+		Gearman_JobRelease(cb.job);
+		cb.job = NULL;
+	}
+	if(cb.data != NULL) {
+		GearmanArena::Release(cb.data);
+		cb.data = NULL;
+	}
+}
+
+void GearmanDispatcher::RunFrame() {
+	if(m_pLock == NULL || m_Dispatching)
+		return;
+
+	const uint64_t start = Gearman_GetMicroseconds();
+
+	SortArrivals();
+
+	DispatchLane *lane = NULL;
+	const size_t lanes = m_Lanes.size();
+	if(lanes == 0) {
+		m_LastFrameTime = 0;
+		return;
+	}
+
+	// Take one callback from each lane in turn until every lane is empty or
+	// the budget is spent. At least one callback always runs so a single slow
+	// callback can't stall the queue forever.
+	size_t i = m_NextLane % lanes;
+	size_t idle = 0;
+	uint64_t now = start;
+
+	while(idle < lanes) {
+		lane = m_Lanes[i];
+		i = (i + 1) % lanes;
+
+		if(lane->pending.empty()) {
+			idle++;
+			continue;
+		}
+		idle = 0;
+
+		gearman_callback cb = lane->pending.first();
+		lane->pending.pop();
+		__sync_sub_and_fetch(&m_Backlog, 1);
+
+		m_Dispatching = true;
+		Gearman_DispatchCallback(cb);
+		m_Dispatching = false;
+		FreeCallback(cb);
+
+		now = Gearman_GetMicroseconds();
+		if(m_FrameBudget != 0 && now - start >= m_FrameBudget)
+			break;
+	}
+
+	// Resume with the next plugin in line on the following frame
+	m_NextLane = i;
+
+	// Drop lanes of plugins that have nothing left
+	for(size_t j = 0; j < m_Lanes.size(); ) {
+		if(m_Lanes[j]->pending.empty()) {
+			delete m_Lanes[j];
+			m_Lanes.erase(m_Lanes.begin() + j);
+			if(m_NextLane > j)
+				m_NextLane--;
+		} else {
+			j++;
+		}
+	}
+
+	m_LastFrameTime = (unsigned int) (now - start);
+	if(m_LastFrameTime > m_PeakFrameTime)
+		m_PeakFrameTime = m_LastFrameTime;
+}
+
+// Sorts new arrivals into their plugin's lane
+void GearmanDispatcher::SortArrivals() {
+	m_pLock->Lock();
+	DispatchLane *lane = NULL;
+	gearman_callback arrival;
+	for(size_t i = 0; i < m_Sources.size(); i++) {
+		while(m_Sources[i]->ring.pop(arrival)) {
+			if(lane == NULL || lane->pContext != arrival.pContext)
+				lane = FindLane(arrival.pContext);
+			lane->pending.push(arrival);
+		}
+	}
+	while(!m_Inbound.empty()) {
+		gearman_callback &cb = m_Inbound.first();
+		if(lane == NULL || lane->pContext != cb.pContext)
+			lane = FindLane(cb.pContext);
+		lane->pending.push(cb);
+		m_Inbound.pop();
+	}
+	m_pLock->Unlock();
+}
+
+// What's left in the plugin's lane would only be dropped when dispatched. Results
+// other tasks wait on are kept, the tasks may belong to another plugin.
+void GearmanDispatcher::DropPlugin(IPluginContext *pContext) {
+	if(m_pLock == NULL)
+		return;
+
+	// What the I/O threads already produced for the plugin is still in the rings
+	SortArrivals();
+
+	for(size_t i = 0; i < m_Lanes.size(); i++) {
+		DispatchLane *lane = m_Lanes[i];
+		if(lane->pContext != pContext)
+			continue;
+
+		for(size_t count = lane->pending.size(); count > 0; count--) {
+			gearman_callback cb = lane->pending.first();
+			lane->pending.pop();
+
+			if(cb.flight != NULL) {
+				lane->pending.push(cb);
+			} else {
+				FreeCallback(cb);
+				__sync_sub_and_fetch(&m_Backlog, 1);
+			}
+		}
+		return;
+	}
+}
+
+void GearmanDispatcher::SetFrameBudget(unsigned int usec) {
+	m_FrameBudget = usec;
+}
+
+unsigned int GearmanDispatcher::GetFrameBudget() const {
+	return m_FrameBudget;
+}
+
+bool GearmanDispatcher::IsDispatching() const {
+	return m_Dispatching;
+}
+
+unsigned int GearmanDispatcher::GetBacklog() const {
+	return m_Backlog;
+}
+
+unsigned int GearmanDispatcher::GetLastFrameTime() const {
+	return m_LastFrameTime;
+}
+
+unsigned int GearmanDispatcher::GetPeakFrameTime() const {
+	return m_PeakFrameTime;
+}
@@ -0,0 +1,127 @@
+#ifndef _INCLUDE_GEARMAN_DISPATCH_H_
+#define _INCLUDE_GEARMAN_DISPATCH_H_
+
+#include "smsdk_ext.h"
+
+#include <IThreader.h>
+#include <sm_queue.h>
+#include <sm_ring.h>
+#include <sh_vector.h>
+#include <time.h>
+
+/* Default per-frame callback budget in microseconds, 0 means unlimited */
+#define GEARMAN_DEFAULT_FRAME_BUDGET	1000
+
+/* Callbacks one I/O thread can have waiting for the game thread */
+#define GEARMAN_RESULT_CAPACITY			16384
+
+enum GearmanCallbackType {
+	GearmanCallback_Created,
+	GearmanCallback_Status,
+	GearmanCallback_Warning,
+	GearmanCallback_Data,			/* A chunk of partial result (WORK_DATA) */
+	GearmanCallback_Exception,		/* The extension fails the task right after */
+	GearmanCallback_Complete,
+	GearmanCallback_Fail,
+	GearmanCallback_BatchComplete,	/* A task of a batch, numerator is its index */
+	GearmanCallback_BatchFail,
+	GearmanCallback_Job
+};
+
+struct gearman_job_ctx;
+struct gearman_flight;
+
+/**
+ * A task event or worker job captured on a network thread, to be dispatched on the game thread.
+ * Everything needed by the plugin callback is copied so libgearman can reuse its buffers.
+ */
+struct gearman_callback {
+	GearmanCallbackType type;
+	IPluginContext *pContext;	/* Owning plugin, only used to pick a dispatch lane */
+	Handle_t hndl;
+	gearman_job_ctx *job;		/* Jobs only, released unless the dispatch takes it */
+	gearman_flight *flight;		/* Final task events only, tasks waiting for the same result */
+	uint32_t numerator;
+	uint32_t denominator;
+	char *data;
+	size_t dataSize;
+};
+
+// Monotonic, so deadlines and latencies don't jump when the wall clock is set
+static inline uint64_t Gearman_GetMicroseconds() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * Hands queued callbacks to plugins on the game thread.
+ *
+ * Callbacks are sorted into one lane per owning plugin and the lanes are served
+ * round-robin, so a plugin with a large backlog can't starve the others. Each frame
+ * stops once the budget is used up and the rest carries over to the next frame.
+ *
+ * Each I/O thread gets its own SPSC ring to the game thread. Anything else (the game
+ * thread itself, or an I/O thread that is being stopped) goes through the locked inbound queue.
+ */
+class GearmanDispatcher {
+public:
+	struct ResultSource {
+		ResultSource(volatile bool *running) : ring(GEARMAN_RESULT_CAPACITY, RingOverflow_Reject), pRunning(running), pushed(0) {
+		}
+		SPSCRing<gearman_callback> ring;
+		volatile bool *pRunning;	/* Stop waiting for room once this goes false */
+		unsigned int pushed;		/* Written by the owning thread only */
+	};
+private:
+	struct DispatchLane {
+		IPluginContext *pContext;
+		Queue<gearman_callback> pending;
+	};
+public:
+	GearmanDispatcher();
+public:
+	void Init();
+	void Shutdown();
+
+	/* Called by an I/O thread before it produces callbacks */
+	ResultSource *AttachThread(volatile bool *running);
+
+	/* Safe to call from any thread */
+	void Push(const gearman_callback &cb);
+
+	/* Game thread only */
+	void RunFrame();
+	void DropPlugin(IPluginContext *pContext);
+
+	/* A callback is running, RunFrame does nothing until it returns */
+	bool IsDispatching() const;
+public:
+	void SetFrameBudget(unsigned int usec);
+	unsigned int GetFrameBudget() const;
+	unsigned int GetBacklog() const;
+	unsigned int GetLastFrameTime() const;
+	unsigned int GetPeakFrameTime() const;
+private:
+	DispatchLane *FindLane(IPluginContext *pContext);
+	void SortArrivals();
+	void FreeCallback(gearman_callback &cb);
+private:
+	IMutex *m_pLock;					/* Guards m_Inbound and m_Sources */
+	Queue<gearman_callback> m_Inbound;
+	CVector<ResultSource *> m_Sources;
+	CVector<DispatchLane *> m_Lanes;	/* Game thread only */
+	size_t m_NextLane;
+	unsigned int m_FrameBudget;
+	volatile unsigned int m_Backlog;
+	unsigned int m_LastFrameTime;
+	unsigned int m_PeakFrameTime;
+	bool m_Dispatching;					/* Inside a callback, RunFrame isn't reentrant */
+};
+
+extern GearmanDispatcher g_Dispatcher;
+
+void Gearman_DispatchCallback(gearman_callback &cb);
+void Gearman_JobRelease(gearman_job_ctx *ctx);
+
+#endif // _INCLUDE_GEARMAN_DISPATCH_H_
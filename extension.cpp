@@ -33,14 +33,24 @@
 #include <string.h>
 
 #include "extension.h"
-#include "worker.h"
+#include "iothread.h"
 
 Gearman g_Gearman;		/**< Global singleton for extension's main interface */
 
 SMEXT_LINK(&g_Gearman);
 
 IThreader *g_pThreader = NULL;
+
+ObjectPool<gearman_client_ctx> g_ClientPool;
+ObjectPool<gearman_task_ctx> g_TaskPool;
+ObjectPool<gearman_worker_cb> g_WorkerCallbackPool;
+ObjectPool<gearman_job_ctx> g_JobPool;
+ObjectPool<gearman_buffer> g_BufferPool;
  
+static void Gearman_GameFrame(bool simulating);
+static void Gearman_WorkerClose(gearman_worker_ctx *ctx);
+static void Gearman_BatchClose(gearman_batch *batch);
+
 bool Gearman::SDK_OnLoad(char *error, size_t err_max, bool late) {
 	sharesys->AddNatives(myself, GearmanNatives);
 	sharesys->RegisterLibrary(myself, "gearman");
@@ -49,14 +59,54 @@ bool Gearman::SDK_OnLoad(char *error, size_t err_max, bool late) {
 	gearmanWorkerHandleType = g_pHandleSys->CreateType("GearmanWorker", this, 0, NULL, NULL, myself->GetIdentity(), NULL);
 	gearmanJobHandleType = g_pHandleSys->CreateType("GearmanJob", this, 0, NULL, NULL, myself->GetIdentity(), NULL);
 	gearmanTaskHandleType = g_pHandleSys->CreateType("GearmanTask", this, 0, NULL, NULL, myself->GetIdentity(), NULL);
+	gearmanBufferHandleType = g_pHandleSys->CreateType("GearmanBuffer", this, 0, NULL, NULL, myself->GetIdentity(), NULL);
+	gearmanBatchHandleType = g_pHandleSys->CreateType("GearmanBatch", this, 0, NULL, NULL, myself->GetIdentity(), NULL);
+
+	rootconsole->AddRootConsoleCommand3("gearman", "Gearman extension", this);
+	plsys->AddPluginsListener(this);
+
+	m_Draining = false;
 	return true;
 }
 
 void Gearman::SDK_OnUnload() {
+	rootconsole->RemoveRootConsoleCommand("gearman", this);
+	plsys->RemovePluginsListener(this);
+	smutils->RemoveGameFrameHook(Gearman_GameFrame);
+
+	// Give what's in flight a chance to reach the servers. Whatever is left fails with
+	// the client, background tasks go to the client's spool if it has one.
+	unsigned int timeout = GEARMAN_DEFAULT_DRAIN_TIMEOUT;
+	const char *value = smutils->GetCoreConfigValue("GearmanDrainTimeout");
+	if(value != NULL && atoi(value) >= 0)
+		timeout = atoi(value);
+
+	Drain(timeout);
+	m_Draining = true;
+
+	KillIOThreads();
+
 	g_pHandleSys->RemoveType(g_Gearman.gearmanClientHandleType, NULL);
 	g_pHandleSys->RemoveType(g_Gearman.gearmanWorkerHandleType, NULL);
 	g_pHandleSys->RemoveType(g_Gearman.gearmanJobHandleType, NULL);
 	g_pHandleSys->RemoveType(g_Gearman.gearmanTaskHandleType, NULL);
+	g_pHandleSys->RemoveType(g_Gearman.gearmanBufferHandleType, NULL);
+	g_pHandleSys->RemoveType(g_Gearman.gearmanBatchHandleType, NULL);
+
+	// Their handles are gone, so they own nothing anymore
+	for(size_t i = 0; i < m_Plugins.size(); i++)
+		delete m_Plugins[i];
+	m_Plugins.clear();
+
+	g_Dispatcher.Shutdown();
+	g_Flights.Clear();
+	g_Cache.Clear();
+
+	for(unsigned int i = 0; i < m_IOThreadCount; i++)
+		delete m_IOThreads[i];
+	m_IOThreadCount = 0;
+
+	g_Stats.Clear();
 }
 
 bool Gearman::QueryRunning(char* error, size_t maxlength) {
@@ -66,36 +116,45 @@ bool Gearman::QueryRunning(char* error, size_t maxlength) {
 
 void Gearman::SDK_OnAllLoaded() {
 	SM_GET_LATE_IFACE(THREADER, g_pThreader);    	
-	m_pQueueLock = g_pThreader->MakeMutex();
+	g_Dispatcher.Init();
+
+	StartIOThreads();
+
+	smutils->AddGameFrameHook(Gearman_GameFrame);
 }
 
 void Gearman::OnHandleDestroy(HandleType_t type, void *object) {
 	if(object != NULL) {
 		if(type == gearmanClientHandleType) {
 			gearman_client_ctx *ctx = (gearman_client_ctx *) object;
-			if(ctx->client != NULL)
-				gearman_client_free(ctx->client);
-			// The worker with run_tasks might still be using this. This might not be needed.
-			ctx->client = NULL;
-			
-			free(ctx);
+			g_Flights.Detach(ctx);
+
+			// The owning I/O thread may be in run_tasks, let it free the client
+			ctx->thread->Close(ctx);
 		} else if(type == gearmanWorkerHandleType) {
 			gearman_worker_ctx *ctx = (gearman_worker_ctx *) object;
-			if(ctx->worker != NULL)
-				gearman_worker_free(ctx->worker);
-			// GearmanWorkerThread might be attempting to use this, not sure if _free sets it to 0. This might not be needed.
-			ctx->worker = NULL;
+			RemoveWorker(ctx);
+
+			for(size_t i = 0; i < ctx->clones.size(); i++)
+				Gearman_WorkerClose(ctx->clones[i]);
+			ctx->clones.clear();
 
-			free(ctx);
+			Gearman_WorkerClose(ctx);
 		} else if(type == gearmanJobHandleType) {
-			gearman_job_free((gearman_job_st *) object);
+			Gearman_JobRelease((gearman_job_ctx *) object);
 		} else if(type == gearmanTaskHandleType) {
-			gearman_task_ctx *ctx = (gearman_task_ctx *) object;
-			if(ctx->task != NULL)
-				gearman_task_free(ctx->task);
-			// I have no idea if anything uses this still. This might not be needed.
-			ctx->task = NULL;
-			free(ctx);
+			RemoveTask((gearman_task_ctx *) object);
+
+			// libgearman frees the task itself once it finishes (GEARMAN_CLIENT_FREE_TASKS),
+			// so only drop the handle's reference here.
+			Gearman_TaskRelease((gearman_task_ctx *) object);
+		} else if(type == gearmanBufferHandleType) {
+			gearman_buffer *buffer = (gearman_buffer *) object;
+			GearmanArena::Release(buffer->data);
+			g_BufferPool.Free(buffer);
+		} else if(type == gearmanBatchHandleType) {
+			RemoveBatch((gearman_batch *) object);
+			Gearman_BatchClose((gearman_batch *) object);
 		}
 	}
 }
@@ -128,12 +187,12 @@ gearman_worker_ctx* Gearman::GetGearmanWorkerInstanceByHandle(Handle_t handle) {
 	return worker;
 }
 
-gearman_job_st* Gearman::GetGearmanJobInstanceByHandle(Handle_t handle) {
+gearman_job_ctx* Gearman::GetGearmanJobInstanceByHandle(Handle_t handle) {
 	HandleSecurity sec;
 	sec.pOwner = NULL;
 	sec.pIdentity = myself->GetIdentity();
 	
-	gearman_job_st *job;
+	gearman_job_ctx *job;
 
 	if (g_pHandleSys->ReadHandle(handle, g_Gearman.gearmanJobHandleType, &sec, (void**)&job) != HandleError_None)
 		return NULL;
@@ -148,129 +207,345 @@ gearman_task_ctx* Gearman::GetGearmanTaskCtxInstanceByHandle(Handle_t handle) {
 	
 	gearman_task_ctx *task;
 
-	if (g_pHandleSys->ReadHandle(handle, g_Gearman.gearmanJobHandleType, &sec, (void**) &task) != HandleError_None)
+	if (g_pHandleSys->ReadHandle(handle, g_Gearman.gearmanTaskHandleType, &sec, (void**) &task) != HandleError_None)
 		return NULL;
 
 	return task;
 }
 
+gearman_buffer* Gearman::GetGearmanBufferInstanceByHandle(Handle_t handle) {
+	HandleSecurity sec;
+	sec.pOwner = NULL;
+	sec.pIdentity = myself->GetIdentity();
+	
+	gearman_buffer *buffer;
+
+	if (g_pHandleSys->ReadHandle(handle, g_Gearman.gearmanBufferHandleType, &sec, (void**) &buffer) != HandleError_None)
+		return NULL;
+
+	return buffer;
+}
+
+gearman_batch* Gearman::GetGearmanBatchInstanceByHandle(Handle_t handle) {
+	HandleSecurity sec;
+	sec.pOwner = NULL;
+	sec.pIdentity = myself->GetIdentity();
+	
+	gearman_batch *batch;
+
+	if (g_pHandleSys->ReadHandle(handle, g_Gearman.gearmanBatchHandleType, &sec, (void**) &batch) != HandleError_None)
+		return NULL;
+
+	return batch;
+}
+
 // Parsing of tasks
 
-static gearman_return_t Gearman_TaskCreatedFn(gearman_task_st *task) {
-	gearman_task_ctx *ctx = (gearman_task_ctx *) gearman_task_context(task);
+// These run on the client thread inside gearman_client_run_tasks, so they only
+// capture the event; Gearman::RunFrame hands it to the plugin on the game thread.
+
+static void Gearman_BatchRelease(gearman_batch *batch) {
+	if(__sync_sub_and_fetch(&batch->refs, 1) == 0) {
+		free(batch->workload);
+		delete [] batch->results;
+		delete batch;
+	}
+}
+
+// Game thread. Results that didn't arrive yet are dropped along with the handle.
+static void Gearman_BatchClose(gearman_batch *batch) {
+	for(unsigned int i = 0; i < batch->count; i++) {
+		GearmanArena::Release(batch->results[i].data);
+		batch->results[i].data = NULL;
+	}
+
+	Gearman_BatchRelease(batch);
+}
+
+void Gearman_TaskRelease(gearman_task_ctx *ctx) {
+	if(__sync_sub_and_fetch(&ctx->refs, 1) == 0) {
+		free(ctx->function);
+		free(ctx->unique);
+		if(ctx->batch != NULL)
+			Gearman_BatchRelease(ctx->batch);
+		else
+			free(ctx->workload);
+		g_TaskPool.Free(ctx);
+	}
+}
+
+// Game thread
+static void Gearman_WorkerClose(gearman_worker_ctx *ctx) {
+	// Once running, the owning I/O thread frees the worker between passes.
+	// Either way it stays around until the plugin let go of all its jobs.
+	if(ctx->thread != NULL) {
+		ctx->thread->Close(ctx);
+	} else {
+		ctx->closing = true;
+		if(ctx->jobs == 0)
+			Gearman_WorkerFree(ctx);
+	}
+}
+
+static void Gearman_WorkerCallbackRelease(gearman_worker_cb *callback) {
+	if(__sync_sub_and_fetch(&callback->refs, 1) == 0) {
+		free(callback->name);
+		g_WorkerCallbackPool.Free(callback);
+	}
+}
+
+void Gearman_WorkerFree(gearman_worker_ctx *ctx) {
+	if(ctx->worker != NULL)
+		gearman_worker_free(ctx->worker);
+	ctx->arena->Close();
+
+	// Clones of the same handle share the callbacks
+	for(size_t i = 0; i < ctx->functions.size(); i++)
+		Gearman_WorkerCallbackRelease(ctx->functions[i].callback);
+
+	while(!ctx->commands.empty()) {
+		free(ctx->commands.first().data);
+		ctx->commands.pop();
+	}
+
+	ctx->lock->DestroyThis();
+	delete ctx;
+}
+
+// The in-flight list is only touched by the client's I/O thread
+void Gearman_TaskLink(gearman_task_ctx *ctx) {
+	gearman_client_ctx *client = ctx->cContext;
+
+	ctx->inflightPrev = NULL;
+	ctx->inflightNext = client->inflight;
+	if(client->inflight != NULL)
+		client->inflight->inflightPrev = ctx;
+	client->inflight = ctx;
+	ctx->linked = true;
+	ctx->server->tasks++;
+}
+
+void Gearman_TaskUnlink(gearman_task_ctx *ctx) {
+	if(!ctx->linked)
+		return;
+
+	gearman_client_ctx *client = ctx->cContext;
+
+	if(ctx->inflightPrev != NULL)
+		ctx->inflightPrev->inflightNext = ctx->inflightNext;
+	else
+		client->inflight = ctx->inflightNext;
+
+	if(ctx->inflightNext != NULL)
+		ctx->inflightNext->inflightPrev = ctx->inflightPrev;
+
+	ctx->inflightPrev = NULL;
+	ctx->inflightNext = NULL;
+	ctx->linked = false;
+	ctx->server->tasks--;
+	GearmanTimerWheel::Cancel(&ctx->timer);
+}
+
+static void Gearman_TaskContextFree(gearman_task_st *task, void *context) {
+	gearman_task_ctx *ctx = (gearman_task_ctx *) context;
 
 	if(ctx == NULL)
-		return GEARMAN_FAIL;
+		return;
 
-	if(ctx->createdfunc != 0) {
-		// functag GearmanCreateCallback public(Handle:task);
-		IPluginFunction *pFunction = ctx->pContext->GetFunctionById(ctx->createdfunc);
-		if(pFunction == NULL)
-			return GEARMAN_SUCCESS;
+	Gearman_TaskUnlink(ctx);
+	ctx->task = NULL;
 
-		pFunction->PushCell(ctx->hndl);
-	
-		cell_t result = 0;
-		pFunction->Execute(&result);
-		return GEARMAN_SUCCESS;
+	// Anything libgearman ends without a result still gets its final event
+	if(!ctx->finished) {
+		const char *error = "The task ended without a result";
+		Gearman_QueueTaskEvent(ctx, GearmanCallback_Fail, error, strlen(error));
 	}
 
-	if(ctx->cContext != NULL && ctx->cContext->createdFunc != 0) {
-		// functag GearmanCreateCallback public(Handle:task);
-		IPluginFunction *pFunction = ctx->pContext->GetFunctionById(ctx->cContext->createdFunc);
-		if(pFunction == NULL)
-			return GEARMAN_SUCCESS;
+	Gearman_TaskRelease(ctx);
+}
 
-		pFunction->PushCell(ctx->hndl);
-	
-		cell_t result = 0;
-		pFunction->Execute(&result);
-		return GEARMAN_SUCCESS;
+// Grows memory taken from libgearman by a terminator so it can be pushed as a string.
+// Usually done in place (the arena rounds up to its size class), unlike copying it.
+static char *Gearman_TerminateData(void *data, size_t dataSize) {
+	char *buffer = (char *) GearmanArena::Resize(data, dataSize + 1);
+	buffer[dataSize] = '\0';
+	return buffer;
+}
+
+// Takes ownership of data, which must be NUL terminated (or NULL)
+static void Gearman_PushTaskEvent(gearman_task_ctx *ctx, GearmanCallbackType type, char *data, size_t dataSize) {
+	gearman_flight *flight = NULL;
+	GearmanSpool *spool = ctx->cContext->spool;
+
+	// A background task no server took is kept for later, and completes without a job
+	// handle. This is on the client's I/O thread, or wherever it's freed.
+	if(type == GearmanCallback_Fail && ctx->background && !ctx->replay && !ctx->finished && spool != NULL
+		&& spool->Append(ctx->function, ctx->unique, ctx->workload, ctx->workloadSize, ctx->priority)) {
+		__sync_add_and_fetch(&ctx->stats->counters[GearmanStat_Spooled], 1);
+
+		GearmanArena::Release(data);
+		data = (char *) GearmanArena::AllocShared(1);
+		data[0] = '\0';
+		dataSize = 0;
+		type = GearmanCallback_Complete;
 	}
 
-	return GEARMAN_SUCCESS;
+	// Every way a task can end goes through here, on whichever thread ended it
+	if((type == GearmanCallback_Complete || type == GearmanCallback_Fail) && !ctx->finished) {
+		ctx->finished = true;
+		ctx->finishTime = Gearman_GetMicroseconds();
+
+		gearman_function_stats *stats = ctx->stats;
+		__sync_add_and_fetch(&stats->counters[type == GearmanCallback_Complete ? GearmanStat_Completed : GearmanStat_Failed], 1);
+		__sync_sub_and_fetch(&stats->counters[GearmanStat_InFlight], 1);
+
+		if(ctx->createdTime != 0)
+			stats->latency[GearmanLatency_Run].Record(ctx->finishTime - ctx->createdTime);
+
+		flight = ctx->flight;
+
+		if(ctx->replay)
+			spool->Replayed(type == GearmanCallback_Complete);
+	}
+
+	// The created event only comes from the I/O thread, and means a server is there
+	if(type == GearmanCallback_Created && spool != NULL)
+		spool->Recovered();
+
+	if(ctx->replay || (ctx->cancelled && flight == NULL) || (ctx->batch != NULL && ctx->batch->cancelled)) {
+		GearmanArena::Release(data);
+		return;
+	}
+
+	gearman_callback cb;
+	cb.type = type;
+	cb.pContext = ctx->pContext;
+	cb.hndl = ctx->hndl;
+	cb.job = NULL;
+	cb.flight = flight;
+	cb.numerator = 0;
+	cb.denominator = 0;
+	cb.data = data;
+	cb.dataSize = dataSize;
+
+	// A batch only reports how its tasks ended, through the batch's handle
+	if(ctx->batch != NULL) {
+		if(type != GearmanCallback_Complete && type != GearmanCallback_Fail) {
+			GearmanArena::Release(data);
+			return;
+		}
+
+		cb.type = (type == GearmanCallback_Complete) ? GearmanCallback_BatchComplete : GearmanCallback_BatchFail;
+		cb.hndl = ctx->batch->hndl;
+		cb.numerator = ctx->batchIndex;
+		g_Dispatcher.Push(cb);
+		return;
+	}
+
+	if(ctx->task != NULL) {
+		cb.numerator = gearman_task_numerator(ctx->task);
+		cb.denominator = gearman_task_denominator(ctx->task);
+	}
+
+	g_Dispatcher.Push(cb);
 }
 
-static gearman_return_t Gearman_TaskStatusFn(gearman_task_st *task) {
+void Gearman_QueueTaskEvent(gearman_task_ctx *ctx, GearmanCallbackType type, const void *data, size_t dataSize) {
+	char *copy = NULL;
+
+	if(data != NULL) {
+		copy = (char *) GearmanArena::AllocShared(dataSize + 1);
+		memcpy(copy, data, dataSize);
+		copy[dataSize] = '\0';
+	}
+
+	Gearman_PushTaskEvent(ctx, type, copy, copy != NULL ? dataSize : 0);
+}
+
+static gearman_return_t Gearman_TaskCreatedFn(gearman_task_st *task) {
 	gearman_task_ctx *ctx = (gearman_task_ctx *) gearman_task_context(task);
 
 	if(ctx == NULL)
 		return GEARMAN_FAIL;
 
-	if(ctx->completefunc == 0)
-		return GEARMAN_SUCCESS;
+	ctx->createdTime = Gearman_GetMicroseconds();
+	ctx->stats->latency[GearmanLatency_Queue].Record(ctx->createdTime - ctx->submitTime);
+	ctx->server->Acknowledged(ctx->createdTime - ctx->sentTime);
 
-	// functag GearmanStatusCallback public(Handle:task, numerator, denominator);
-	IPluginFunction *pFunction = ctx->pContext->GetFunctionById(ctx->completefunc);
-	if(pFunction == NULL)
-		return GEARMAN_SUCCESS;
-
-	pFunction->PushCell(ctx->hndl);
-	pFunction->PushCell(gearman_task_numerator(task));
-	pFunction->PushCell(gearman_task_denominator(task));
+	Gearman_QueueTaskEvent(ctx, GearmanCallback_Created, NULL, 0);
 
-	cell_t result = 0;
-	pFunction->Execute(&result);
+	// Queued by the server is all a background task gets, libgearman finishes it right after
+	if(ctx->background) {
+		const char *jobHandle = gearman_task_job_handle(task);
+		if(jobHandle == NULL)
+			jobHandle = "";
 
+		Gearman_QueueTaskEvent(ctx, GearmanCallback_Complete, jobHandle, strlen(jobHandle));
+	}
 	return GEARMAN_SUCCESS;
 }
 
-static gearman_return_t Gearman_TaskWarningFn(gearman_task_st *task) {
+static gearman_return_t Gearman_TaskStatusFn(gearman_task_st *task) {
 	gearman_task_ctx *ctx = (gearman_task_ctx *) gearman_task_context(task);
 
 	if(ctx == NULL)
 		return GEARMAN_FAIL;
-	
-	if(ctx->warningfunc == 0)
-		return GEARMAN_SUCCESS;
 
-	// functag GearmanWarningCallback public(Handle:task);
-	IPluginFunction *pFunction = ctx->pContext->GetFunctionById(ctx->completefunc);
-	if(pFunction == NULL)
-		return GEARMAN_SUCCESS;
+	Gearman_QueueTaskEvent(ctx, GearmanCallback_Status, NULL, 0);
+	return GEARMAN_SUCCESS;
+}
 
-	pFunction->PushCell(ctx->hndl);
+static gearman_return_t Gearman_TaskWarningFn(gearman_task_st *task) {
+	gearman_task_ctx *ctx = (gearman_task_ctx *) gearman_task_context(task);
 
-	cell_t result = 0;
-	pFunction->Execute(&result);
+	if(ctx == NULL)
+		return GEARMAN_FAIL;
 
+	Gearman_QueueTaskEvent(ctx, GearmanCallback_Warning, NULL, 0);
 	return GEARMAN_SUCCESS;
 }
 
-static gearman_return_t Gearman_TaskCompleteFn(gearman_task_st *task) {
+// Every chunk is handed on as it arrives, the game thread drops it if no one streams the
+// task. Holding on to them here is what GearmanTask_SetDataCallback is meant to avoid.
+static gearman_return_t Gearman_TaskDataFn(gearman_task_st *task) {
 	gearman_task_ctx *ctx = (gearman_task_ctx *) gearman_task_context(task);
 
 	if(ctx == NULL)
 		return GEARMAN_FAIL;
 
-	if(ctx->completefunc == 0)
-		return GEARMAN_SUCCESS;
+	size_t dataSize = 0;
+	void *data = gearman_task_take_data(task, &dataSize);
 
-	// functag GearmanCompleteCallback public(Handle:task, const String:data[], const dataSize);
-	IPluginFunction *pFunction = ctx->pContext->GetFunctionById(ctx->completefunc);
-	if(pFunction == NULL)
-		return GEARMAN_SUCCESS;
+	Gearman_PushTaskEvent(ctx, GearmanCallback_Data, Gearman_TerminateData(data, dataSize), data != NULL ? dataSize : 0);
+	return GEARMAN_SUCCESS;
+}
 
-	// A failed attempt at attempting to find WHY there is extra data...
-	const char *data = (char *) gearman_task_data(task);
+static gearman_return_t Gearman_TaskCompleteFn(gearman_task_st *task) {
+	gearman_task_ctx *ctx = (gearman_task_ctx *) gearman_task_context(task);
 
-	const int dataSize = gearman_task_data_size(task);
+	if(ctx == NULL)
+		return GEARMAN_FAIL;
 
-	char *newData = strdup(data);
-	newData[dataSize] = '\0';
+	// Hand libgearman's result buffer over instead of copying it
+	size_t dataSize = 0;
+	void *data = gearman_task_take_data(task, &dataSize);
 
-	pFunction->PushCell(ctx->hndl);
-	pFunction->PushString(newData);
-	pFunction->PushCell(dataSize);
+	Gearman_PushTaskEvent(ctx, GearmanCallback_Complete, Gearman_TerminateData(data, dataSize), data != NULL ? dataSize : 0);
+	return GEARMAN_SUCCESS;
+}
 
-	cell_t result = 0;
-	pFunction->Execute(&result);
+// libgearman finishes the task right after without calling the fail fn, so the task is
+// failed here too, with the exception's data as the error
+static gearman_return_t Gearman_TaskExceptionFn(gearman_task_st *task) {
+	gearman_task_ctx *ctx = (gearman_task_ctx *) gearman_task_context(task);
 
-	g_pHandleSys->FreeHandle(ctx->hndl, NULL);
-	ctx->hndl = NULL;
+	if(ctx == NULL)
+		return GEARMAN_FAIL;
 
-	free(newData);
+	__sync_add_and_fetch(&ctx->stats->counters[GearmanStat_Exceptions], 1);
 
+	Gearman_QueueTaskEvent(ctx, GearmanCallback_Exception, gearman_task_data(task), gearman_task_data_size(task));
+	Gearman_QueueTaskEvent(ctx, GearmanCallback_Fail, gearman_task_data(task), gearman_task_data_size(task));
 	return GEARMAN_SUCCESS;
 }
 
@@ -280,46 +555,317 @@ static gearman_return_t Gearman_TaskFailFn(gearman_task_st *task) {
 	if(ctx == NULL)
 		return GEARMAN_FAIL;
 
-	if(ctx->failfunc == 0)
-		return GEARMAN_SUCCESS;
+	const char *error = gearman_task_error(task);
+	if(error == NULL)
+		error = "";
 
-	// functag GearmanFailCallback public(Handle:task, const String:error[]);
-	IPluginFunction *pFunction = ctx->pContext->GetFunctionById(ctx->completefunc);
-	if(pFunction == NULL)
-		return GEARMAN_SUCCESS;
+	Gearman_QueueTaskEvent(ctx, GearmanCallback_Fail, error, strlen(error));
+	return GEARMAN_SUCCESS;
+}
+
+static void Gearman_FreeHandle(Handle_t hndl) {
+	HandleSecurity sec;
+	sec.pOwner = NULL;
+	sec.pIdentity = myself->GetIdentity();
+
+	g_pHandleSys->FreeHandle(hndl, &sec);
+}
+
+static void Gearman_DispatchJob(gearman_callback &cb);
+static void Gearman_DispatchBatch(gearman_callback &cb);
+static void Gearman_DispatchFlight(gearman_callback &cb);
+static void Gearman_DispatchTask(gearman_task_ctx *ctx, gearman_callback &cb);
+
+// Runs on the game thread, called by GearmanDispatcher
+void Gearman_DispatchCallback(gearman_callback &cb) {
+	if(cb.type == GearmanCallback_Job) {
+		Gearman_DispatchJob(cb);
+		return;
+	}
+
+	if(cb.type == GearmanCallback_BatchComplete || cb.type == GearmanCallback_BatchFail) {
+		Gearman_DispatchBatch(cb);
+		return;
+	}
+
+	// Whether or not the task's own handle is still open
+	if(cb.flight != NULL)
+		Gearman_DispatchFlight(cb);
+
+	gearman_task_ctx *ctx = g_Gearman.GetGearmanTaskCtxInstanceByHandle(cb.hndl);
+
+	// The plugin closed the task (or unloaded) before the event arrived
+	if(ctx == NULL)
+		return;
+
+	if(cb.type == GearmanCallback_Complete || cb.type == GearmanCallback_Fail)
+		ctx->stats->latency[GearmanLatency_Dispatch].Record(Gearman_GetMicroseconds() - ctx->finishTime);
+
+	// Before the callback, which may take the data
+	if(cb.type == GearmanCallback_Complete && ctx->cache != NULL && cb.data != NULL)
+		g_Cache.Store(ctx->cache, ctx->workload, ctx->workloadSize, cb.data, cb.dataSize);
+
+	Gearman_DispatchTask(ctx, cb);
+}
+
+// Hands a copy of the result to every task that waited for it
+static void Gearman_DispatchFlight(gearman_callback &cb) {
+	gearman_flight *flight = cb.flight;
+	const bool success = (cb.type == GearmanCallback_Complete);
+
+	// Out of the table first, so tasks added from the callbacks start a new flight
+	CVector<Handle_t> waiters = flight->waiters;
+	gearman_function_stats *stats = flight->stats;
+	g_Flights.Remove(flight);
+	cb.flight = NULL;
+
+	for(size_t i = 0; i < waiters.size(); i++) {
+		__sync_add_and_fetch(&stats->counters[success ? GearmanStat_Completed : GearmanStat_Failed], 1);
+		__sync_sub_and_fetch(&stats->counters[GearmanStat_InFlight], 1);
+
+		gearman_task_ctx *ctx = g_Gearman.GetGearmanTaskCtxInstanceByHandle(waiters[i]);
+		if(ctx == NULL)
+			continue;
+
+		ctx->finished = true;
+
+		gearman_callback copy = cb;
+		copy.hndl = waiters[i];
+		copy.data = NULL;
+		if(cb.data != NULL) {
+			copy.data = (char *) GearmanArena::AllocShared(cb.dataSize + 1);
+			memcpy(copy.data, cb.data, cb.dataSize + 1);
+		}
 
-	pFunction->PushCell(ctx->hndl);
-	pFunction->PushString(gearman_task_error(task));
+		Gearman_DispatchTask(ctx, copy);
+		GearmanArena::Release(copy.data);
+	}
+}
 
+static void Gearman_DispatchTask(gearman_task_ctx *ctx, gearman_callback &cb) {
+	IPluginFunction *pFunction = NULL;
 	cell_t result = 0;
-	pFunction->Execute(&result);
 
-	g_pHandleSys->FreeHandle(ctx->hndl, NULL);
+	switch(cb.type) {
+	case GearmanCallback_Created:
+		// functag GearmanCreateCallback public(Handle:task);
+		// Falls back to the client's created callback, copied when the task was added
+		if((pFunction = ctx->callbacks[GearmanTaskCallback_Created]) == NULL)
+			return;
 
-	return GEARMAN_SUCCESS;
+		pFunction->PushCell(cb.hndl);
+		pFunction->Execute(&result);
+		break;
+	case GearmanCallback_Status:
+		// functag GearmanStatusCallback public(Handle:task, numerator, denominator);
+		if((pFunction = ctx->callbacks[GearmanTaskCallback_Status]) == NULL)
+			return;
+
+		pFunction->PushCell(cb.hndl);
+		pFunction->PushCell(cb.numerator);
+		pFunction->PushCell(cb.denominator);
+		pFunction->Execute(&result);
+		break;
+	case GearmanCallback_Warning:
+		// functag GearmanWarningCallback public(Handle:task);
+		if((pFunction = ctx->callbacks[GearmanTaskCallback_Warning]) == NULL)
+			return;
+
+		pFunction->PushCell(cb.hndl);
+		pFunction->Execute(&result);
+		break;
+	case GearmanCallback_Data:
+		// functag GearmanDataCallback public(Handle:task, const String:data[], const dataSize);
+		if((pFunction = ctx->callbacks[GearmanTaskCallback_Data]) == NULL)
+			return;
+
+		pFunction->PushCell(cb.hndl);
+		pFunction->PushStringEx(cb.data, cb.dataSize + 1, SM_PARAM_STRING_COPY | SM_PARAM_STRING_BINARY, 0);
+		pFunction->PushCell(cb.dataSize);
+		pFunction->Execute(&result);
+		break;
+	case GearmanCallback_Exception:
+		// functag GearmanExceptionCallback public(Handle:task, const String:exception[], const exceptionSize);
+		if((pFunction = ctx->callbacks[GearmanTaskCallback_Exception]) == NULL)
+			return;
+
+		pFunction->PushCell(cb.hndl);
+		pFunction->PushStringEx(cb.data, cb.dataSize + 1, SM_PARAM_STRING_COPY | SM_PARAM_STRING_BINARY, 0);
+		pFunction->PushCell(cb.dataSize);
+		pFunction->Execute(&result);
+		break;
+	case GearmanCallback_Complete:
+		if((pFunction = ctx->callbacks[GearmanTaskCallback_CompleteBuffer]) != NULL) {
+			// functag GearmanCompleteBufferCallback public(Handle:task, Handle:buffer);
+			// The result moves into the buffer as is. It's closed after the callback,
+			// plugins that want to keep it can clone the handle.
+			gearman_buffer *buffer = g_BufferPool.Alloc();
+			buffer->data = cb.data;
+			buffer->size = cb.dataSize;
+			cb.data = NULL;
+
+			Handle_t bufferHndl = g_pHandleSys->CreateHandle(g_Gearman.gearmanBufferHandleType, buffer, ctx->pContext->GetIdentity(), myself->GetIdentity(), NULL);
+			if(bufferHndl != BAD_HANDLE) {
+				pFunction->PushCell(cb.hndl);
+				pFunction->PushCell(bufferHndl);
+				pFunction->Execute(&result);
+
+				Gearman_FreeHandle(bufferHndl);
+			} else {
+				GearmanArena::Release(buffer->data);
+				g_BufferPool.Free(buffer);
+			}
+		} else if((pFunction = ctx->callbacks[GearmanTaskCallback_Complete]) != NULL) {
+			// functag GearmanCompleteCallback public(Handle:task, const String:data[], const dataSize);
+			// Binary so embedded NULs don't cut the data short, the terminator comes along
+			pFunction->PushCell(cb.hndl);
+			pFunction->PushStringEx(cb.data, cb.dataSize + 1, SM_PARAM_STRING_COPY | SM_PARAM_STRING_BINARY, 0);
+			pFunction->PushCell(cb.dataSize);
+			pFunction->Execute(&result);
+		}
+
+		Gearman_FreeHandle(cb.hndl);
+		break;
+	case GearmanCallback_Fail:
+		// functag GearmanFailCallback public(Handle:task, const String:error[]);
+		if((pFunction = ctx->callbacks[GearmanTaskCallback_Fail]) != NULL) {
+			pFunction->PushCell(cb.hndl);
+			pFunction->PushString(cb.data);
+			pFunction->Execute(&result);
+		}
+
+		Gearman_FreeHandle(cb.hndl);
+		break;
+	}
+}
+
+static void Gearman_DispatchBatch(gearman_callback &cb) {
+	gearman_batch *batch = g_Gearman.GetGearmanBatchInstanceByHandle(cb.hndl);
+
+	// The plugin closed the batch before all of it arrived
+	if(batch == NULL)
+		return;
+
+	gearman_batch_result &item = batch->results[cb.numerator];
+	const bool success = (cb.type == GearmanCallback_BatchComplete);
+
+	// The batch keeps the result (or error) for GearmanBatch_GetResult
+	item.data = cb.data;
+	item.dataSize = cb.dataSize;
+	item.done = true;
+	item.success = success;
+	cb.data = NULL;
+
+	if(success)
+		batch->completed++;
+	else
+		batch->failed++;
+
+	IPluginFunction *pFunction = NULL;
+	cell_t result = 0;
+
+	// functag GearmanBatchItemCallback public(Handle:batch, index, bool:success, const String:data[], const dataSize);
+	if((pFunction = batch->itemfunc) != NULL) {
+		pFunction->PushCell(cb.hndl);
+		pFunction->PushCell(cb.numerator);
+		pFunction->PushCell(success);
+		pFunction->PushStringEx(item.data != NULL ? item.data : (char *) "", item.dataSize + 1, SM_PARAM_STRING_COPY | SM_PARAM_STRING_BINARY, 0);
+		pFunction->PushCell(item.dataSize);
+		pFunction->Execute(&result);
+
+		// It may have closed the batch
+		if(g_Gearman.GetGearmanBatchInstanceByHandle(cb.hndl) == NULL)
+			return;
+	}
+
+	if(batch->completed + batch->failed < batch->count)
+		return;
+
+	// functag GearmanBatchCallback public(Handle:batch, completed, failed);
+	if((pFunction = batch->completefunc) != NULL) {
+		pFunction->PushCell(cb.hndl);
+		pFunction->PushCell(batch->completed);
+		pFunction->PushCell(batch->failed);
+		pFunction->Execute(&result);
+	}
+
+	Gearman_FreeHandle(cb.hndl);
+}
+
+void Gearman::RunFrame() {
+	g_Dispatcher.RunFrame();
+}
+
+static void Gearman_GameFrame(bool simulating) {
+	g_Gearman.RunFrame();
 }
  
 // native GearmanClient_Create()
 cell_t GearmanClient_Create(IPluginContext *pContext, const cell_t *params) {
+	gearman_client_ctx *cContext = g_ClientPool.Alloc();
+	cContext->arena = GearmanArena::Create();
+	cContext->pContext = pContext;
+	cContext->createdFunc = NULL;
+	cContext->coalesce = false;
+	cContext->spool = NULL;
+	cContext->lock = g_pThreader->MakeMutex();
+	cContext->newServers = 0;
+	cContext->nextConnection = 0;
+	cContext->shard = false;
+	cContext->connectTimeout = GEARMAN_SERVER_CONNECT_TIMEOUT;
+	cContext->taskTimeout = 0;
+	cContext->nextCheck = 0;
+	cContext->thread = g_Gearman.AssignIOThread();
+	cContext->pending = new SPSCRing<gearman_task_ctx *>(GEARMAN_PENDING_CAPACITY, RingOverflow_Reject);
+	cContext->inflight = NULL;
+	cContext->scheduled = 0;
+	cContext->closing = false;
+
+	if(cContext->thread == NULL) {
+		cContext->arena->Close();
+		delete cContext->pending;
+		cContext->lock->DestroyThis();
+		g_ClientPool.Free(cContext);
+		return pContext->ThrowNativeError("No gearman I/O thread is running");
+	}
+	// Return the handle
+	return g_pHandleSys->CreateHandle(g_Gearman.gearmanClientHandleType, cContext, pContext->GetIdentity(), myself->GetIdentity(), NULL);
+}
+
+// I/O thread. Every server gets a libgearman client of its own, see GearmanServer.
+GearmanServer *Gearman_ClientConnect(gearman_client_ctx *ctx, const char *host, in_port_t port) {
 	gearman_client_st *client = gearman_client_create(NULL);
 
 	if(client == NULL)
-		return BAD_HANDLE;
-	
+		return NULL;
+
+	// Before anything else, every allocation the client makes has to come from its arena.
+	// The servers of a client share it, they're all run by the same thread.
+	ctx->arena->Install(client);
+
 	gearman_client_set_created_fn(client, Gearman_TaskCreatedFn);
 	gearman_client_set_fail_fn(client, Gearman_TaskFailFn);
 	gearman_client_set_status_fn(client, Gearman_TaskStatusFn);
 	gearman_client_set_warning_fn(client, Gearman_TaskWarningFn);
+	gearman_client_set_data_fn(client, Gearman_TaskDataFn);
 	gearman_client_set_complete_fn(client, Gearman_TaskCompleteFn);
+	gearman_client_set_exception_fn(client, Gearman_TaskExceptionFn);
+	gearman_client_set_task_context_free_fn(client, Gearman_TaskContextFree);
 
-	//gearman_client_add_options(client, GEARMAN_CLIENT_NON_BLOCKING);
-	
-	gearman_client_ctx *cContext = new gearman_client_ctx;
-	cContext->client = client;
-	cContext->pContext = pContext;
-	cContext->createdFunc = 0;
-	// Return the handle
-	return g_pHandleSys->CreateHandle(g_Gearman.gearmanClientHandleType, cContext, pContext->GetIdentity(), myself->GetIdentity(), NULL);
+	gearman_client_add_options(client, GEARMAN_CLIENT_FREE_TASKS);
+
+	// Have the server forward exceptions, they're counted before the task fails
+	gearman_client_add_options(client, GEARMAN_CLIENT_EXCEPTION);
+
+	// The I/O thread sweeps many clients, run_tasks must never wait on the network
+	gearman_client_add_options(client, GEARMAN_CLIENT_NON_BLOCKING);
+
+	if(gearman_client_add_server(client, host, port) != GEARMAN_SUCCESS) {
+		gearman_client_free(client);
+		return NULL;
+	}
+
+	return new GearmanServer(client, host, port);
 }
 
 // native GearmanClient_AddServer(Handle:gearman, const String:address[], port);
@@ -337,59 +883,202 @@ cell_t GearmanClient_AddServer(IPluginContext *pContext, const cell_t *params) {
 	char *hostname = NULL;
 	pContext->LocalToString(params[2], &hostname);
 	
-	return gearman_client_add_server(client->client, hostname, params[3]);
+	// The I/O thread may be in run_tasks on this client
+	gearman_server_addr server;
+	server.host = strdup(hostname);
+	server.port = params[3];
+
+	client->lock->Lock();
+	client->servers.push(server);
+	client->newServers = 1;
+	client->lock->Unlock();
+
+	client->thread->Schedule(client);
+	return GEARMAN_SUCCESS;
 }
 
-// native GearmanClient_AddTask(Handle:gearman, const String:function[], const String:workload[], GearmanCompletedCallback:callback, GearmanPriority:priority=Gearman_PriorityNormal);
-cell_t GearmanClient_AddTask(IPluginContext *pContext, const cell_t *params) {
-	gearman_client_ctx *client = g_Gearman.GetGearmanClientInstanceByHandle(static_cast<Handle_t>(params[1]));
+// Function ids from plugins are 0 for none
+static IPluginFunction *Gearman_GetFunction(IPluginContext *pContext, funcid_t funcid) {
+	return (funcid != 0) ? pContext->GetFunctionById(funcid) : NULL;
+}
 
-	if(client == NULL)
-		return pContext->ThrowNativeError("Invalid gearman handle: %i", params[1]);
-	
-	char *functionName = NULL;
-	char *argument = NULL;
-	
-	pContext->LocalToString(params[2], &functionName);
-	pContext->LocalToString(params[3], &argument);
-	
-	GearmanPriority prio = (GearmanPriority) params[5];
-	
-	gearman_return_t ret;
+// SourcePawn doesn't tell natives how long an array is, so a size from the plugin is
+// checked against the plugin's memory instead: both ends of the range have to be in it.
+// Otherwise a size that's too large would read whatever lies past the plugin's memory.
+static bool Gearman_LocalToBuffer(IPluginContext *pContext, cell_t local, cell_t size, char **buffer) {
+	cell_t *first = NULL;
+	cell_t *last = NULL;
+
+	// The plugin's data, heap and stack are one block, addressed from its start
+	if(size < 0 || (int64_t) local + size > 0x7FFFFFFF)
+		return false;
+	if(pContext->LocalToPhysAddr(local, &first) != SP_ERROR_NONE)
+		return false;
+	if(size > 0 && pContext->LocalToPhysAddr(local + size - 1, &last) != SP_ERROR_NONE)
+		return false;
+
+	*buffer = (char *) first;
+	return true;
+}
 
-	gearman_task_ctx *task = new gearman_task_ctx;
+// Everything but the workload and handle, counted as submitted
+static gearman_task_ctx *Gearman_TaskCreate(IPluginContext *pContext, gearman_client_ctx *client, const char *functionName, gearman_function_stats *stats, GearmanPriority priority) {
+	gearman_task_ctx *task = g_TaskPool.Alloc();
 	task->pContext = pContext;
 	task->cContext = client;
-	task->completefunc = static_cast<funcid_t>(params[4]);
+	task->thread = client->thread;
 
-	task->createdfunc = NULL;
-	task->failfunc = NULL;
-	task->warningfunc = NULL;
-	task->statusfunc = NULL;
+	for(unsigned int i = 0; i < GearmanTaskCallback_Count; i++)
+		task->callbacks[i] = NULL;
+	task->callbacks[GearmanTaskCallback_Created] = client->createdFunc;
 
 	task->task = NULL;
+	task->hndl = BAD_HANDLE;
+	task->refs = 1;
+
+	// The I/O thread adds the task to libgearman later, so keep copies of the strings
+	task->function = strdup(functionName);
+	task->workload = NULL;
+	task->workloadSize = 0;
+	task->unique = NULL;
+	task->priority = priority;
+	task->background = false;
+	task->replay = false;
+	task->cancelled = false;
+	task->flight = NULL;
+
+	task->owner = NULL;
+	task->ownerPrev = NULL;
+	task->ownerNext = NULL;
+	task->cache = NULL;
+
+	task->batch = NULL;
+	task->batchIndex = 0;
+	task->batchNext = NULL;
+
+	task->inflightPrev = NULL;
+	task->inflightNext = NULL;
+	task->linked = false;
+	task->server = NULL;
+	task->attempts = 0;
+	task->timeout = client->taskTimeout;
+	GearmanTimerWheel::Init(&task->timer, task);
+
+	task->stats = stats;
+	task->submitTime = Gearman_GetMicroseconds();
+	task->sentTime = 0;
+	task->createdTime = 0;
+	task->finishTime = 0;
+	task->finished = false;
+	__sync_add_and_fetch(&stats->counters[GearmanStat_Submitted], 1);
+	__sync_add_and_fetch(&stats->counters[GearmanStat_InFlight], 1);
 
-	switch(prio) {
-	case GearmanPriority_Low:
-		task->task = gearman_client_add_task_low(client->client, task->task, task, functionName, "", argument, strlen(argument), &ret);
-		break;
-	case GearmanPriority_Normal:
-		task->task = gearman_client_add_task(client->client, task->task, task, functionName, "", argument, strlen(argument), &ret);
-		break;
-	case GearmanPriority_High:
-		task->task = gearman_client_add_task_high(client->client, task->task, task, functionName, "", argument, strlen(argument), &ret);
-		break;
-	}
+	return task;
+}
+
+// For tasks that never made it to the I/O thread
+static void Gearman_TaskRejected(gearman_task_ctx *task) {
+	task->finished = true;
+	__sync_add_and_fetch(&task->stats->counters[GearmanStat_Failed], 1);
+	__sync_sub_and_fetch(&task->stats->counters[GearmanStat_InFlight], 1);
+}
+
+static cell_t Gearman_AddTask(IPluginContext *pContext, gearman_client_ctx *client, const char *functionName, const char *workload, size_t workloadSize, funcid_t completefunc, GearmanPriority priority, const char *unique, bool background = false) {
+	if(g_Gearman.IsDraining())
+		return pContext->ThrowNativeError("Unable to add task, the gearman extension is draining");
+
+	gearman_task_ctx *task = Gearman_TaskCreate(pContext, client, functionName, g_Stats.Find(functionName), priority);
+	task->callbacks[GearmanTaskCallback_Complete] = Gearman_GetFunction(pContext, completefunc);
+	task->background = background;
+	task->refs = 2;
+
+	task->workloadSize = workloadSize;
+	task->workload = (char *) malloc(workloadSize + 1);
+	memcpy(task->workload, workload, workloadSize);
+	task->workload[workloadSize] = '\0';
+
+	if(unique != NULL && unique[0] != '\0')
+		task->unique = strdup(unique);
 
 	task->hndl = g_pHandleSys->CreateHandle(g_Gearman.gearmanTaskHandleType, task, pContext->GetIdentity(), myself->GetIdentity(), NULL);
+	if(task->hndl == BAD_HANDLE) {
+		// Neither the handle's reference nor the pipeline's is going to be taken
+		Gearman_TaskRejected(task);
+		Gearman_TaskRelease(task);
+		Gearman_TaskRelease(task);
+		return BAD_HANDLE;
+	}
+
+	g_Gearman.AddTask(task);
+
+	// There's no result to share for background tasks, every one has to reach the server
+	if(!background && (task->cache = g_Cache.GetFunction(functionName)) != NULL) {
+		const gearman_cache_entry *entry = g_Cache.Lookup(task->cache, task->workload, workloadSize);
+		if(entry != NULL) {
+			// Completes through the dispatcher like any other task, on the next frame
+			task->cache = NULL;
+			Gearman_TaskRelease(task);
+			Gearman_QueueTaskEvent(task, GearmanCallback_Complete, entry->data, entry->dataSize);
+			return task->hndl;
+		}
+	}
+
+	if(!background && client->coalesce) {
+		const char *key = (task->unique != NULL) ? task->unique : task->workload;
+		const size_t keySize = (task->unique != NULL) ? strlen(task->unique) : workloadSize;
+
+		gearman_flight *flight = g_Flights.Find(client, functionName, key, keySize, task->unique != NULL);
+		if(flight != NULL) {
+			// Nothing goes to the server, the task gets a copy of the other one's result.
+			// Only the handle's reference is left.
+			flight->waiters.push_back(task->hndl);
+			__sync_add_and_fetch(&task->stats->counters[GearmanStat_Coalesced], 1);
+			Gearman_TaskRelease(task);
+			return task->hndl;
+		}
+
+		task->flight = g_Flights.Create(client, functionName, key, keySize, task->unique != NULL, task->stats);
+	}
+
+	if(!g_Gearman.AddToQueue(task)) {
+		Gearman_TaskRejected(task);
+
+		if(task->flight != NULL)
+			g_Flights.Remove(task->flight);
 
-	g_Gearman.AddToQueue(task);
+		// Frees the handle's reference, then the pipeline's
+		Gearman_FreeHandle(task->hndl);
+		Gearman_TaskRelease(task);
+		return pContext->ThrowNativeError("Unable to queue task, too many tasks pending on this client");
+	}
 	
 	return task->hndl;
 }
 
-// native GearmanClient_DoBackground(Handle:gearman, const String:function[], const String:workload[], GearmanPriority:priority=Gearman_PriorityNormal, const String:unique[] = "");
-cell_t GearmanClient_DoBackground(IPluginContext *pContext, const cell_t *params) {
+// I/O thread. The task has no handle, only the spool hears how it ends.
+gearman_task_ctx *Gearman_SpoolTaskCreate(gearman_client_ctx *client, const gearman_spool_entry &entry) {
+	GearmanPriority priority = (GearmanPriority) entry.priority;
+	if(priority != GearmanPriority_Low && priority != GearmanPriority_High)
+		priority = GearmanPriority_Normal;
+
+	gearman_task_ctx *task = Gearman_TaskCreate(client->pContext, client, entry.function, client->spool->GetStats(), priority);
+	task->callbacks[GearmanTaskCallback_Created] = NULL;
+	task->background = true;
+	task->replay = true;
+
+	task->workloadSize = entry.workloadSize;
+	task->workload = (char *) malloc(entry.workloadSize + 1);
+	memcpy(task->workload, entry.workload, entry.workloadSize);
+	task->workload[entry.workloadSize] = '\0';
+
+	if(entry.unique[0] != '\0')
+		task->unique = strdup(entry.unique);
+
+	return task;
+}
+
+// native GearmanClient_AddTask(Handle:gearman, const String:function[], const String:workload[], GearmanCompletedCallback:callback, GearmanPriority:priority=Gearman_PriorityNormal, const String:unique[]="");
+cell_t GearmanClient_AddTask(IPluginContext *pContext, const cell_t *params) {
 	gearman_client_ctx *client = g_Gearman.GetGearmanClientInstanceByHandle(static_cast<Handle_t>(params[1]));
 
 	if(client == NULL)
@@ -401,29 +1090,157 @@ cell_t GearmanClient_DoBackground(IPluginContext *pContext, const cell_t *params
 	pContext->LocalToString(params[2], &functionName);
 	pContext->LocalToString(params[3], &argument);
 	
-	GearmanPriority prio = (GearmanPriority) params[4];
+	// Plugins built against an older include don't pass a unique
+	char *unique = NULL;
+	if(params[0] >= 6)
+		pContext->LocalToString(params[6], &unique);
+
+	return Gearman_AddTask(pContext, client, functionName, argument, strlen(argument), static_cast<funcid_t>(params[4]), (GearmanPriority) params[5], unique);
+}
+
+// native GearmanClient_AddTaskEx(Handle:gearman, const String:function[], const String:data[], dataSize, GearmanCompleteCallback:callback, GearmanPriority:priority=GearmanPriority_Normal, const String:unique[]="");
+cell_t GearmanClient_AddTaskEx(IPluginContext *pContext, const cell_t *params) {
+	gearman_client_ctx *client = g_Gearman.GetGearmanClientInstanceByHandle(static_cast<Handle_t>(params[1]));
+
+	if(client == NULL)
+		return pContext->ThrowNativeError("Invalid gearman handle: %i", params[1]);
+
+	char *functionName = NULL;
+	char *data = NULL;
 	
-	gearman_return_t ret = GEARMAN_FAIL;
+	if(!Gearman_LocalToBuffer(pContext, params[3], params[4], &data))
+		return pContext->ThrowNativeError("Invalid data size: %i", params[4]);
 
-	gearman_job_handle_t job_handle;
+	pContext->LocalToString(params[2], &functionName);
+	
+	char *unique = NULL;
+	if(params[0] >= 7)
+		pContext->LocalToString(params[7], &unique);
 
-	switch(prio) {
-	case GearmanPriority_Low:
-		ret = gearman_client_do_low_background(client->client, functionName, "", argument, strlen(argument), job_handle);
-		break;
-	case GearmanPriority_Normal:
-		ret = gearman_client_do_background(client->client, functionName, "", argument, strlen(argument), job_handle);
-		break;
-	case GearmanPriority_High:
-		ret = gearman_client_do_high_background(client->client, functionName, "", argument, strlen(argument), job_handle);
-		break;
+	return Gearman_AddTask(pContext, client, functionName, data, params[4], static_cast<funcid_t>(params[5]), (GearmanPriority) params[6], unique);
+}
+
+// native GearmanClient_AddTaskBatch(Handle:gearman, const String:function[], const String:data[], dataSize, const sizes[], count, GearmanBatchCallback:callback, GearmanPriority:priority=GearmanPriority_Normal);
+cell_t GearmanClient_AddTaskBatch(IPluginContext *pContext, const cell_t *params) {
+	gearman_client_ctx *client = g_Gearman.GetGearmanClientInstanceByHandle(static_cast<Handle_t>(params[1]));
+
+	if(client == NULL)
+		return pContext->ThrowNativeError("Invalid gearman handle: %i", params[1]);
+
+	if(g_Gearman.IsDraining())
+		return pContext->ThrowNativeError("Unable to add batch, the gearman extension is draining");
+
+	const cell_t count = params[6];
+	if(count < 1 || count > GEARMAN_MAX_BATCH)
+		return pContext->ThrowNativeError("Invalid batch size: %i (1 - %i)", count, GEARMAN_MAX_BATCH);
+
+	char *functionName = NULL;
+	char *data = NULL;
+	char *sizesBuffer = NULL;
+
+	if(!Gearman_LocalToBuffer(pContext, params[3], params[4], &data))
+		return pContext->ThrowNativeError("Invalid data size: %i", params[4]);
+
+	if(!Gearman_LocalToBuffer(pContext, params[5], count * sizeof(cell_t), &sizesBuffer))
+		return pContext->ThrowNativeError("Invalid sizes array for %i tasks", count);
+
+	pContext->LocalToString(params[2], &functionName);
+	cell_t *sizes = (cell_t *) sizesBuffer;
+
+	// Each size is at most dataSize, so the sum is checked before it could wrap
+	size_t total = 0;
+	for(cell_t i = 0; i < count; i++) {
+		if(sizes[i] < 0 || sizes[i] > params[4] - (cell_t) total)
+			return pContext->ThrowNativeError("Invalid data size at index %i: %i (%i bytes of data left)", i, sizes[i], params[4] - (cell_t) total);
+		total += sizes[i];
 	}
 
-	if(ret != GEARMAN_SUCCESS) {
+	gearman_batch *batch = new gearman_batch;
+	batch->pContext = pContext;
+	batch->refs = 1 + count;
+	batch->count = count;
+	batch->completed = 0;
+	batch->failed = 0;
+	batch->completefunc = Gearman_GetFunction(pContext, static_cast<funcid_t>(params[7]));
+	batch->itemfunc = NULL;
+	batch->cancelled = false;
+
+	// One copy of all the workloads instead of one per task
+	batch->workload = (char *) malloc(total > 0 ? total : 1);
+	memcpy(batch->workload, data, total);
+
+	batch->results = new gearman_batch_result[count];
+	for(cell_t i = 0; i < count; i++) {
+		batch->results[i].data = NULL;
+		batch->results[i].dataSize = 0;
+		batch->results[i].done = false;
+		batch->results[i].success = false;
+	}
+
+	batch->hndl = g_pHandleSys->CreateHandle(g_Gearman.gearmanBatchHandleType, batch, pContext->GetIdentity(), myself->GetIdentity(), NULL);
+	if(batch->hndl == BAD_HANDLE) {
+		// No task took a reference yet
+		batch->refs = 1;
+		Gearman_BatchRelease(batch);
 		return BAD_HANDLE;
 	}
 
-	return g_pHandleSys->CreateHandle(g_Gearman.gearmanJobHandleType, job_handle, pContext->GetIdentity(), myself->GetIdentity(), NULL);
+	// Every task shares the function's stats entry, and goes to the I/O thread as one
+	gearman_function_stats *stats = g_Stats.Find(functionName);
+	gearman_task_ctx *first = NULL;
+	gearman_task_ctx *last = NULL;
+	size_t offset = 0;
+
+	for(cell_t i = 0; i < count; i++) {
+		gearman_task_ctx *task = Gearman_TaskCreate(pContext, client, functionName, stats, (GearmanPriority) params[8]);
+		task->workload = batch->workload + offset;
+		task->workloadSize = sizes[i];
+		task->batch = batch;
+		task->batchIndex = i;
+		offset += sizes[i];
+
+		if(last != NULL)
+			last->batchNext = task;
+		else
+			first = task;
+		last = task;
+	}
+
+	if(!g_Gearman.AddToQueue(first)) {
+		while(first != NULL) {
+			gearman_task_ctx *next = first->batchNext;
+			Gearman_TaskRejected(first);
+			Gearman_TaskRelease(first);
+			first = next;
+		}
+
+		Gearman_FreeHandle(batch->hndl);
+		return pContext->ThrowNativeError("Unable to queue batch, too many tasks pending on this client");
+	}
+
+	g_Gearman.AddBatch(batch);
+	return batch->hndl;
+}
+
+// native GearmanClient_DoBackground(Handle:gearman, const String:function[], const String:workload[], GearmanPriority:priority=Gearman_PriorityNormal, const String:unique[] = "");
+cell_t GearmanClient_DoBackground(IPluginContext *pContext, const cell_t *params) {
+	gearman_client_ctx *client = g_Gearman.GetGearmanClientInstanceByHandle(static_cast<Handle_t>(params[1]));
+
+	if(client == NULL)
+		return pContext->ThrowNativeError("Invalid gearman handle: %i", params[1]);
+	
+	char *functionName = NULL;
+	char *argument = NULL;
+	
+	pContext->LocalToString(params[2], &functionName);
+	pContext->LocalToString(params[3], &argument);
+
+	char *unique = NULL;
+	if(params[0] >= 5)
+		pContext->LocalToString(params[5], &unique);
+
+	// Submitted through the I/O thread like any other task, the complete callback gets the job handle
+	return Gearman_AddTask(pContext, client, functionName, argument, strlen(argument), 0, (GearmanPriority) params[4], unique, true);
 }
 
 // native GearmanClient_SetCreatedCallback(Handle:gearman, GearmanCreatedCallback:callback);
@@ -434,11 +1251,224 @@ cell_t GearmanClient_SetCreatedCallback(IPluginContext *pContext, const cell_t *
 		return false;
 	}
 
-	ctx->createdFunc = static_cast<funcid_t>(params[2]);
+	ctx->createdFunc = Gearman_GetFunction(ctx->pContext, static_cast<funcid_t>(params[2]));
+
+	return true;
+}
+
+// native GearmanClient_SetCoalescing(Handle:gearman, bool:enable);
+cell_t GearmanClient_SetCoalescing(IPluginContext *pContext, const cell_t *params) {
+	gearman_client_ctx *ctx = g_Gearman.GetGearmanClientInstanceByHandle(static_cast<Handle_t>(params[1]));
+	if(ctx == NULL) {
+		pContext->ThrowNativeError("Invalid client handle: %i", params[1]);
+		return false;
+	}
+
+	// Tasks already waiting still get their result
+	ctx->coalesce = (params[2] != 0);
+
+	return true;
+}
+
+// native bool:GearmanClient_SetTimeout(Handle:gearman, timeout);
+cell_t GearmanClient_SetTimeout(IPluginContext *pContext, const cell_t *params) {
+	gearman_client_ctx *ctx = g_Gearman.GetGearmanClientInstanceByHandle(static_cast<Handle_t>(params[1]));
+	if(ctx == NULL) {
+		pContext->ThrowNativeError("Invalid client handle: %i", params[1]);
+		return false;
+	}
+
+	if(params[2] < 0) {
+		pContext->ThrowNativeError("Invalid timeout: %i", params[2]);
+		return false;
+	}
+
+	// libgearman's own timeout only bounds blocking calls, the I/O thread never makes any
+	// for tasks. Tasks submitted from now on get this one instead, see GearmanTask_SetTimeout.
+	ctx->taskTimeout = params[2];
+
+	return true;
+}
+
+// native bool:GearmanClient_SetSharding(Handle:gearman, bool:enable);
+cell_t GearmanClient_SetSharding(IPluginContext *pContext, const cell_t *params) {
+	gearman_client_ctx *ctx = g_Gearman.GetGearmanClientInstanceByHandle(static_cast<Handle_t>(params[1]));
+	if(ctx == NULL) {
+		pContext->ThrowNativeError("Invalid client handle: %i", params[1]);
+		return false;
+	}
+
+	// Tasks the I/O thread already placed stay where they are
+	ctx->shard = (params[2] != 0);
 
 	return true;
 }
 
+// native bool:GearmanClient_SetConnectTimeout(Handle:gearman, timeout);
+cell_t GearmanClient_SetConnectTimeout(IPluginContext *pContext, const cell_t *params) {
+	gearman_client_ctx *ctx = g_Gearman.GetGearmanClientInstanceByHandle(static_cast<Handle_t>(params[1]));
+	if(ctx == NULL) {
+		pContext->ThrowNativeError("Invalid client handle: %i", params[1]);
+		return false;
+	}
+
+	if(params[2] <= 0) {
+		pContext->ThrowNativeError("Invalid timeout: %i", params[2]);
+		return false;
+	}
+
+	ctx->connectTimeout = params[2];
+
+	return true;
+}
+
+// native bool:GearmanClient_SetSpool(Handle:gearman, const String:name[], rate=500);
+cell_t GearmanClient_SetSpool(IPluginContext *pContext, const cell_t *params) {
+	gearman_client_ctx *ctx = g_Gearman.GetGearmanClientInstanceByHandle(static_cast<Handle_t>(params[1]));
+	if(ctx == NULL) {
+		pContext->ThrowNativeError("Invalid client handle: %i", params[1]);
+		return false;
+	}
+
+	if(ctx->spool != NULL) {
+		pContext->ThrowNativeError("The client already has a spool");
+		return false;
+	}
+
+	char *name = NULL;
+	pContext->LocalToString(params[2], &name);
+
+	// It becomes a file name
+	size_t length = strlen(name);
+	if(length == 0 || length > 64 || strspn(name, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_-") != length) {
+		pContext->ThrowNativeError("Invalid spool name \"%s\", use up to 64 letters, digits, '_' and '-'", name);
+		return false;
+	}
+
+	char error[256];
+	GearmanSpool *spool = GearmanSpool::Open(name, error, sizeof(error));
+	if(spool == NULL) {
+		pContext->ThrowNativeError("%s", error);
+		return false;
+	}
+
+	char statsName[80];
+	snprintf(statsName, sizeof(statsName), "spool:%s", name);
+
+	spool->SetRate((params[0] >= 3 && params[3] > 0) ? params[3] : GEARMAN_SPOOL_DEFAULT_RATE);
+	spool->SetStats(g_Stats.Find(statsName));
+
+	// The I/O thread may look at it any time from here on
+	__sync_synchronize();
+	ctx->spool = spool;
+
+	// Replays whatever the spool still held
+	ctx->thread->Schedule(ctx);
+
+	return true;
+}
+
+// native GearmanClient_GetSpoolInfo(Handle:gearman, GearmanSpoolInfo:info);
+cell_t GearmanClient_GetSpoolInfo(IPluginContext *pContext, const cell_t *params) {
+	gearman_client_ctx *ctx = g_Gearman.GetGearmanClientInstanceByHandle(static_cast<Handle_t>(params[1]));
+	if(ctx == NULL)
+		return pContext->ThrowNativeError("Invalid client handle: %i", params[1]);
+
+	GearmanSpool *spool = ctx->spool;
+	if(spool == NULL)
+		return 0;
+
+	switch(params[2]) {
+	case GearmanSpoolInfo_Depth:
+		return spool->GetDepth();
+	case GearmanSpoolInfo_Bytes:
+		return spool->GetBytes();
+	case GearmanSpoolInfo_Spooled:
+		return spool->GetSpooled();
+	case GearmanSpoolInfo_Replayed:
+		return spool->GetReplayed();
+	case GearmanSpoolInfo_ReplayRate:
+		return spool->GetReplayRate();
+	}
+
+	return pContext->ThrowNativeError("Invalid spool info: %i", params[2]);
+}
+
+// The handle's worker for index 0, then its clones
+static gearman_worker_ctx *Gearman_WorkerMember(gearman_worker_ctx *ctx, size_t index) {
+	return (index == 0) ? ctx : ctx->clones[index - 1];
+}
+
+static gearman_return_t Gearman_WorkerRegister(gearman_worker_ctx *ctx, gearman_worker_cb *callback) {
+	gearman_worker_reg fn;
+	fn.callback = callback;
+	fn.registered = true;
+
+	ctx->lock->Lock();
+	gearman_return_t ret = gearman_worker_register(ctx->worker, callback->name, callback->timeout);
+	if(ret == GEARMAN_SUCCESS) {
+		__sync_add_and_fetch(&callback->refs, 1);
+		ctx->functions.push_back(fn);
+	}
+	ctx->lock->Unlock();
+
+	return ret;
+}
+
+// Hands the handle's workers that have something to do to an I/O thread each
+static bool Gearman_WorkerAttach(gearman_worker_ctx *ctx) {
+	for(size_t i = 0; i <= ctx->clones.size(); i++) {
+		gearman_worker_ctx *member = Gearman_WorkerMember(ctx, i);
+		if(member->thread != NULL || member->functions.size() == 0)
+			continue;
+
+		GearmanIOThread *thread = g_Gearman.AssignIOThread();
+		if(thread == NULL || !thread->Attach(member))
+			return false;
+	}
+	return true;
+}
+
+// Game thread. The clone gets a connection of its own to every server of ctx, and the
+// same functions.
+static gearman_worker_ctx *Gearman_WorkerClone(gearman_worker_ctx *ctx) {
+	// The I/O thread may be using ctx->worker, and its arena until ours is installed
+	ctx->lock->Lock();
+	gearman_worker_st *worker = gearman_worker_clone(NULL, ctx->worker);
+	ctx->lock->Unlock();
+
+	if(worker == NULL)
+		return NULL;
+
+	GearmanArena *arena = GearmanArena::Create();
+	arena->Install(worker);
+	gearman_worker_add_options(worker, GEARMAN_WORKER_NON_BLOCKING);
+
+	gearman_worker_ctx *clone = new gearman_worker_ctx;
+	clone->pContext = ctx->pContext;
+	clone->worker = worker;
+	clone->arena = arena;
+	clone->lock = g_pThreader->MakeMutex();
+	clone->thread = NULL;
+	clone->jobs = 0;
+	clone->prefetch = ctx->prefetch;
+	clone->unregistering = false;
+	clone->stopped = false;
+	clone->closing = false;
+
+	// libgearman copies the function list, including functions ctx dropped for their limit
+	for(size_t i = 0; i < ctx->functions.size(); i++) {
+		gearman_worker_reg fn;
+		fn.callback = ctx->functions[i].callback;
+		fn.registered = gearman_worker_function_exist(worker, fn.callback->name, strlen(fn.callback->name));
+
+		__sync_add_and_fetch(&fn.callback->refs, 1);
+		clone->functions.push_back(fn);
+	}
+
+	return clone;
+}
+
 // native GearmanWorker_Create()
 cell_t GearmanWorker_Create(IPluginContext *pContext, const cell_t *params) {
 	gearman_worker_st *worker = gearman_worker_create(NULL);
@@ -446,13 +1476,30 @@ cell_t GearmanWorker_Create(IPluginContext *pContext, const cell_t *params) {
 	if(worker == NULL)
 		return BAD_HANDLE;
 
+	GearmanArena *arena = GearmanArena::Create();
+	arena->Install(worker);
+
+	// Same as clients, the I/O thread sweeps it along with everything else
+	gearman_worker_add_options(worker, GEARMAN_WORKER_NON_BLOCKING);
+
 	gearman_worker_ctx *ctx = new gearman_worker_ctx;
 	ctx->pContext = pContext;
 	ctx->worker = worker;
+	ctx->arena = arena;
+	ctx->lock = g_pThreader->MakeMutex();
 	ctx->thread = NULL;
+	ctx->jobs = 0;
+	ctx->prefetch = GEARMAN_WORKER_PREFETCH;
+	ctx->unregistering = false;
+	ctx->stopped = false;
+	ctx->closing = false;
 
 	// Return the handle
-	return g_pHandleSys->CreateHandle(g_Gearman.gearmanWorkerHandleType, ctx, pContext->GetIdentity(), myself->GetIdentity(), NULL);
+	Handle_t hndl = g_pHandleSys->CreateHandle(g_Gearman.gearmanWorkerHandleType, ctx, pContext->GetIdentity(), myself->GetIdentity(), NULL);
+	if(hndl != BAD_HANDLE)
+		g_Gearman.AddWorker(ctx);
+
+	return hndl;
 }
 
 // native GearmanWorker_AddServer(Handle:gearman, const String:address[], port);
@@ -470,7 +1517,19 @@ cell_t GearmanWorker_AddServer(IPluginContext *pContext, const cell_t *params) {
 	char *hostname = NULL;
 	pContext->LocalToString(params[2], &hostname);
 	
-	return gearman_worker_add_server(ctx->worker, hostname, params[3]);
+	gearman_return_t ret = GEARMAN_SUCCESS;
+	for(size_t i = 0; i <= ctx->clones.size(); i++) {
+		gearman_worker_ctx *member = Gearman_WorkerMember(ctx, i);
+
+		member->lock->Lock();
+		gearman_return_t memberRet = gearman_worker_add_server(member->worker, hostname, params[3]);
+		member->lock->Unlock();
+
+		if(memberRet != GEARMAN_SUCCESS && ret == GEARMAN_SUCCESS)
+			ret = memberRet;
+	}
+
+	return ret;
 }
 
 // native GearmanWorker_AddFunction(Handle:gearman, const String:functionName[], GearmanWorker:worker, timeout = 0);
@@ -485,69 +1544,158 @@ cell_t GearmanWorker_AddFunction(IPluginContext *pContext, const cell_t *params)
 	char *funcName = NULL;
 	pContext->LocalToString(params[2], &funcName);
 	
-	gearman_worker_cb *context = new gearman_worker_cb;
+	gearman_worker_cb *context = g_WorkerCallbackPool.Alloc();
 	context->pContext = pContext;
-	context->funcid = static_cast<funcid_t>(params[3]);
+	context->pFunction = Gearman_GetFunction(pContext, static_cast<funcid_t>(params[3]));
+	context->name = strdup(funcName);
+	context->limit = 0;
+	context->running = 0;
+	context->refs = 1;
+
+	// The include doesn't expose the timeout yet
+	context->timeout = (params[0] >= 4) ? params[4] : 0;
+
+	// Jobs are grabbed by the I/O thread and looked up by name, see GearmanIOThread::RunWorker
+	gearman_return_t ret = Gearman_WorkerRegister(ctx, context);
+	if(ret == GEARMAN_SUCCESS) {
+		for(size_t i = 0; i < ctx->clones.size(); i++)
+			Gearman_WorkerRegister(ctx->clones[i], context);
+	}
 
-	int timeout = params[4];
+	// Every worker that registered it holds a reference of its own
+	Gearman_WorkerCallbackRelease(context);
 
-	gearman_return_t ret;// = gearman_worker_add_function(ctx->worker, funcName, timeout, Gearman_CallWorker, context);
+	if(ret != GEARMAN_SUCCESS)
+		return ret;
 
-	gearman_function_t func = gearman_function_create(Gearman_CallWorker);
+	if(!Gearman_WorkerAttach(ctx)) {
+		pContext->ThrowNativeError("Failed to add function, no gearman I/O thread is running");
+		return GEARMAN_FAIL;
+	}
+	return ret;
+}
 
-	ret = gearman_worker_define_function(ctx->worker, funcName, strlen(funcName), func, timeout, context);
+// Runs on the I/O thread that grabbed the job
+void Gearman_QueueJobEvent(gearman_job_ctx *ctx) {
+	// The job keeps no copy, the workload now belongs to ctx
+	size_t workloadSize = 0;
+	void *workload = gearman_job_take_workload(ctx->job, &workloadSize);
+
+	ctx->workload = Gearman_TerminateData(workload, workloadSize);
+	ctx->workloadSize = (workload != NULL) ? workloadSize : 0;
+
+	gearman_callback cb;
+	cb.type = GearmanCallback_Job;
+	cb.pContext = ctx->callback->pContext;
+	cb.hndl = BAD_HANDLE;
+	cb.job = ctx;
+	cb.flight = NULL;
+	cb.numerator = 0;
+	cb.denominator = 0;
+	cb.data = NULL;
+	cb.dataSize = 0;
+
+	g_Dispatcher.Push(cb);
+}
 
-	// This needs a thread to call gearman_worker_work for 'worker', one thread per worker.
-	if(ret == GEARMAN_SUCCESS && ctx->thread == NULL) {
-		ctx->thread = new GearmanWorkerThread(ctx);
+// Only called once nothing else can touch the worker, by its I/O thread or after it stopped
+void Gearman_JobFree(gearman_job_ctx *ctx) {
+	gearman_job_free(ctx->job);
+	GearmanArena::Release(ctx->workload);
+	ctx->wContext->jobs--;
+	__sync_sub_and_fetch(&ctx->callback->running, 1);
+	g_JobPool.Free(ctx);
+}
 
-		ThreadParams threadparams;
-		threadparams.flags = Thread_AutoRelease;
-		threadparams.prio = ThreadPrio_Low;
+static void Gearman_QueueJobCommand(gearman_job_ctx *ctx, GearmanJobCommand type, const char *data, size_t dataSize, uint32_t numerator = 0, uint32_t denominator = 0) {
+	gearman_worker_ctx *worker = ctx->wContext;
 
-		IThreadHandle *handle = g_pThreader->MakeThread(ctx->thread, &threadparams);
-		if(handle == NULL) {
-			pContext->ThrowNativeError("Failed to add function, unable to start worker thread.");
-			return GEARMAN_FAIL;
+	// Nothing sends anymore once the I/O threads are stopped, only clean up
+	if(worker->thread == NULL) {
+		if(type == GearmanJobCommand_Release) {
+			Gearman_JobFree(ctx);
+			if(worker->closing && worker->jobs == 0)
+				Gearman_WorkerFree(worker);
 		}
+		return;
 	}
-	return ret;
+
+	gearman_job_cmd cmd;
+	cmd.type = type;
+	cmd.job = ctx;
+	cmd.data = NULL;
+	cmd.dataSize = dataSize;
+	cmd.numerator = numerator;
+	cmd.denominator = denominator;
+
+	if(data != NULL) {
+		cmd.data = (char *) malloc(dataSize + 1);
+		memcpy(cmd.data, data, dataSize);
+		cmd.data[dataSize] = '\0';
+	}
+
+	worker->lock->Lock();
+	worker->commands.push(cmd);
+	worker->lock->Unlock();
 }
 
-gearman_return_t Gearman_CallWorker(gearman_job_st *job, void *context) {
-	gearman_worker_cb * worker_cb = (gearman_worker_cb *) context;
+// Game thread, drops the plugin's side of the job. A job that never got a final
+// result is failed so the server doesn't wait on it until the worker disconnects.
+void Gearman_JobRelease(gearman_job_ctx *ctx) {
+	if(!ctx->finished) {
+		ctx->finished = true;
+		Gearman_QueueJobCommand(ctx, GearmanJobCommand_Fail, NULL, 0);
+	}
 
-	if(worker_cb == NULL)
-		return GEARMAN_FAIL;
-	
-	Handle_t job_hndl = g_pHandleSys->CreateHandle(g_Gearman.gearmanJobHandleType, job, worker_cb->pContext->GetIdentity(), myself->GetIdentity(), NULL);
-	
-	IPluginFunction *pFunction = worker_cb->pContext->GetFunctionById(worker_cb->funcid);
+	Gearman_QueueJobCommand(ctx, GearmanJobCommand_Release, NULL, 0);
+}
+
+static void Gearman_DispatchJob(gearman_callback &cb) {
+	gearman_job_ctx *ctx = cb.job;
+	gearman_worker_cb *callback = ctx->callback;
+
+	// The worker was closed (or its plugin unloaded) while the job waited, the
+	// dispatcher releases it
+	if(ctx->wContext->closing)
+		return;
 
+	IPluginFunction *pFunction = callback->pFunction;
 	if(pFunction == NULL)
-		return GEARMAN_FAIL;
-		
-	const char *workload = (char *) gearman_job_workload(job);
+		return;
 
-	const size_t workloadSize = gearman_job_workload_size(job);
+	ctx->hndl = g_pHandleSys->CreateHandle(g_Gearman.gearmanJobHandleType, ctx, callback->pContext->GetIdentity(), myself->GetIdentity(), NULL);
+	if(ctx->hndl == BAD_HANDLE)
+		return;
+
+	// The handle owns the job from here on
+	Handle_t hndl = ctx->hndl;
+	cb.job = NULL;
 
 	// GearmanWorker(Handle:job, const String:workload[], const workloadSize)
-	// Push the job handle
-	pFunction->PushCell(job_hndl);
-	pFunction->PushString(workload);
-	pFunction->PushCell(workloadSize);
+	pFunction->PushCell(hndl);
+	pFunction->PushStringEx(ctx->workload, ctx->workloadSize + 1, SM_PARAM_STRING_COPY | SM_PARAM_STRING_BINARY, 0);
+	pFunction->PushCell(ctx->workloadSize);
 
 	cell_t result = 0;
 	pFunction->Execute(&result);
-	
-	if(result != GEARMAN_IN_PROGRESS) {
-		HandleSecurity sec;
-		sec.pOwner = NULL;
-		sec.pIdentity = myself->GetIdentity();
-		g_pHandleSys->FreeHandle(job_hndl, &sec);
+
+	// Replies later with GearmanJob_Send*, and closes the handle itself
+	if(result == GEARMAN_IN_PROGRESS)
+		return;
+
+	// The callback may have closed the handle already
+	if(g_Gearman.GetGearmanJobInstanceByHandle(hndl) != ctx)
+		return;
+
+	if(!ctx->finished) {
+		ctx->finished = true;
+		if(result == GEARMAN_SUCCESS)
+			Gearman_QueueJobCommand(ctx, GearmanJobCommand_Complete, NULL, 0);
+		else
+			Gearman_QueueJobCommand(ctx, GearmanJobCommand_Fail, NULL, 0);
 	}
 
-	return static_cast<gearman_return_t>(result);
+	Gearman_FreeHandle(hndl);
 }
 
 cell_t GearmanWorker_SetIdentifier(IPluginContext *pContext, const cell_t *params) {
@@ -561,77 +1709,175 @@ cell_t GearmanWorker_SetIdentifier(IPluginContext *pContext, const cell_t *param
 	char *identifier = NULL;
 	pContext->LocalToString(params[2], &identifier);
 	
-	return gearman_worker_set_identifier(ctx->worker, identifier, strlen(identifier));
+	gearman_return_t ret = GEARMAN_SUCCESS;
+	for(size_t i = 0; i <= ctx->clones.size(); i++) {
+		gearman_worker_ctx *member = Gearman_WorkerMember(ctx, i);
+
+		member->lock->Lock();
+		gearman_return_t memberRet = gearman_worker_set_identifier(member->worker, identifier, strlen(identifier));
+		member->lock->Unlock();
+
+		if(memberRet != GEARMAN_SUCCESS && ret == GEARMAN_SUCCESS)
+			ret = memberRet;
+	}
+
+	return ret;
+}
+
+// native bool:GearmanWorker_SetConcurrency(Handle:worker, connections);
+cell_t GearmanWorker_SetConcurrency(IPluginContext *pContext, const cell_t *params) {
+	gearman_worker_ctx *ctx = g_Gearman.GetGearmanWorkerInstanceByHandle(static_cast<Handle_t>(params[1]));
+
+	if(ctx == NULL)
+		return pContext->ThrowNativeError("Invalid worker handle: %i", params[1]);
+
+	if(params[2] < 1 || params[2] > GEARMAN_MAX_WORKER_CONNECTIONS)
+		return pContext->ThrowNativeError("Invalid number of connections: %i (1 - %i)", params[2], GEARMAN_MAX_WORKER_CONNECTIONS);
+
+	const size_t clones = params[2] - 1;
+
+	// Extra connections go away like a closed handle, after their jobs were released
+	while(ctx->clones.size() > clones) {
+		Gearman_WorkerClose(ctx->clones.back());
+		ctx->clones.pop_back();
+	}
+
+	while(ctx->clones.size() < clones) {
+		gearman_worker_ctx *clone = Gearman_WorkerClone(ctx);
+		if(clone == NULL)
+			return false;
+		ctx->clones.push_back(clone);
+	}
+
+	return Gearman_WorkerAttach(ctx);
+}
+
+// native GearmanWorker_SetFunctionLimit(Handle:worker, const String:function[], limit);
+cell_t GearmanWorker_SetFunctionLimit(IPluginContext *pContext, const cell_t *params) {
+	gearman_worker_ctx *ctx = g_Gearman.GetGearmanWorkerInstanceByHandle(static_cast<Handle_t>(params[1]));
+
+	if(ctx == NULL)
+		return pContext->ThrowNativeError("Invalid worker handle: %i", params[1]);
+
+	if(params[3] < 0)
+		return pContext->ThrowNativeError("Invalid limit: %i", params[3]);
+
+	char *funcName = NULL;
+	pContext->LocalToString(params[2], &funcName);
+
+	// Only the game thread adds functions, the callbacks can be read without the lock.
+	// The I/O threads pick the new limit up on their next pass.
+	for(size_t i = 0; i < ctx->functions.size(); i++) {
+		gearman_worker_cb *callback = ctx->functions[i].callback;
+		if(strcmp(callback->name, funcName) == 0) {
+			callback->limit = params[3];
+			return true;
+		}
+	}
+
+	return pContext->ThrowNativeError("Function \"%s\" was not added to this worker", funcName);
 }
 
 /* Gearman Job Functions */
 
+static cell_t Gearman_SendJobData(gearman_job_ctx *job, const char *data, size_t dataSize, GearmanResp type) {
+	if(job->finished)
+		return GEARMAN_INVALID_ARGUMENT;
+
+	// Sent by the worker's I/O thread, in the order they were queued
+	switch(type) {
+		case GearmanResp_Data:
+			Gearman_QueueJobCommand(job, GearmanJobCommand_Data, data, dataSize);
+			break;
+		case GearmanResp_Warning:
+			Gearman_QueueJobCommand(job, GearmanJobCommand_Warning, data, dataSize);
+			break;
+		case GearmanResp_Complete:
+			job->finished = true;
+			Gearman_QueueJobCommand(job, GearmanJobCommand_Complete, data, dataSize);
+			break;
+		case GearmanResp_Exception:
+			job->finished = true;
+			Gearman_QueueJobCommand(job, GearmanJobCommand_Exception, data, dataSize);
+			break;
+		default:
+			return GEARMAN_INVALID_ARGUMENT;
+	}
+	return GEARMAN_SUCCESS;
+}
+
 // native GearmanJob_Send(Handle:job, const String:data[], GearmanResp:type=GearmanResp_Data)
 cell_t GearmanJob_Send(IPluginContext *pContext, const cell_t *params) {
-	gearman_job_st *job = g_Gearman.GetGearmanJobInstanceByHandle(static_cast<Handle_t>(params[1]));
+	gearman_job_ctx *job = g_Gearman.GetGearmanJobInstanceByHandle(static_cast<Handle_t>(params[1]));
 	if(job == NULL) {
 		pContext->ThrowNativeError("Invalid job handle: %i", params[1]);
 		return GEARMAN_FAIL;
 	}
-	
-	char *data = NULL;
-	pContext->LocalToString(params[2], &data);
+	
+	char *data = NULL;
+	pContext->LocalToString(params[2], &data);
+
+	return Gearman_SendJobData(job, data, strlen(data), (GearmanResp) params[3]);
+}
+
+// native GearmanJob_SendBinary(Handle:job, const String:data[], dataSize, GearmanResp:type=GearmanResp_Data)
+cell_t GearmanJob_SendBinary(IPluginContext *pContext, const cell_t *params) {
+	gearman_job_ctx *job = g_Gearman.GetGearmanJobInstanceByHandle(static_cast<Handle_t>(params[1]));
+	if(job == NULL) {
+		pContext->ThrowNativeError("Invalid job handle: %i", params[1]);
+		return GEARMAN_FAIL;
+	}
+
+	char *data = NULL;
+	if(!Gearman_LocalToBuffer(pContext, params[2], params[3], &data)) {
+		pContext->ThrowNativeError("Invalid data size: %i", params[3]);
+		return GEARMAN_FAIL;
+	}
 
-	const size_t dataSize = strlen(data);
-	
-	GearmanResp type = (GearmanResp) params[3];
-	
-	gearman_return_t ret;
-	
-	switch(type) {
-		case GearmanResp_Data:
-			ret = gearman_job_send_data(job, data, dataSize);
-			break;
-		case GearmanResp_Warning:
-			ret = gearman_job_send_warning(job, data, dataSize);
-			break;
-		case GearmanResp_Complete:
-			ret = gearman_job_send_complete(job, data, dataSize);
-			break;
-		case GearmanResp_Exception:
-			ret = gearman_job_send_exception(job, data, dataSize);
-			break;
-	}
-	return ret;
+	return Gearman_SendJobData(job, data, params[3], (GearmanResp) params[4]);
 }
 
 // native GearmanJob_SendFail(Handle:job);
 cell_t GearmanJob_SendFail(IPluginContext *pContext, const cell_t *params) {
-	gearman_job_st *job = g_Gearman.GetGearmanJobInstanceByHandle(static_cast<Handle_t>(params[1]));
+	gearman_job_ctx *job = g_Gearman.GetGearmanJobInstanceByHandle(static_cast<Handle_t>(params[1]));
 	if(job == NULL) {
 		pContext->ThrowNativeError("Invalid job handle: %i", params[1]);
 		return GEARMAN_FAIL;
 	}
+
+	if(job->finished)
+		return GEARMAN_INVALID_ARGUMENT;
 	
-	return gearman_job_send_fail(job);
+	job->finished = true;
+	Gearman_QueueJobCommand(job, GearmanJobCommand_Fail, NULL, 0);
+	return GEARMAN_SUCCESS;
 }
 
 // native GearmanJob_SendStatus(Handle:job, numerator, denominator);
 cell_t GearmanJob_SendStatus(IPluginContext *pContext, const cell_t *params) {
-	gearman_job_st *job = g_Gearman.GetGearmanJobInstanceByHandle(static_cast<Handle_t>(params[1]));
+	gearman_job_ctx *job = g_Gearman.GetGearmanJobInstanceByHandle(static_cast<Handle_t>(params[1]));
 	if(job == NULL) {
 		pContext->ThrowNativeError("Invalid job handle: %i", params[1]);
 		return GEARMAN_FAIL;
 	}
+
+	if(job->finished)
+		return GEARMAN_INVALID_ARGUMENT;
 	
-	return gearman_job_send_status(job, params[2], params[3]);
+	Gearman_QueueJobCommand(job, GearmanJobCommand_Status, NULL, 0, params[2], params[3]);
+	return GEARMAN_SUCCESS;
 }
 
 // native GearmanJob_FunctionName(Handle:job, String:buffer[], maxlen);
 cell_t GearmanJob_FunctionName(IPluginContext *pContext, const cell_t *params) {
-	gearman_job_st *job = g_Gearman.GetGearmanJobInstanceByHandle(static_cast<Handle_t>(params[1]));
+	gearman_job_ctx *job = g_Gearman.GetGearmanJobInstanceByHandle(static_cast<Handle_t>(params[1]));
 	if(job == NULL) {
 		pContext->ThrowNativeError("Invalid job handle: %i", params[1]);
 		return GEARMAN_FAIL;
 	}
 
 	// Return
-	const char *result = gearman_job_function_name(job);
+	const char *result = gearman_job_function_name(job->job);
 	if(result != NULL) {
 		pContext->StringToLocalUTF8(params[2], params[3], result, NULL);
 		return strlen(result);
@@ -642,14 +1888,14 @@ cell_t GearmanJob_FunctionName(IPluginContext *pContext, const cell_t *params) {
 
 // native GearmanJob_Unique(Handle:job, String:buffer[], maxlen);
 cell_t GearmanJob_Unique(IPluginContext *pContext, const cell_t *params) {
-	gearman_job_st *job = g_Gearman.GetGearmanJobInstanceByHandle(static_cast<Handle_t>(params[1]));
+	gearman_job_ctx *job = g_Gearman.GetGearmanJobInstanceByHandle(static_cast<Handle_t>(params[1]));
 	if(job == NULL) {
 		pContext->ThrowNativeError("Invalid job handle: %i", params[1]);
 		return GEARMAN_FAIL;
 	}
 
 	// Return
-	const char *result = gearman_job_unique(job);
+	const char *result = gearman_job_unique(job->job);
 	if(result != NULL) {
 		pContext->StringToLocalUTF8(params[2], params[3], result, NULL);
 		return strlen(result);
@@ -660,14 +1906,14 @@ cell_t GearmanJob_Unique(IPluginContext *pContext, const cell_t *params) {
 
 // native GearmanJob_Workload(Handle:job, String:buffer[], maxlen);
 cell_t GearmanJob_Workload(IPluginContext *pContext, const cell_t *params) {
-	gearman_job_st *job = g_Gearman.GetGearmanJobInstanceByHandle(static_cast<Handle_t>(params[1]));
+	gearman_job_ctx *job = g_Gearman.GetGearmanJobInstanceByHandle(static_cast<Handle_t>(params[1]));
 	if(job == NULL) {
 		pContext->ThrowNativeError("Invalid job handle: %i", params[1]);
 		return GEARMAN_FAIL;
 	}
 
 	// Return
-	const char *result = (char*) gearman_job_workload(job);
+	const char *result = job->workload;
 	if(result != NULL) {
 		pContext->StringToLocalUTF8(params[2], params[3], result, NULL);
 		return strlen(result);
@@ -678,17 +1924,41 @@ cell_t GearmanJob_Workload(IPluginContext *pContext, const cell_t *params) {
 
 // native GearmanJob_WorkloadSize(Handle:job);
 cell_t GearmanJob_WorkloadSize(IPluginContext *pContext, const cell_t *params) {
-	gearman_job_st *job = g_Gearman.GetGearmanJobInstanceByHandle(static_cast<Handle_t>(params[1]));
+	gearman_job_ctx *job = g_Gearman.GetGearmanJobInstanceByHandle(static_cast<Handle_t>(params[1]));
 	if(job == NULL) {
 		pContext->ThrowNativeError("Invalid job handle: %i", params[1]);
 		return GEARMAN_FAIL;
 	}
 	
-	return gearman_job_workload_size(job);
+	return job->workloadSize;
 }
 
 // Gearman task functions
 
+// native bool:GearmanTask_SetTimeout(Handle:task, timeout);
+cell_t GearmanTask_SetTimeout(IPluginContext *pContext, const cell_t *params) {
+	gearman_task_ctx *ctx = g_Gearman.GetGearmanTaskCtxInstanceByHandle(static_cast<Handle_t>(params[1]));
+	if(ctx == NULL) {
+		pContext->ThrowNativeError("Invalid task handle: %i", params[1]);
+		return false;
+	}
+
+	if(params[2] < 0) {
+		pContext->ThrowNativeError("Invalid timeout: %i", params[2]);
+		return false;
+	}
+
+	ctx->timeout = params[2];
+
+	// The I/O thread may have submitted it already, have it (re)arm the timer
+	if(!ctx->thread->SetTimeout(ctx)) {
+		pContext->ThrowNativeError("Unable to set the timeout, too many are pending");
+		return false;
+	}
+
+	return true;
+}
+
 // native GearmanTask_SetCreatedCallback(Handle:task, GearmanCreatedCallback:cb);
 cell_t GearmanTask_SetCreatedCallback(IPluginContext *pContext, const cell_t *params) {
 	gearman_task_ctx *ctx = g_Gearman.GetGearmanTaskCtxInstanceByHandle(static_cast<Handle_t>(params[1]));
@@ -697,7 +1967,33 @@ cell_t GearmanTask_SetCreatedCallback(IPluginContext *pContext, const cell_t *pa
 		return GEARMAN_FAIL;
 	}
 
-	ctx->createdfunc = static_cast<funcid_t>(params[2]);
+	ctx->callbacks[GearmanTaskCallback_Created] = Gearman_GetFunction(ctx->pContext, static_cast<funcid_t>(params[2]));
+
+	return true;
+}
+
+// native GearmanTask_SetCompleteCallback(Handle:task, GearmanCompleteCallback:cb);
+cell_t GearmanTask_SetCompleteCallback(IPluginContext *pContext, const cell_t *params) {
+	gearman_task_ctx *ctx = g_Gearman.GetGearmanTaskCtxInstanceByHandle(static_cast<Handle_t>(params[1]));
+	if(ctx == NULL) {
+		pContext->ThrowNativeError("Invalid task handle: %i", params[1]);
+		return GEARMAN_FAIL;
+	}
+
+	ctx->callbacks[GearmanTaskCallback_Complete] = Gearman_GetFunction(ctx->pContext, static_cast<funcid_t>(params[2]));
+
+	return true;
+}
+
+// native GearmanTask_SetCompleteBufferCallback(Handle:task, GearmanCompleteBufferCallback:cb);
+cell_t GearmanTask_SetCompleteBufferCallback(IPluginContext *pContext, const cell_t *params) {
+	gearman_task_ctx *ctx = g_Gearman.GetGearmanTaskCtxInstanceByHandle(static_cast<Handle_t>(params[1]));
+	if(ctx == NULL) {
+		pContext->ThrowNativeError("Invalid task handle: %i", params[1]);
+		return GEARMAN_FAIL;
+	}
+
+	ctx->callbacks[GearmanTaskCallback_CompleteBuffer] = Gearman_GetFunction(ctx->pContext, static_cast<funcid_t>(params[2]));
 
 	return true;
 }
@@ -710,7 +2006,7 @@ cell_t GearmanTask_SetStatusCallback(IPluginContext *pContext, const cell_t *par
 		return GEARMAN_FAIL;
 	}
 	
-	ctx->statusfunc = static_cast<funcid_t>(params[2]);
+	ctx->callbacks[GearmanTaskCallback_Status] = Gearman_GetFunction(ctx->pContext, static_cast<funcid_t>(params[2]));
 
 	return true;
 }
@@ -723,7 +2019,7 @@ cell_t GearmanTask_SetFailCallback(IPluginContext *pContext, const cell_t *param
 		return GEARMAN_FAIL;
 	}
 
-	ctx->failfunc = static_cast<funcid_t>(params[2]);
+	ctx->callbacks[GearmanTaskCallback_Fail] = Gearman_GetFunction(ctx->pContext, static_cast<funcid_t>(params[2]));
 
 	return true;
 }
@@ -736,102 +2032,610 @@ cell_t GearmanTask_SetWarningCallback(IPluginContext *pContext, const cell_t *pa
 		return GEARMAN_FAIL;
 	}
 
-	ctx->warningfunc = static_cast<funcid_t>(params[2]);
+	ctx->callbacks[GearmanTaskCallback_Warning] = Gearman_GetFunction(ctx->pContext, static_cast<funcid_t>(params[2]));
+
+	return true;
+}
+
+// native GearmanTask_SetDataCallback(Handle:task, GearmanDataCallback:cb);
+cell_t GearmanTask_SetDataCallback(IPluginContext *pContext, const cell_t *params) {
+	gearman_task_ctx *ctx = g_Gearman.GetGearmanTaskCtxInstanceByHandle(static_cast<Handle_t>(params[1]));
+	if(ctx == NULL) {
+		pContext->ThrowNativeError("Invalid task handle: %i", params[1]);
+		return GEARMAN_FAIL;
+	}
+
+	ctx->callbacks[GearmanTaskCallback_Data] = Gearman_GetFunction(ctx->pContext, static_cast<funcid_t>(params[2]));
 
 	return true;
 }
 
-// Workers for client
+// native GearmanTask_SetExceptionCallback(Handle:task, GearmanExceptionCallback:cb);
+cell_t GearmanTask_SetExceptionCallback(IPluginContext *pContext, const cell_t *params) {
+	gearman_task_ctx *ctx = g_Gearman.GetGearmanTaskCtxInstanceByHandle(static_cast<Handle_t>(params[1]));
+	if(ctx == NULL) {
+		pContext->ThrowNativeError("Invalid task handle: %i", params[1]);
+		return GEARMAN_FAIL;
+	}
+
+	ctx->callbacks[GearmanTaskCallback_Exception] = Gearman_GetFunction(ctx->pContext, static_cast<funcid_t>(params[2]));
 
-void Gearman::OnWorkerStart(IThreadWorker *pWorker) {
+	return true;
 }
 
-void Gearman::OnWorkerStop(IThreadWorker *pWorker) {
+// Gearman buffer functions
+
+// native GearmanBuffer_Size(Handle:buffer);
+cell_t GearmanBuffer_Size(IPluginContext *pContext, const cell_t *params) {
+	gearman_buffer *buffer = g_Gearman.GetGearmanBufferInstanceByHandle(static_cast<Handle_t>(params[1]));
+	if(buffer == NULL)
+		return pContext->ThrowNativeError("Invalid buffer handle: %i", params[1]);
+
+	return buffer->size;
 }
 
-static bool s_OneTimeThreaderErrorMsg = false;
+// native GearmanBuffer_Read(Handle:buffer, String:output[], maxlen, offset = 0);
+cell_t GearmanBuffer_Read(IPluginContext *pContext, const cell_t *params) {
+	gearman_buffer *buffer = g_Gearman.GetGearmanBufferInstanceByHandle(static_cast<Handle_t>(params[1]));
+	if(buffer == NULL)
+		return pContext->ThrowNativeError("Invalid buffer handle: %i", params[1]);
 
-bool Gearman::AddToQueue(gearman_task_ctx *ctx) {
-	if (!m_pWorker) {
-		m_pWorker = g_pThreader->MakeWorker(this, true);
-		if (!m_pWorker) {
-			if (!s_OneTimeThreaderErrorMsg) {
-				g_pSM->LogError(myself, "[SM] Unable to create gearman threader (error unknown)");
-				s_OneTimeThreaderErrorMsg = true;
-			}
-			return false;
-		}
-		if (!m_pWorker->Start()) {
-			if (!s_OneTimeThreaderErrorMsg) {
-				g_pSM->LogError(myself, "[SM] Unable to start gearman threader (error unknown)");
-				s_OneTimeThreaderErrorMsg = true;
-			}
-			g_pThreader->DestroyWorker(m_pWorker);
-			m_pWorker = NULL;
-			return false;
+	if(params[3] < 0 || params[4] < 0)
+		return pContext->ThrowNativeError("Invalid length or offset");
+
+	const size_t offset = params[4];
+	if(offset >= buffer->size)
+		return 0;
+
+	size_t length = buffer->size - offset;
+	if(length > (size_t) params[3])
+		length = params[3];
+
+	char *output = NULL;
+	pContext->LocalToString(params[2], &output);
+	memcpy(output, buffer->data + offset, length);
+
+	// Terminate when there's room so the result also works as a string
+	if(length < (size_t) params[3])
+		output[length] = '\0';
+
+	return length;
+}
+
+// Gearman batch natives
+
+// native GearmanBatch_SetItemCallback(Handle:batch, GearmanBatchItemCallback:cb);
+cell_t GearmanBatch_SetItemCallback(IPluginContext *pContext, const cell_t *params) {
+	gearman_batch *batch = g_Gearman.GetGearmanBatchInstanceByHandle(static_cast<Handle_t>(params[1]));
+	if(batch == NULL) {
+		pContext->ThrowNativeError("Invalid batch handle: %i", params[1]);
+		return false;
+	}
+
+	batch->itemfunc = Gearman_GetFunction(batch->pContext, static_cast<funcid_t>(params[2]));
+	return true;
+}
+
+static gearman_batch_result *Gearman_BatchResult(IPluginContext *pContext, const cell_t *params) {
+	gearman_batch *batch = g_Gearman.GetGearmanBatchInstanceByHandle(static_cast<Handle_t>(params[1]));
+	if(batch == NULL) {
+		pContext->ThrowNativeError("Invalid batch handle: %i", params[1]);
+		return NULL;
+	}
+
+	if(params[2] < 0 || (unsigned int) params[2] >= batch->count) {
+		pContext->ThrowNativeError("Invalid batch index: %i", params[2]);
+		return NULL;
+	}
+
+	return &batch->results[params[2]];
+}
+
+// native bool:GearmanBatch_Succeeded(Handle:batch, index);
+cell_t GearmanBatch_Succeeded(IPluginContext *pContext, const cell_t *params) {
+	gearman_batch_result *item = Gearman_BatchResult(pContext, params);
+	if(item == NULL)
+		return false;
+
+	return item->done && item->success;
+}
+
+// native GearmanBatch_GetResultSize(Handle:batch, index);
+cell_t GearmanBatch_GetResultSize(IPluginContext *pContext, const cell_t *params) {
+	gearman_batch_result *item = Gearman_BatchResult(pContext, params);
+	if(item == NULL)
+		return 0;
+
+	return item->dataSize;
+}
+
+// native GearmanBatch_GetResult(Handle:batch, index, String:output[], maxlen);
+cell_t GearmanBatch_GetResult(IPluginContext *pContext, const cell_t *params) {
+	gearman_batch_result *item = Gearman_BatchResult(pContext, params);
+	if(item == NULL)
+		return 0;
+
+	if(params[4] < 0)
+		return pContext->ThrowNativeError("Invalid length: %i", params[4]);
+
+	size_t length = item->dataSize;
+	if(length > (size_t) params[4])
+		length = params[4];
+
+	char *output = NULL;
+	pContext->LocalToString(params[3], &output);
+	if(length > 0)
+		memcpy(output, item->data, length);
+
+	// Terminate when there's room so the result also works as a string
+	if(length < (size_t) params[4])
+		output[length] = '\0';
+
+	return length;
+}
+
+// Result cache natives
+
+// native GearmanCache_SetTTL(const String:function[], Float:ttl);
+cell_t GearmanCache_SetTTL(IPluginContext *pContext, const cell_t *params) {
+	float ttl = sp_ctof(params[2]);
+	if(ttl < 0.0f)
+		return pContext->ThrowNativeError("Invalid TTL: %f", ttl);
+
+	char *functionName = NULL;
+	pContext->LocalToString(params[1], &functionName);
+
+	g_Cache.SetFunction(functionName, (uint64_t) (ttl * 1000000.0));
+	return true;
+}
+
+// native GearmanCache_SetMemoryLimit(bytes);
+cell_t GearmanCache_SetMemoryLimit(IPluginContext *pContext, const cell_t *params) {
+	if(params[1] < 0)
+		return pContext->ThrowNativeError("Invalid memory limit: %i", params[1]);
+
+	g_Cache.SetMemoryLimit(params[1]);
+	return true;
+}
+
+// native GearmanCache_Clear(const String:function[]="");
+cell_t GearmanCache_Clear(IPluginContext *pContext, const cell_t *params) {
+	char *functionName = NULL;
+	pContext->LocalToString(params[1], &functionName);
+
+	if(functionName[0] == '\0') {
+		g_Cache.Purge(NULL);
+		return true;
+	}
+
+	gearman_cache_fn *function = g_Cache.GetFunction(functionName);
+	if(function != NULL)
+		g_Cache.Purge(function);
+	return true;
+}
+
+// Dispatcher natives
+
+// native Gearman_SetFrameBudget(microseconds);
+cell_t Gearman_SetFrameBudget(IPluginContext *pContext, const cell_t *params) {
+	if(params[1] < 0)
+		return pContext->ThrowNativeError("Invalid frame budget: %i", params[1]);
+
+	g_Dispatcher.SetFrameBudget(params[1]);
+	return true;
+}
+
+// native Gearman_Drain(timeout);
+cell_t Gearman_Drain(IPluginContext *pContext, const cell_t *params) {
+	if(params[1] < 0)
+		return pContext->ThrowNativeError("Invalid timeout: %i", params[1]);
+
+	if(g_Dispatcher.IsDispatching())
+		return pContext->ThrowNativeError("Unable to drain from a gearman callback");
+
+	return g_Gearman.Drain(params[1]);
+}
+
+// native Gearman_GetBacklog();
+cell_t Gearman_GetBacklog(IPluginContext *pContext, const cell_t *params) {
+	return g_Dispatcher.GetBacklog();
+}
+
+// native Gearman_GetFrameTime(bool:peak=false);
+cell_t Gearman_GetFrameTime(IPluginContext *pContext, const cell_t *params) {
+	return params[1] ? g_Dispatcher.GetPeakFrameTime() : g_Dispatcher.GetLastFrameTime();
+}
+
+// Statistics natives
+
+// native GearmanStats_GetFunctionCount();
+cell_t GearmanStats_GetFunctionCount(IPluginContext *pContext, const cell_t *params) {
+	return g_Stats.GetCount();
+}
+
+// native bool:GearmanStats_GetFunctionName(index, String:buffer[], maxlen);
+cell_t GearmanStats_GetFunctionName(IPluginContext *pContext, const cell_t *params) {
+	gearman_function_stats *stats = (params[1] >= 0) ? g_Stats.GetAt(params[1]) : NULL;
+	if(stats == NULL)
+		return false;
+
+	pContext->StringToLocal(params[2], params[3], stats->name);
+	return true;
+}
+
+// native GearmanStats_GetCounter(const String:function[], GearmanStat:stat);
+cell_t GearmanStats_GetCounter(IPluginContext *pContext, const cell_t *params) {
+	if(params[2] < 0 || params[2] >= GearmanStat_Count)
+		return pContext->ThrowNativeError("Invalid statistic: %i", params[2]);
+
+	char *functionName = NULL;
+	pContext->LocalToString(params[1], &functionName);
+
+	gearman_function_stats *stats = g_Stats.Lookup(functionName);
+	if(stats == NULL)
+		return 0;
+
+	return stats->counters[params[2]];
+}
+
+// native GearmanStats_GetLatency(const String:function[], GearmanLatency:stage, Float:percentile);
+cell_t GearmanStats_GetLatency(IPluginContext *pContext, const cell_t *params) {
+	if(params[2] < 0 || params[2] >= GearmanLatency_Count)
+		return pContext->ThrowNativeError("Invalid latency stage: %i", params[2]);
+
+	char *functionName = NULL;
+	pContext->LocalToString(params[1], &functionName);
+
+	gearman_function_stats *stats = g_Stats.Lookup(functionName);
+	if(stats == NULL)
+		return 0;
+
+	return stats->latency[params[2]].GetPercentile(sp_ctof(params[3]));
+}
+
+// native GearmanStats_Reset();
+cell_t GearmanStats_Reset(IPluginContext *pContext, const cell_t *params) {
+	g_Stats.Reset();
+	return true;
+}
+
+// I/O threads for clients and workers
+
+void Gearman::StartIOThreads() {
+	unsigned int count = GEARMAN_DEFAULT_IO_THREADS;
+
+	const char *value = smutils->GetCoreConfigValue("GearmanIOThreads");
+	if(value != NULL && atoi(value) > 0)
+		count = atoi(value);
+
+	if(count > GEARMAN_MAX_IO_THREADS)
+		count = GEARMAN_MAX_IO_THREADS;
+
+	m_IOThreadCount = 0;
+	m_NextIOThread = 0;
+
+	for(unsigned int i = 0; i < count; i++) {
+		GearmanIOThread *thread = new GearmanIOThread();
+		if(!thread->Start()) {
+			g_pSM->LogError(myself, "[SM] Unable to start gearman I/O thread %u of %u", i + 1, count);
+			delete thread;
+			break;
 		}
+		m_IOThreads[m_IOThreadCount++] = thread;
 	}
+}
 
-	/* Add to the queue */
-	{
-		m_pQueueLock->Lock();
-		if(!m_TaskQueue.empty()) {
-			m_pQueueLock->Unlock();
-			return true;
+void Gearman::KillIOThreads() {
+	for(unsigned int i = 0; i < m_IOThreadCount; i++)
+		m_IOThreads[i]->Stop();
+}
+
+GearmanIOThread *Gearman::AssignIOThread() {
+	if(m_IOThreadCount == 0)
+		return NULL;
+
+	return m_IOThreads[m_NextIOThread++ % m_IOThreadCount];
+}
+
+gearman_plugin *Gearman::FindPlugin(IPluginContext *pContext, bool create) {
+	for(size_t i = 0; i < m_Plugins.size(); i++) {
+		if(m_Plugins[i]->pContext == pContext)
+			return m_Plugins[i];
+	}
+
+	if(!create)
+		return NULL;
+
+	gearman_plugin *plugin = new gearman_plugin;
+	plugin->pContext = pContext;
+	plugin->tasks = NULL;
+	m_Plugins.push_back(plugin);
+	return plugin;
+}
+
+void Gearman::AddWorker(gearman_worker_ctx *ctx) {
+	FindPlugin(ctx->pContext, true)->workers.push_back(ctx);
+}
+
+void Gearman::RemoveWorker(gearman_worker_ctx *ctx) {
+	gearman_plugin *plugin = FindPlugin(ctx->pContext, false);
+	if(plugin == NULL)
+		return;
+
+	for(size_t i = 0; i < plugin->workers.size(); i++) {
+		if(plugin->workers[i] == ctx) {
+			plugin->workers.erase(plugin->workers.begin() + i);
+			return;
 		}
-		m_TaskQueue.push(ctx);
-		m_pQueueLock->Unlock();
 	}
+}
 
-	/* Make the thread */
-	m_pWorker->MakeThread(this);
-	return true;
+void Gearman::AddTask(gearman_task_ctx *ctx) {
+	gearman_plugin *plugin = FindPlugin(ctx->pContext, true);
+
+	ctx->owner = plugin;
+	ctx->ownerPrev = NULL;
+	ctx->ownerNext = plugin->tasks;
+	if(plugin->tasks != NULL)
+		plugin->tasks->ownerPrev = ctx;
+	plugin->tasks = ctx;
+}
+
+void Gearman::AddBatch(gearman_batch *batch) {
+	FindPlugin(batch->pContext, true)->batches.push_back(batch);
 }
 
-void Gearman::RunThread(IThreadHandle *pThread) {
-	gearman_task_ctx *ctx = NULL;
+void Gearman::RemoveBatch(gearman_batch *batch) {
+	gearman_plugin *plugin = FindPlugin(batch->pContext, false);
+	if(plugin == NULL)
+		return;
 
-	{
-		m_pQueueLock->Lock();
-		if (!m_TaskQueue.empty()) {
-			ctx = m_TaskQueue.first();
-			m_TaskQueue.pop();
+	for(size_t i = 0; i < plugin->batches.size(); i++) {
+		if(plugin->batches[i] == batch) {
+			plugin->batches.erase(plugin->batches.begin() + i);
+			return;
 		}
-		m_pQueueLock->Unlock();
 	}
+}
+
+void Gearman::RemoveTask(gearman_task_ctx *ctx) {
+	if(ctx->owner == NULL)
+		return;
+
+	if(ctx->ownerPrev != NULL)
+		ctx->ownerPrev->ownerNext = ctx->ownerNext;
+	else
+		ctx->owner->tasks = ctx->ownerNext;
+
+	if(ctx->ownerNext != NULL)
+		ctx->ownerNext->ownerPrev = ctx->ownerPrev;
+
+	ctx->owner = NULL;
+	ctx->ownerPrev = NULL;
+	ctx->ownerNext = NULL;
+}
+
+// Runs before the plugin's handles are freed, and only goes through what it owns.
+// Its callbacks queued on the game thread are dropped, its tasks are taken back from
+// libgearman, its batches send nothing more and its workers unregister their functions.
+void Gearman::OnPluginUnloaded(IPlugin *plugin) {
+	IPluginContext *pContext = plugin->GetBaseContext();
 
-	if (!ctx) {
+	g_Dispatcher.DropPlugin(pContext);
+
+	gearman_plugin *owned = FindPlugin(pContext, false);
+	if(owned == NULL)
 		return;
+
+	for(size_t i = 0; i < m_Plugins.size(); i++) {
+		if(m_Plugins[i] == owned) {
+			m_Plugins.erase(m_Plugins.begin() + i);
+			break;
+		}
+	}
+
+	// Workers' callbacks outlive their handle until every I/O thread let go of them.
+	// Clones share the callbacks, but each has its own connection to unregister.
+	gearman_job_cmd cmd;
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.type = GearmanJobCommand_UnregisterAll;
+
+	for(size_t i = 0; i < owned->workers.size(); i++) {
+		gearman_worker_ctx *ctx = owned->workers[i];
+
+		ctx->lock->Lock();
+		for(size_t j = 0; j < ctx->functions.size(); j++)
+			ctx->functions[j].callback->pFunction = NULL;
+		ctx->commands.push(cmd);
+		ctx->lock->Unlock();
+
+		for(size_t j = 0; j < ctx->clones.size(); j++) {
+			gearman_worker_ctx *clone = ctx->clones[j];
+			clone->lock->Lock();
+			clone->commands.push(cmd);
+			clone->lock->Unlock();
+		}
+	}
+
+	// A batch's tasks only hold the batch, not the plugin. Those not sent yet are
+	// failed by the I/O thread, and no event reaches the batch's callbacks anymore.
+	for(size_t i = 0; i < owned->batches.size(); i++) {
+		gearman_batch *batch = owned->batches[i];
+		batch->cancelled = true;
+		batch->completefunc = NULL;
+		batch->itemfunc = NULL;
+	}
+
+	// Background tasks still have to reach the server, and other tasks may be waiting
+	// on a flight's result
+	gearman_task_ctx *task = owned->tasks;
+	while(task != NULL) {
+		gearman_task_ctx *next = task->ownerNext;
+
+		if(!task->background && task->flight == NULL && !task->finished) {
+			task->cancelled = true;
+			task->thread->Cancel(task);
+		}
+
+		task->owner = NULL;
+		task->ownerPrev = NULL;
+		task->ownerNext = NULL;
+		task = next;
 	}
 
-	gearman_return_t ret = gearman_client_run_tasks(ctx->cContext->client);
-	// TODO use ret
+	delete owned;
 }
 
-void Gearman::OnTerminate(IThreadHandle *pThread, bool cancel) {
+int Gearman::GetInFlight() const {
+	int inflight = 0;
+	for(size_t i = 0; i < g_Stats.GetCount(); i++)
+		inflight += g_Stats.GetAt(i)->counters[GearmanStat_InFlight];
+	return inflight;
 }
 
-void Gearman::KillWorkerThread() {
-	if (m_pWorker) {
-		m_pWorker->Stop(false);
-		g_pThreader->DestroyWorker(m_pWorker);
-		m_pWorker = NULL;
-		s_OneTimeThreaderErrorMsg = false;
+// Callbacks keep running meanwhile, tasks that waited on another one only finish when
+// its result is dispatched
+int Gearman::Drain(unsigned int timeout) {
+	const uint64_t start = Gearman_GetMicroseconds();
+	const uint64_t deadline = start + (uint64_t) timeout * 1000;
+
+	// From inside a callback nothing could be dispatched, it would only wait out the timeout
+	if(g_Dispatcher.IsDispatching())
+		return GetInFlight();
+
+	m_Draining = true;
+
+	int inflight;
+	while((inflight = GetInFlight()) > 0 && Gearman_GetMicroseconds() < deadline) {
+		g_Dispatcher.RunFrame();
+		g_pThreader->ThreadSleep(1);
+	}
+
+	m_Draining = false;
+
+	const unsigned int elapsed = (unsigned int) ((Gearman_GetMicroseconds() - start) / 1000);
+	if(inflight > 0)
+		g_pSM->LogMessage(myself, "[SM] Gearman drain gave up after %u ms, %d tasks still in flight", elapsed, inflight);
+	else
+		g_pSM->LogMessage(myself, "[SM] Gearman drained in %u ms", elapsed);
+
+	return inflight;
+}
+
+bool Gearman::IsDraining() const {
+	return m_Draining;
+}
+
+bool Gearman::AddToQueue(gearman_task_ctx *ctx) {
+	return ctx->thread->Submit(ctx);
+}
+
+// Root console, "sm gearman"
+
+template <class T>
+static void Gearman_PrintPool(const char *name, const ObjectPool<T> &pool) {
+	rootconsole->ConsolePrint("    %-18s %8u live %8u peak %8u capacity %10u bytes", name,
+		pool.GetLive(), pool.GetPeak(), (unsigned int) pool.GetCapacity(), (unsigned int) pool.GetBytes());
+}
+
+void Gearman::PrintMemory() {
+	// Copy first, the I/O threads keep changing these
+	gearman_arena_stats stats = g_ArenaStats;
+
+	unsigned int hitRate = (stats.allocs > 0) ? (unsigned int) ((uint64_t) stats.hits * 100 / stats.allocs) : 0;
+	unsigned int waste = (stats.inUse > 0 && stats.inUse > stats.requested) ? (unsigned int) ((uint64_t) (stats.inUse - stats.requested) * 100 / stats.inUse) : 0;
+
+	rootconsole->ConsolePrint("[Gearman] libgearman arenas (%u open):", stats.arenas);
+	rootconsole->ConsolePrint("    From malloc:       %10u bytes", (unsigned int) stats.system);
+	rootconsole->ConsolePrint("    In use:            %10u bytes (%u requested, %u%% lost to rounding)", (unsigned int) stats.inUse, (unsigned int) stats.requested, waste);
+	rootconsole->ConsolePrint("    Cached:            %10u bytes", (unsigned int) stats.cached);
+	rootconsole->ConsolePrint("    Allocations:       %10u (%u%% from free lists, %u too large for a size class)", stats.allocs, hitRate, stats.large);
+
+	rootconsole->ConsolePrint("[Gearman] Context pools:");
+	Gearman_PrintPool("clients", g_ClientPool);
+	Gearman_PrintPool("tasks", g_TaskPool);
+	Gearman_PrintPool("worker functions", g_WorkerCallbackPool);
+	Gearman_PrintPool("jobs", g_JobPool);
+	Gearman_PrintPool("buffers", g_BufferPool);
+
+	rootconsole->ConsolePrint("[Gearman] Result cache:");
+	rootconsole->ConsolePrint("    Entries:           %10u", (unsigned int) g_Cache.GetCount());
+	rootconsole->ConsolePrint("    In use:            %10u bytes (limit %u)", (unsigned int) g_Cache.GetMemoryUsed(), (unsigned int) g_Cache.GetMemoryLimit());
+}
+
+void Gearman::PrintStats() {
+	if(g_Stats.GetCount() == 0) {
+		rootconsole->ConsolePrint("[Gearman] No tasks were submitted yet.");
+		return;
+	}
+
+	// Latencies are p50/p99 in milliseconds
+	rootconsole->ConsolePrint("[Gearman] %-24s %9s %9s %7s %6s %6s %6s  %-13s %-13s %-13s", "Function", "Submitted", "Completed", "Failed", "Excep", "Flight", "Joined",
+		"Queue p50/99", "Run p50/99", "Callback p50/99");
+
+	for(size_t i = 0; i < g_Stats.GetCount(); i++) {
+		gearman_function_stats *stats = g_Stats.GetAt(i);
+		char latency[GearmanLatency_Count][32];
+
+		for(unsigned int j = 0; j < GearmanLatency_Count; j++) {
+			snprintf(latency[j], sizeof(latency[j]), "%.1f/%.1f", stats->latency[j].GetPercentile(50.0f) / 1000.0f,
+				stats->latency[j].GetPercentile(99.0f) / 1000.0f);
+		}
+
+		rootconsole->ConsolePrint("          %-24s %9d %9d %7d %6d %6d %6d  %-13s %-13s %-13s", stats->name,
+			stats->counters[GearmanStat_Submitted], stats->counters[GearmanStat_Completed], stats->counters[GearmanStat_Failed],
+			stats->counters[GearmanStat_Exceptions], stats->counters[GearmanStat_InFlight], stats->counters[GearmanStat_Coalesced],
+			latency[GearmanLatency_Queue], latency[GearmanLatency_Run], latency[GearmanLatency_Dispatch]);
+	}
+}
+
+void Gearman::OnRootConsoleCommand(const char *cmdname, const ICommandArgs *args) {
+	if(args->ArgC() >= 3) {
+		const char *command = args->Arg(2);
+
+		if(strcmp(command, "memory") == 0) {
+			PrintMemory();
+			return;
+		} else if(strcmp(command, "stats") == 0) {
+			if(args->ArgC() >= 4 && strcmp(args->Arg(3), "reset") == 0) {
+				g_Stats.Reset();
+				rootconsole->ConsolePrint("[Gearman] Statistics were reset.");
+			} else {
+				PrintStats();
+			}
+			return;
+		}
 	}
+
+	rootconsole->ConsolePrint("SourceMod Gearman Menu:");
+	rootconsole->DrawGenericOption("memory", "Allocator and context pool usage");
+	rootconsole->DrawGenericOption("stats", "Task counters and latencies per function, \"stats reset\" clears them");
 }
 
 const sp_nativeinfo_t GearmanNatives[] = {
 	{"GearmanClient_Create", GearmanClient_Create},
 	{"GearmanClient_AddServer", GearmanClient_AddServer},
 	{"GearmanClient_AddTask", GearmanClient_AddTask},
+	{"GearmanClient_AddTaskEx", GearmanClient_AddTaskEx},
+	{"GearmanClient_AddTaskBatch", GearmanClient_AddTaskBatch},
+	{"GearmanClient_DoBackground", GearmanClient_DoBackground},
+	{"GearmanClient_SetCoalescing", GearmanClient_SetCoalescing},
 	{"GearmanClient_SetCreatedCallback", GearmanClient_SetCreatedCallback},
+	{"GearmanClient_SetTimeout", GearmanClient_SetTimeout},
+	{"GearmanClient_SetSharding", GearmanClient_SetSharding},
+	{"GearmanClient_SetConnectTimeout", GearmanClient_SetConnectTimeout},
+	{"GearmanClient_SetSpool", GearmanClient_SetSpool},
+	{"GearmanClient_GetSpoolInfo", GearmanClient_GetSpoolInfo},
 	
 	{"GearmanWorker_Create", GearmanWorker_Create},
 	{"GearmanWorker_AddServer", GearmanWorker_AddServer},
 	{"GearmanWorker_AddFunction", GearmanWorker_AddFunction},
 	{"GearmanWorker_SetIdentifier", GearmanWorker_SetIdentifier},
+	{"GearmanWorker_SetConcurrency", GearmanWorker_SetConcurrency},
+	{"GearmanWorker_SetFunctionLimit", GearmanWorker_SetFunctionLimit},
 	
 	{"GearmanJob_Send", GearmanJob_Send},
+	{"GearmanJob_SendBinary", GearmanJob_SendBinary},
 	{"GearmanJob_SendFail", GearmanJob_SendFail},
 	{"GearmanJob_SendStatus", GearmanJob_SendStatus},
 	{"GearmanJob_FunctionName", GearmanJob_FunctionName},
@@ -840,8 +2644,34 @@ const sp_nativeinfo_t GearmanNatives[] = {
 	{"GearmanJob_WorkloadSize", GearmanJob_WorkloadSize},
 
 	{"GearmanTask_SetCreatedCallback", GearmanTask_SetCreatedCallback},
+	{"GearmanTask_SetTimeout", GearmanTask_SetTimeout},
 	{"GearmanTask_SetStatusCallback", GearmanTask_SetStatusCallback},
 	{"GearmanTask_SetFailCallback", GearmanTask_SetFailCallback},
 	{"GearmanTask_SetWarningCallback", GearmanTask_SetWarningCallback},
+	{"GearmanTask_SetDataCallback", GearmanTask_SetDataCallback},
+	{"GearmanTask_SetExceptionCallback", GearmanTask_SetExceptionCallback},
+	{"GearmanTask_SetCompleteCallback", GearmanTask_SetCompleteCallback},
+	{"GearmanTask_SetCompleteBufferCallback", GearmanTask_SetCompleteBufferCallback},
+
+	{"GearmanBuffer_Size", GearmanBuffer_Size},
+	{"GearmanBuffer_Read", GearmanBuffer_Read},
+	{"GearmanBatch_SetItemCallback", GearmanBatch_SetItemCallback},
+	{"GearmanBatch_Succeeded", GearmanBatch_Succeeded},
+	{"GearmanBatch_GetResultSize", GearmanBatch_GetResultSize},
+	{"GearmanBatch_GetResult", GearmanBatch_GetResult},
+
+	{"Gearman_SetFrameBudget", Gearman_SetFrameBudget},
+	{"Gearman_GetBacklog", Gearman_GetBacklog},
+	{"Gearman_Drain", Gearman_Drain},
+	{"Gearman_GetFrameTime", Gearman_GetFrameTime},
+
+	{"GearmanStats_GetFunctionCount", GearmanStats_GetFunctionCount},
+	{"GearmanStats_GetFunctionName", GearmanStats_GetFunctionName},
+	{"GearmanStats_GetCounter", GearmanStats_GetCounter},
+	{"GearmanStats_GetLatency", GearmanStats_GetLatency},
+	{"GearmanStats_Reset", GearmanStats_Reset},
+	{"GearmanCache_SetTTL", GearmanCache_SetTTL},
+	{"GearmanCache_SetMemoryLimit", GearmanCache_SetMemoryLimit},
+	{"GearmanCache_Clear", GearmanCache_Clear},
 	{NULL, NULL}
 };
@@ -41,10 +41,40 @@
 
 #include <IThreader.h>
 #include <sm_queue.h>
+#include <sm_ring.h>
+#include <sm_pool.h>
 
-gearman_return_t Gearman_CallWorker(gearman_job_st *job, void *context);
+#include "dispatch.h"
+#include "arena.h"
+#include "stats.h"
+#include "coalesce.h"
+#include "cache.h"
+#include "spool.h"
+#include "server.h"
+#include "timer.h"
 
-class GearmanWorkerThread;
+extern IThreader *g_pThreader;
+
+class GearmanIOThread;
+
+/* Upper bound for the GearmanIOThreads core.cfg setting */
+#define GEARMAN_MAX_IO_THREADS		16
+#define GEARMAN_DEFAULT_IO_THREADS	2
+
+/* How long unloading waits for tasks in flight, the GearmanDrainTimeout core.cfg setting (ms) */
+#define GEARMAN_DEFAULT_DRAIN_TIMEOUT	5000
+
+/* Tasks a client can have submitted but not yet picked up by its I/O thread */
+#define GEARMAN_PENDING_CAPACITY	4096
+
+/* Jobs a worker grabs ahead while earlier ones are still with the plugin */
+#define GEARMAN_WORKER_PREFETCH		16
+
+/* Tasks one GearmanClient_AddTaskBatch call can submit */
+#define GEARMAN_MAX_BATCH			4096
+
+/* Upper bound for GearmanWorker_SetConcurrency */
+#define GEARMAN_MAX_WORKER_CONNECTIONS	32
 
 enum GearmanPriority {
 	GearmanPriority_Low,
@@ -59,47 +89,248 @@ enum GearmanResp {
 	GearmanResp_Exception
 };
 
+enum GearmanJobCommand {
+	GearmanJobCommand_Data,
+	GearmanJobCommand_Warning,
+	GearmanJobCommand_Status,
+	GearmanJobCommand_Complete,
+	GearmanJobCommand_Exception,
+	GearmanJobCommand_Fail,
+	GearmanJobCommand_Release,		/* Game thread is done with the job, free it */
+	GearmanJobCommand_UnregisterAll	/* The worker's plugin unloaded, no job */
+};
+
+/* A function added to a worker handle, shared by all of the handle's connections */
 struct gearman_worker_cb {
 	IPluginContext *pContext;
-	funcid_t funcid;
+	IPluginFunction *pFunction;		/* Game thread, NULL once its plugin unloaded */
+	char *name;
+	int timeout;
+	unsigned int limit;				/* Jobs at once over all connections, 0 for no limit */
+	volatile unsigned int running;	/* Grabbed and not yet released, over all connections */
+	volatile int refs;				/* One per connection it was registered on */
+};
+
+/* The function as registered on one connection */
+struct gearman_worker_reg {
+	gearman_worker_cb *callback;
+	bool registered;				/* CAN_DO, dropped while callback is at its limit */
+};
+
+struct gearman_job_ctx;
+
+/* A result for the server, queued on the game thread and sent by the worker's I/O thread */
+struct gearman_job_cmd {
+	GearmanJobCommand type;
+	gearman_job_ctx *job;
+	char *data;
+	size_t dataSize;
+	uint32_t numerator;
+	uint32_t denominator;
+};
+
+struct gearman_task_ctx;
+
+/* A server added on the game thread, the client's I/O thread adds it to libgearman */
+struct gearman_server_addr {
+	char *host;
+	in_port_t port;
+};
+
+struct gearman_batch_result {
+	char *data;								/* Result, or the error if it failed */
+	size_t dataSize;
+	bool done;
+	bool success;
+};
+
+/* Tasks submitted together, reported through one handle instead of a handle each */
+struct gearman_batch {
+	IPluginContext *pContext;
+	Handle_t hndl;
+	volatile int refs;						/* One for the handle, one per task */
+	volatile bool cancelled;				/* Its plugin unloaded, tasks not sent yet are failed */
+
+	char *workload;							/* All workloads back to back, the tasks point into it */
+	unsigned int count;
+
+	/* Game thread */
+	gearman_batch_result *results;
+	unsigned int completed;
+	unsigned int failed;
+	IPluginFunction *completefunc;
+	IPluginFunction *itemfunc;
 };
 
 struct gearman_client_ctx {
 	IPluginContext *pContext;
-	gearman_client_st *client;
-	funcid_t createdFunc;
+	GearmanArena *arena;					/* Everything the servers' clients allocate, outlives them until released */
+	IPluginFunction *createdFunc;			/* Copied into every new task */
+	bool coalesce;							/* Identical tasks wait for the one in flight */
+	GearmanSpool *spool;					/* Keeps background tasks no server took, set once */
+
+	IMutex *lock;							/* Guards servers */
+	Queue<gearman_server_addr> servers;		/* Game thread -> thread, added before anything else runs */
+	volatile int newServers;
+
+	/* Owned by thread, one per server added */
+	CVector<GearmanServer *> connections;
+	unsigned int nextConnection;			/* Where the search for the best server starts */
+	GearmanRing ring;						/* Over connections, for sharding */
+	volatile bool shard;					/* Route tasks by key over ring, see GearmanClient_SetSharding */
+	volatile int connectTimeout;			/* Milliseconds, see GearmanClient_SetConnectTimeout */
+	volatile int taskTimeout;				/* Milliseconds every new task gets, 0 for none */
+	uint64_t nextCheck;						/* For tasks the server didn't acknowledge in time */
+
+	GearmanIOThread *thread;				/* The only thread that touches client */
+	SPSCRing<gearman_task_ctx *> *pending;	/* Game thread -> thread, not yet handed to libgearman */
+	gearman_task_ctx *inflight;				/* Handed to libgearman, owned by thread */
+	volatile int scheduled;					/* Queued on (or being run by) thread */
+	volatile bool closing;					/* Handle was closed, thread frees it */
 };
 
 struct gearman_worker_ctx {
 	IPluginContext *pContext;
 	gearman_worker_st *worker;
-	GearmanWorkerThread *thread;
+	GearmanArena *arena;					/* Everything worker allocates, outlives it until released */
+	IMutex *lock;							/* Guards worker, functions and commands */
+	CVector<gearman_worker_reg> functions;
+	Queue<gearman_job_cmd> commands;		/* Game thread -> thread, in order */
+	GearmanIOThread *thread;				/* Set once the first function is added */
+	unsigned int jobs;						/* Grabbed and not yet released */
+	unsigned int prefetch;
+	bool unregistering;						/* A CANT_DO wasn't sent yet, hold off registering */
+	bool stopped;							/* Unregistered everything for good, see GearmanJobCommand_UnregisterAll */
+	volatile bool closing;					/* Handle was closed, freed once jobs is 0 */
+
+	/* The handle's worker only, game thread. Clones of worker, each on its own connection
+	   and I/O thread, see GearmanWorker_SetConcurrency */
+	CVector<gearman_worker_ctx *> clones;
+};
+
+struct gearman_job_ctx {
+	gearman_worker_ctx *wContext;
+	gearman_job_st *job;
+	char *workload;							/* Taken from job, NUL terminated */
+	size_t workloadSize;
+	gearman_worker_cb *callback;			/* The function it was grabbed for */
+	Handle_t hndl;
+	bool finished;							/* Game thread, a final result was queued */
+};
+
+struct gearman_plugin;
+
+/* A task's dispatch table, one slot per plugin callback */
+enum GearmanTaskCallback {
+	GearmanTaskCallback_Created,
+	GearmanTaskCallback_Status,
+	GearmanTaskCallback_Warning,
+	GearmanTaskCallback_Data,
+	GearmanTaskCallback_Exception,
+	GearmanTaskCallback_Complete,
+	GearmanTaskCallback_CompleteBuffer,	/* Called instead of Complete if set */
+	GearmanTaskCallback_Fail,
+	GearmanTaskCallback_Count
 };
 
 struct gearman_task_ctx {
 	IPluginContext *pContext;
-	gearman_client_ctx *cContext;
+	gearman_client_ctx *cContext;	/* Freed with the client, the task's handle can outlive it */
+	GearmanIOThread *thread;		/* The client's, for requests after the client is gone */
 	gearman_task_st *task;
 	gearman_return_t *ret;
 
 	Handle_t hndl;
+	volatile int refs;		/* One for the handle, one for the I/O pipeline (then libgearman) */
+
+	/* Copied at submission, the I/O thread adds the task to libgearman */
+	char *function;
+	char *workload;
+	size_t workloadSize;
+	char *unique;			/* NULL for none */
+	GearmanPriority priority;
+	bool background;		/* Done once the server queued it, completes with the job handle */
+	bool replay;			/* Read back from the client's spool, only the spool hears how it ends */
+	volatile bool cancelled;	/* Its plugin unloaded, events only go to the counters */
+
+	/* Game thread, the plugin that holds the task's handle. In its list while the handle is open. */
+	gearman_plugin *owner;
+	gearman_task_ctx *ownerPrev;
+	gearman_task_ctx *ownerNext;
+
+	/* Tasks that joined this one, see GearmanFlights. Set before it's queued. */
+	gearman_flight *flight;
+
+	/* The result goes into GearmanCache, NULL for uncached functions or cache hits */
+	gearman_cache_fn *cache;
+
+	/* Set for tasks of a batch, which have no handle. Only the first one is queued on
+	   the client, the others are chained to it. */
+	gearman_batch *batch;
+	unsigned int batchIndex;
+	gearman_task_ctx *batchNext;
+
+	gearman_task_ctx *inflightPrev;
+	gearman_task_ctx *inflightNext;
+	bool linked;
+
+	/* The server it was handed to, a task no server acknowledged can move on to another */
+	GearmanServer *server;
+	unsigned int attempts;
+
+	/* Fails the task once it's been in flight for timeout milliseconds since it was
+	   submitted, 0 for never. Armed on the client's I/O thread while the task is linked. */
+	volatile int timeout;
+	gearman_timer timer;
+
+	/* Latency accounting, the times are written before the event that reads them is queued */
+	gearman_function_stats *stats;
+	uint64_t submitTime;
+	uint64_t sentTime;		/* Handed to the server */
+	uint64_t createdTime;	/* 0 until the server created the job */
+	uint64_t finishTime;
+	volatile bool finished;	/* Counted as completed or failed, set on whichever thread ended it */
 
-	funcid_t createdfunc;
-	funcid_t statusfunc;
-	funcid_t failfunc;
-	funcid_t warningfunc;
-	funcid_t completefunc;
+	/* Resolved when set, NULL for none. The task's handle closes with its plugin,
+	   events that arrive after that are dropped before these are looked at. */
+	IPluginFunction *callbacks[GearmanTaskCallback_Count];
 };
 
+/* What a plugin has open, so unloading it only touches its own things. Game thread. */
+struct gearman_plugin {
+	IPluginContext *pContext;
+	gearman_task_ctx *tasks;				/* Through ownerNext */
+	CVector<gearman_worker_ctx *> workers;
+	CVector<gearman_batch *> batches;		/* Until their handle is closed */
+};
+
+/* Result data handed to a plugin as a GearmanBuffer handle, without copying it */
+struct gearman_buffer {
+	char *data;
+	size_t size;
+};
+
+/* Context structs that are created at task/job rate come from these instead of new */
+extern ObjectPool<gearman_client_ctx> g_ClientPool;
+extern ObjectPool<gearman_task_ctx> g_TaskPool;
+extern ObjectPool<gearman_worker_cb> g_WorkerCallbackPool;
+extern ObjectPool<gearman_job_ctx> g_JobPool;
+extern ObjectPool<gearman_buffer> g_BufferPool;
+
 /**
  * @brief Sample implementation of the SDK Extension.
  * Note: Uncomment one of the pre-defined virtual functions in order to use it.
  */
-class Gearman : public SDKExtension, public IHandleTypeDispatch, public IThread, public IThreadWorkerCallbacks {
+class Gearman : public SDKExtension, public IHandleTypeDispatch, public IRootConsoleCommand, public IPluginsListener {
 private:
-	Queue<gearman_task_ctx *> m_TaskQueue;
-	IMutex *m_pQueueLock;				/* Queue safety lock */
-	IThreadWorker *m_pWorker;			/* Worker thread object */
+	GearmanIOThread *m_IOThreads[GEARMAN_MAX_IO_THREADS];
+	unsigned int m_IOThreadCount;
+	unsigned int m_NextIOThread;
+
+	/* Plugins with open task or worker handles */
+	CVector<gearman_plugin *> m_Plugins;
+
+	bool m_Draining;						/* No new tasks are accepted, see Drain */
 public:
 	/**
 	 * @brief This is called after the initial loading sequence has been processed.
@@ -135,8 +366,10 @@ public:
 	gearman_client_ctx* GetGearmanClientInstanceByHandle(Handle_t);
 	gearman_worker_ctx* GetGearmanWorkerInstanceByHandle(Handle_t);
 
-	gearman_job_st* GetGearmanJobInstanceByHandle(Handle_t);
+	gearman_job_ctx* GetGearmanJobInstanceByHandle(Handle_t);
 	gearman_task_ctx* GetGearmanTaskCtxInstanceByHandle(Handle_t);
+	gearman_buffer* GetGearmanBufferInstanceByHandle(Handle_t);
+	gearman_batch* GetGearmanBatchInstanceByHandle(Handle_t);
 	
 	HandleType_t gearmanClientHandleType;
 	
@@ -145,22 +378,51 @@ public:
 	HandleType_t gearmanJobHandleType;
 
 	HandleType_t gearmanTaskHandleType;
+
+	HandleType_t gearmanBufferHandleType;
+
+	HandleType_t gearmanBatchHandleType;
 	
+	GearmanIOThread *AssignIOThread();
 	bool AddToQueue(gearman_task_ctx *ctx);
+	void AddWorker(gearman_worker_ctx *ctx);
+	void AddTask(gearman_task_ctx *ctx);
+	void AddBatch(gearman_batch *batch);
+
+	/* Game thread. Waits for the tasks in flight, returns how many are left after timeout ms. */
+	int Drain(unsigned int timeout);
+	bool IsDraining() const;
 public:
 	void RunFrame();
 public:
 	void OnHandleDestroy(HandleType_t type, void *object);
-public: //IThread
-	void RunThread(IThreadHandle *pThread);
-	void OnTerminate(IThreadHandle *pThread, bool cancel);
-public: //IThreadWorkerCallbacks
-	void OnWorkerStart(IThreadWorker *pWorker);
-	void OnWorkerStop(IThreadWorker *pWorker);
+public: //IPluginsListener
+	void OnPluginUnloaded(IPlugin *plugin);
+public:
+	void OnRootConsoleCommand(const char *cmdname, const ICommandArgs *args);
+private:
+	void PrintMemory();
+	void PrintStats();
 private:
-	void KillWorkerThread();
+	void StartIOThreads();
+	void KillIOThreads();
+	gearman_plugin *FindPlugin(IPluginContext *pContext, bool create);
+	int GetInFlight() const;
+	void RemoveWorker(gearman_worker_ctx *ctx);
+	void RemoveTask(gearman_task_ctx *ctx);
+	void RemoveBatch(gearman_batch *batch);
 };
 
 extern const sp_nativeinfo_t GearmanNatives[];
 
+void Gearman_TaskRelease(gearman_task_ctx *ctx);
+void Gearman_TaskLink(gearman_task_ctx *ctx);
+void Gearman_TaskUnlink(gearman_task_ctx *ctx);
+void Gearman_QueueTaskEvent(gearman_task_ctx *ctx, GearmanCallbackType type, const void *data, size_t dataSize);
+GearmanServer *Gearman_ClientConnect(gearman_client_ctx *ctx, const char *host, in_port_t port);
+gearman_task_ctx *Gearman_SpoolTaskCreate(gearman_client_ctx *client, const gearman_spool_entry &entry);
+void Gearman_WorkerFree(gearman_worker_ctx *ctx);
+void Gearman_QueueJobEvent(gearman_job_ctx *ctx);
+void Gearman_JobFree(gearman_job_ctx *ctx);
+
 #endif // _INCLUDE_SOURCEMOD_EXTENSION_PROPER_H_
@@ -0,0 +1,722 @@
+#include "iothread.h"
+
+GearmanIOThread::GearmanIOThread() : m_Ready(GEARMAN_READY_CAPACITY), m_NewWorkers(GEARMAN_READY_CAPACITY),
+	m_TaskRequests(GEARMAN_TASK_REQUESTS, RingOverflow_Reject), m_pResults(NULL), m_pThread(NULL), m_Running(false) {
+}
+
+GearmanIOThread::~GearmanIOThread() {
+	Stop();
+}
+
+bool GearmanIOThread::Start() {
+	ThreadParams params;
+	params.flags = Thread_Default;
+	params.prio = ThreadPrio_Normal;
+
+	m_Running = true;
+	m_pThread = g_pThreader->MakeThread(this, &params);
+	if(m_pThread == NULL) {
+		m_Running = false;
+		return false;
+	}
+
+	return true;
+}
+
+void GearmanIOThread::Stop() {
+	if(m_pThread == NULL)
+		return;
+
+	m_Running = false;
+	m_pThread->WaitForThread();
+	m_pThread->DestroyThis();
+	m_pThread = NULL;
+
+	// Nobody runs these anymore, fail what never made it to libgearman
+	gearman_client_ctx *client;
+	gearman_task_ctx *task;
+	while(m_Ready.pop(client)) {
+		while(client->pending->pop(task)) {
+			while(task != NULL) {
+				gearman_task_ctx *next = task->batchNext;
+				FailTask(task, "The gearman extension is shutting down");
+				task = next;
+			}
+		}
+
+		client->scheduled = 0;
+		if(client->closing)
+			FreeClient(client);
+	}
+
+	while(m_TaskRequests.pop(task))
+		Gearman_TaskRelease(task);
+
+	// Workers left open go back to the game thread, closing their handle frees them
+	gearman_worker_ctx *worker;
+	while(m_NewWorkers.pop(worker))
+		m_Workers.push_back(worker);
+
+	for(size_t i = 0; i < m_Workers.size(); i++) {
+		worker = m_Workers[i];
+		worker->thread = NULL;
+		DropJobCommands(worker);
+		if(worker->closing && worker->jobs == 0)
+			Gearman_WorkerFree(worker);
+	}
+	m_Workers.clear();
+}
+
+// A client is on m_Ready at most once: whoever flips scheduled from 0 to 1 queues it,
+// and only the thread running it clears the flag again.
+void GearmanIOThread::Schedule(gearman_client_ctx *client) {
+	if(__sync_bool_compare_and_swap(&client->scheduled, 0, 1))
+		m_Ready.push(client);
+}
+
+bool GearmanIOThread::Submit(gearman_task_ctx *task) {
+	gearman_client_ctx *client = task->cContext;
+
+	if(m_pThread == NULL)
+		return false;
+
+	if(!client->pending->push(task))
+		return false;
+
+	Schedule(client);
+	return true;
+}
+
+void GearmanIOThread::Close(gearman_client_ctx *client) {
+	client->closing = true;
+	__sync_synchronize();
+
+	// If this thread isn't holding the client we can free it right here,
+	// otherwise it is freed on its next pass
+	if(__sync_bool_compare_and_swap(&client->scheduled, 0, 1))
+		FreeClient(client);
+}
+
+bool GearmanIOThread::Attach(gearman_worker_ctx *worker) {
+	if(m_pThread == NULL)
+		return false;
+
+	worker->thread = this;
+	if(!m_NewWorkers.push(worker)) {
+		worker->thread = NULL;
+		return false;
+	}
+
+	return true;
+}
+
+void GearmanIOThread::Close(gearman_worker_ctx *worker) {
+	// Freed on this thread's next pass, see RunWorkers
+	worker->closing = true;
+}
+
+// The task's timeout was changed, it's rearmed if it's in flight by then
+bool GearmanIOThread::SetTimeout(gearman_task_ctx *task) {
+	return PushTaskRequest(task);
+}
+
+// The task was marked cancelled, it's taken back from libgearman if it's in flight by then
+bool GearmanIOThread::Cancel(gearman_task_ctx *task) {
+	return PushTaskRequest(task);
+}
+
+bool GearmanIOThread::PushTaskRequest(gearman_task_ctx *task) {
+	__sync_add_and_fetch(&task->refs, 1);
+	if(!m_TaskRequests.push(task)) {
+		Gearman_TaskRelease(task);
+		return false;
+	}
+	return true;
+}
+
+void GearmanIOThread::RunThread(IThreadHandle *pHandle) {
+	m_pResults = g_Dispatcher.AttachThread(&m_Running);
+
+	gearman_client_ctx *client;
+	gearman_worker_ctx *worker;
+	gearman_task_ctx *task;
+	while(m_Running) {
+		const unsigned int pushed = m_pResults->pushed;
+		bool progress = false;
+
+		while(m_NewWorkers.pop(worker))
+			m_Workers.push_back(worker);
+
+		// Tasks that weren't submitted yet are handled by SubmitTask
+		while(m_TaskRequests.pop(task)) {
+			if(task->linked && task->cancelled)
+				CancelTask(task);
+			else if(task->linked)
+				ArmTimer(task);
+			Gearman_TaskRelease(task);
+		}
+
+		// Only the clients that are ready now, busy ones are queued again behind them
+		for(size_t count = m_Ready.size(); count > 0 && m_Ready.pop(client); count--) {
+			if(RunClient(client))
+				progress = true;
+		}
+
+		if(RunTimers())
+			progress = true;
+
+		if(RunWorkers())
+			progress = true;
+
+		if(!progress && m_pResults->pushed == pushed)
+			g_pThreader->ThreadSleep(1);
+	}
+}
+
+void GearmanIOThread::OnTerminate(IThreadHandle *pHandle, bool cancel) {
+}
+
+// Returns true if anything happened that is worth another pass right away
+bool GearmanIOThread::RunClient(gearman_client_ctx *client) {
+	gearman_task_ctx *task;
+	bool progress = false;
+
+	// Tasks submitted after a server was added may need it
+	if(client->newServers != 0)
+		AddServers(client);
+
+	// Everything submitted since the last pass goes out together. A batch is queued
+	// as its first task, the others are chained to it.
+	while(client->pending->pop(task)) {
+		while(task != NULL) {
+			gearman_task_ctx *next = task->batchNext;
+			if(client->closing)
+				FailTask(task, "The client handle was closed");
+			else
+				SubmitTask(client, task);
+			task = next;
+		}
+		progress = true;
+	}
+
+	if(client->closing) {
+		// We still hold scheduled, so the game thread left freeing to us
+		FreeClient(client);
+		return true;
+	}
+
+	if(client->spool != NULL && ReplaySpool(client))
+		progress = true;
+
+	if(client->inflight != NULL) {
+		for(size_t i = 0; i < client->connections.size(); i++) {
+			GearmanServer *server = client->connections[i];
+			if(server->tasks == 0)
+				continue;
+
+			gearman_return_t ret = gearman_client_run_tasks(server->client);
+
+			if(ret == GEARMAN_SUCCESS) {
+				progress = true;
+			} else if(ret != GEARMAN_IO_WAIT && ret != GEARMAN_TIMEOUT) {
+				FailServer(client, server, gearman_client_error(server->client));
+				progress = true;
+			}
+		}
+	}
+
+	CheckServers(client);
+
+	if(!client->pending->empty() || client->inflight != NULL || (client->spool != NULL && client->spool->HasWork())) {
+		// Still busy, go to the back so the other clients on this thread get a turn
+		m_Ready.push(client);
+		return progress;
+	}
+
+	client->scheduled = 0;
+	__sync_synchronize();
+
+	// Catch a submit, server or close that raced with clearing the flag
+	if(!client->pending->empty() || client->newServers != 0 || client->closing)
+		Schedule(client);
+
+	return progress;
+}
+
+bool GearmanIOThread::RunWorkers() {
+	bool progress = false;
+
+	for(size_t i = 0; i < m_Workers.size(); ) {
+		gearman_worker_ctx *worker = m_Workers[i];
+
+		worker->lock->Lock();
+		if(RunWorker(worker))
+			progress = true;
+
+		// A closed worker stays until the game thread released every job it handed out
+		bool done = worker->closing && worker->jobs == 0 && worker->commands.empty();
+		worker->lock->Unlock();
+
+		// Pushing can wait for the game thread, which takes the lock to queue job results
+		for(size_t j = 0; j < m_Grabbed.size(); j++)
+			Gearman_QueueJobEvent(m_Grabbed[j]);
+		m_Grabbed.clear();
+
+		if(done) {
+			m_Workers.erase(m_Workers.begin() + i);
+			Gearman_WorkerFree(worker);
+			continue;
+		}
+
+		i++;
+	}
+
+	return progress;
+}
+
+// Called with worker->lock held
+bool GearmanIOThread::RunWorker(gearman_worker_ctx *worker) {
+	bool progress = false;
+
+	while(!worker->commands.empty()) {
+		gearman_job_cmd &cmd = worker->commands.first();
+
+		// Partly sent, libgearman picks up where it left off on the next call. Nothing
+		// else may go out on the connection until then, so don't grab either.
+		if(!RunJobCommand(worker, cmd))
+			return progress;
+
+		free(cmd.data);
+		worker->commands.pop();
+		progress = true;
+	}
+
+	if(worker->closing)
+		return progress;
+
+	UpdateFunctions(worker);
+
+	gearman_return_t ret;
+	while(worker->jobs < worker->prefetch) {
+		// NULL on GEARMAN_IO_WAIT, GEARMAN_NO_JOBS, or a connection error libgearman
+		// retries on the next call
+		gearman_job_st *job = gearman_worker_grab_job(worker->worker, NULL, &ret);
+
+		// Anything but IO_WAIT means the function changes went out before the grab
+		if(ret != GEARMAN_IO_WAIT)
+			worker->unregistering = false;
+
+		if(job == NULL)
+			break;
+
+		QueueJob(worker, job);
+		UpdateFunctions(worker);
+		progress = true;
+	}
+
+	return progress;
+}
+
+// Keeps functions that are at their limit from being grabbed, on every connection of
+// the handle. Jobs that were assigned before the server saw the CANT_DO still run, so
+// with several connections a function can go over its limit by a few jobs.
+void GearmanIOThread::UpdateFunctions(gearman_worker_ctx *worker) {
+	if(worker->stopped)
+		return;
+
+	for(size_t i = 0; i < worker->functions.size(); i++) {
+		gearman_worker_reg &fn = worker->functions[i];
+		gearman_worker_cb *callback = fn.callback;
+		bool full = callback->limit != 0 && callback->running >= callback->limit;
+
+		if(full && fn.registered) {
+			gearman_worker_unregister(worker->worker, callback->name);
+			fn.registered = false;
+			worker->unregistering = true;
+		} else if(!full && !fn.registered && !worker->unregistering) {
+			// libgearman would add the function a second time while the CANT_DO is still
+			// queued, and send that one first
+			if(gearman_worker_register(worker->worker, callback->name, callback->timeout) == GEARMAN_SUCCESS)
+				fn.registered = true;
+		}
+	}
+}
+
+// Returns false if the command has to be retried
+bool GearmanIOThread::RunJobCommand(gearman_worker_ctx *worker, gearman_job_cmd &cmd) {
+	gearman_job_st *job = (cmd.job != NULL) ? cmd.job->job : NULL;
+	gearman_return_t ret = GEARMAN_SUCCESS;
+
+	switch(cmd.type) {
+	case GearmanJobCommand_Data:
+		ret = gearman_job_send_data(job, cmd.data, cmd.dataSize);
+		break;
+	case GearmanJobCommand_Warning:
+		ret = gearman_job_send_warning(job, cmd.data, cmd.dataSize);
+		break;
+	case GearmanJobCommand_Status:
+		ret = gearman_job_send_status(job, cmd.numerator, cmd.denominator);
+		break;
+	case GearmanJobCommand_Complete:
+		ret = gearman_job_send_complete(job, cmd.data, cmd.dataSize);
+		break;
+	case GearmanJobCommand_Exception:
+		ret = gearman_job_send_exception(job, cmd.data, cmd.dataSize);
+		break;
+	case GearmanJobCommand_Fail:
+		ret = gearman_job_send_fail(job);
+		break;
+	case GearmanJobCommand_Release:
+		Gearman_JobFree(cmd.job);
+		break;
+	case GearmanJobCommand_UnregisterAll:
+		// Goes out as RESET_ABILITIES with the next grab, grabbing goes on for that
+		gearman_worker_unregister_all(worker->worker);
+		for(size_t i = 0; i < worker->functions.size(); i++)
+			worker->functions[i].registered = false;
+		worker->stopped = true;
+		break;
+	}
+
+	// Any other error means the connection is gone, and the server hands the job
+	// to another worker anyway
+	return (ret != GEARMAN_IO_WAIT);
+}
+
+void GearmanIOThread::QueueJob(gearman_worker_ctx *worker, gearman_job_st *job) {
+	const char *name = gearman_job_function_name(job);
+
+	gearman_worker_cb *callback = NULL;
+	for(size_t i = 0; i < worker->functions.size(); i++) {
+		if(strcmp(worker->functions[i].callback->name, name) == 0) {
+			callback = worker->functions[i].callback;
+			break;
+		}
+	}
+
+	if(callback == NULL) {
+		gearman_job_send_fail(job);
+		gearman_job_free(job);
+		return;
+	}
+
+	gearman_job_ctx *ctx = g_JobPool.Alloc();
+	ctx->wContext = worker;
+	ctx->job = job;
+	ctx->callback = callback;
+	ctx->hndl = BAD_HANDLE;
+	ctx->finished = false;
+
+	worker->jobs++;
+	__sync_add_and_fetch(&callback->running, 1);
+	m_Grabbed.push_back(ctx);
+}
+
+// Once stopped, the only thing left to do with queued results is free what they refer to
+void GearmanIOThread::DropJobCommands(gearman_worker_ctx *worker) {
+	while(!worker->commands.empty()) {
+		gearman_job_cmd &cmd = worker->commands.first();
+		if(cmd.type == GearmanJobCommand_Release)
+			Gearman_JobFree(cmd.job);
+
+		free(cmd.data);
+		worker->commands.pop();
+	}
+}
+
+void GearmanIOThread::SubmitTask(gearman_client_ctx *client, gearman_task_ctx *task) {
+	if(task->cancelled || (task->batch != NULL && task->batch->cancelled)) {
+		FailTask(task, "The task was cancelled");
+		return;
+	}
+
+	GearmanServer *server = client->shard ? PickShard(client, task) : PickServer(client);
+	if(server == NULL) {
+		FailTask(task, "No gearman job server is reachable");
+		return;
+	}
+
+	gearman_return_t ret = GEARMAN_SUCCESS;
+	const char *unique = (task->unique != NULL) ? task->unique : "";
+
+	if(task->background) {
+		switch(task->priority) {
+		case GearmanPriority_Low:
+			task->task = gearman_client_add_task_low_background(server->client, NULL, task, task->function, unique, task->workload, task->workloadSize, &ret);
+			break;
+		case GearmanPriority_Normal:
+			task->task = gearman_client_add_task_background(server->client, NULL, task, task->function, unique, task->workload, task->workloadSize, &ret);
+			break;
+		case GearmanPriority_High:
+			task->task = gearman_client_add_task_high_background(server->client, NULL, task, task->function, unique, task->workload, task->workloadSize, &ret);
+			break;
+		}
+	} else {
+		switch(task->priority) {
+		case GearmanPriority_Low:
+			task->task = gearman_client_add_task_low(server->client, NULL, task, task->function, unique, task->workload, task->workloadSize, &ret);
+			break;
+		case GearmanPriority_Normal:
+			task->task = gearman_client_add_task(server->client, NULL, task, task->function, unique, task->workload, task->workloadSize, &ret);
+			break;
+		case GearmanPriority_High:
+			task->task = gearman_client_add_task_high(server->client, NULL, task, task->function, unique, task->workload, task->workloadSize, &ret);
+			break;
+		}
+	}
+
+	if(task->task == NULL) {
+		FailTask(task, gearman_client_error(server->client));
+		return;
+	}
+
+	task->server = server;
+	task->attempts++;
+	task->sentTime = Gearman_GetMicroseconds();
+
+	// libgearman now holds the pipeline's reference, it is dropped in Gearman_TaskContextFree
+	Gearman_TaskLink(task);
+	ArmTimer(task);
+}
+
+// The deadline counts from when the plugin submitted the task
+void GearmanIOThread::ArmTimer(gearman_task_ctx *task) {
+	const int timeout = task->timeout;
+
+	if(timeout > 0)
+		m_Timers.Schedule(&task->timer, task->submitTime + (uint64_t) timeout * 1000);
+	else
+		GearmanTimerWheel::Cancel(&task->timer);
+}
+
+// Only linked tasks are on the wheel, so their client is held by this thread
+bool GearmanIOThread::RunTimers() {
+	gearman_timer *timer = m_Timers.Advance(Gearman_GetMicroseconds());
+	bool progress = (timer != NULL);
+
+	while(timer != NULL) {
+		gearman_timer *next = timer->next;
+		ExpireTask((gearman_task_ctx *) timer->owner);
+		timer = next;
+	}
+
+	return progress;
+}
+
+void GearmanIOThread::ExpireTask(gearman_task_ctx *task) {
+	char error[64];
+	snprintf(error, sizeof(error), "Timed out after %d ms", task->timeout);
+
+	__sync_add_and_fetch(&task->stats->counters[GearmanStat_TimedOut], 1);
+	Gearman_QueueTaskEvent(task, GearmanCallback_Fail, error, strlen(error));
+
+	DetachTask(task);
+	Gearman_TaskRelease(task);
+}
+
+// The plugin is gone, only the counters hear how it ended
+void GearmanIOThread::CancelTask(gearman_task_ctx *task) {
+	const char *error = "The task was cancelled";
+	Gearman_QueueTaskEvent(task, GearmanCallback_Fail, error, strlen(error));
+
+	DetachTask(task);
+	Gearman_TaskRelease(task);
+}
+
+// The up server with the best score, starting the search after the last pick so equal
+// servers take turns. With none up, the servers that are due are probed, which only
+// helps tasks submitted once a probe got its answer (see CheckServers).
+GearmanServer *GearmanIOThread::PickServer(gearman_client_ctx *client) {
+	const size_t count = client->connections.size();
+	GearmanServer *best = NULL;
+
+	for(size_t i = 0; i < count; i++) {
+		GearmanServer *server = client->connections[(client->nextConnection + i) % count];
+		if(server->IsUp() && (best == NULL || server->GetScore() < best->GetScore()))
+			best = server;
+	}
+
+	if(best == NULL) {
+		const uint64_t now = Gearman_GetMicroseconds();
+		for(size_t i = 0; i < count && best == NULL; i++) {
+			GearmanServer *server = client->connections[(client->nextConnection + i) % count];
+			if(server->IsDue(now) && server->Probe(now))
+				best = server;
+		}
+	}
+
+	if(count > 0)
+		client->nextConnection = (client->nextConnection + 1) % count;
+
+	return best;
+}
+
+// The task's key decides, its unique or else its workload. With the key's servers all
+// down this falls back to probing like PickServer.
+GearmanServer *GearmanIOThread::PickShard(gearman_client_ctx *client, gearman_task_ctx *task) {
+	uint32_t hash;
+	if(task->unique != NULL)
+		hash = GearmanRing::HashOf(task->unique, strlen(task->unique));
+	else
+		hash = GearmanRing::HashOf(task->workload, task->workloadSize);
+
+	GearmanServer *server = client->ring.Find(hash);
+	if(server == NULL)
+		server = PickServer(client);
+
+	return server;
+}
+
+void GearmanIOThread::FailTask(gearman_task_ctx *task, const char *error) {
+	if(error == NULL)
+		error = "";
+
+	Gearman_QueueTaskEvent(task, GearmanCallback_Fail, error, strlen(error));
+	Gearman_TaskRelease(task);
+}
+
+void GearmanIOThread::FailInflight(gearman_client_ctx *client, const char *error) {
+	if(error == NULL)
+		error = "";
+
+	while(client->inflight != NULL) {
+		gearman_task_ctx *task = client->inflight;
+		Gearman_QueueTaskEvent(task, GearmanCallback_Fail, error, strlen(error));
+
+		DetachTask(task);
+		Gearman_TaskRelease(task);
+	}
+}
+
+// Takes the task back from libgearman, the pipeline's reference stays with the caller
+void GearmanIOThread::DetachTask(gearman_task_ctx *task) {
+	// Unlink first so Gearman_TaskContextFree doesn't release it a second time
+	Gearman_TaskUnlink(task);
+	gearman_task_set_context(task->task, NULL);
+	gearman_task_free(task->task);
+	task->task = NULL;
+}
+
+// The server goes down. Its tasks that weren't acknowledged yet move to another server,
+// at most once per server the client has, the others fail: their job may be running.
+void GearmanIOThread::FailServer(gearman_client_ctx *client, GearmanServer *server, const char *error) {
+	if(error == NULL)
+		error = "";
+
+	server->Failed(Gearman_GetMicroseconds());
+
+	CVector<gearman_task_ctx *> tasks;
+	for(gearman_task_ctx *task = client->inflight; task != NULL; task = task->inflightNext) {
+		if(task->server == server)
+			tasks.push_back(task);
+	}
+
+	for(size_t i = 0; i < tasks.size(); i++) {
+		gearman_task_ctx *task = tasks[i];
+		DetachTask(task);
+
+		if(task->createdTime == 0 && task->attempts < client->connections.size()) {
+			SubmitTask(client, task);
+		} else {
+			Gearman_QueueTaskEvent(task, GearmanCallback_Fail, error, strlen(error));
+			Gearman_TaskRelease(task);
+		}
+	}
+}
+
+// libgearman never gives up on a connect in non-blocking mode, so a server that is
+// unreachable without refusing the connection is caught here
+void GearmanIOThread::CheckServers(gearman_client_ctx *client) {
+	const uint64_t now = Gearman_GetMicroseconds();
+
+	if(now < client->nextCheck)
+		return;
+	client->nextCheck = now + GEARMAN_SERVER_CHECK_INTERVAL;
+
+	const uint64_t timeout = (uint64_t) client->connectTimeout * 1000;
+	GearmanServer *late = NULL;
+
+	for(gearman_task_ctx *task = client->inflight; task != NULL && late == NULL; task = task->inflightNext) {
+		if(task->createdTime == 0 && now - task->sentTime > timeout)
+			late = task->server;
+	}
+
+	// One at a time, failing it moves tasks around
+	if(late != NULL) {
+		char error[256];
+		snprintf(error, sizeof(error), "%s:%u didn't answer within %d ms", late->host, (unsigned int) late->port, client->connectTimeout);
+		FailServer(client, late, error);
+		return;
+	}
+
+	// Probes that are running are checked on, and servers that are due get theirs even
+	// while others are up, starting one per check. None of it blocks.
+	bool started = false;
+	for(size_t i = 0; i < client->connections.size(); i++) {
+		GearmanServer *server = client->connections[i];
+		if(server->IsProbing()) {
+			server->Probe(now);
+		} else if(!started && server->IsDue(now)) {
+			server->Probe(now);
+			started = true;
+		}
+	}
+}
+
+void GearmanIOThread::AddServers(gearman_client_ctx *client) {
+	client->lock->Lock();
+	while(!client->servers.empty()) {
+		gearman_server_addr &server = client->servers.first();
+		GearmanServer *connection = Gearman_ClientConnect(client, server.host, server.port);
+		if(connection != NULL) {
+			client->connections.push_back(connection);
+			client->ring.Add(connection);
+		}
+		free(server.host);
+		client->servers.pop();
+	}
+	client->newServers = 0;
+	client->lock->Unlock();
+
+	// Worth trying the spool on the new server right away
+	if(client->spool != NULL)
+		client->spool->Recovered();
+}
+
+// Hands the spool's next round to libgearman, the tasks report back to the spool
+bool GearmanIOThread::ReplaySpool(gearman_client_ctx *client) {
+	GearmanSpool *spool = client->spool;
+	unsigned int budget = spool->BeginReplay(Gearman_GetMicroseconds());
+
+	if(budget == 0)
+		return false;
+
+	gearman_spool_entry entry;
+	for(unsigned int i = 0; i < budget && spool->Next(entry); i++)
+		SubmitTask(client, Gearman_SpoolTaskCreate(client, entry));
+
+	spool->EndReplay();
+	return true;
+}
+
+void GearmanIOThread::FreeClient(gearman_client_ctx *client) {
+	// Background tasks still in flight go to the spool, so it's closed after
+	FailInflight(client, "The client handle was closed");
+	if(client->spool != NULL)
+		client->spool->Close();
+
+	client->ring.Clear();
+	for(size_t i = 0; i < client->connections.size(); i++)
+		delete client->connections[i];
+	client->connections.clear();
+	client->arena->Close();
+
+	while(!client->servers.empty()) {
+		free(client->servers.first().host);
+		client->servers.pop();
+	}
+	client->lock->DestroyThis();
+
+	delete client->pending;
+	g_ClientPool.Free(client);
+}
@@ -0,0 +1,91 @@
+#ifndef _INCLUDE_GEARMAN_IOTHREAD_H_
+#define _INCLUDE_GEARMAN_IOTHREAD_H_
+
+#include "extension.h"
+
+/* Clients (or new workers) one I/O thread can have waiting to run */
+#define GEARMAN_READY_CAPACITY		4096
+
+/* Timeout changes and cancellations the game thread can have waiting for one I/O thread */
+#define GEARMAN_TASK_REQUESTS		4096
+
+/* How often a busy client looks for servers that are late acknowledging tasks (microseconds) */
+#define GEARMAN_SERVER_CHECK_INTERVAL	10000
+
+/**
+ * Runs libgearman clients and workers off the game thread.
+ *
+ * Every client and worker is owned by one I/O thread for its whole life and is put in
+ * non-blocking mode, so a thread can drive any number of them in one loop. Natives only
+ * queue submissions on the client; the owning thread hands everything queued to
+ * libgearman and runs it in a single run_tasks pass. Clients that still have work go to
+ * the back of the ready queue. Workers are swept every pass: results the plugins queued
+ * are sent first, then new jobs are grabbed (up to the worker's prefetch) and handed to
+ * the game thread. A client with a spool also replays it from here, see GearmanSpool.
+ *
+ * Each server of a client has its own libgearman client, and every task goes to the
+ * healthiest one that is up (see GearmanServer). Tasks a server didn't acknowledge
+ * before it went down are moved to another one.
+ *
+ * Task deadlines are kept on a timer wheel per thread; a task that runs out of time is
+ * failed and taken back from libgearman like one whose server went away.
+ *
+ * libgearman keeps its sockets private, so there's no fd set to wait on. A pass that
+ * makes no progress anywhere sleeps for a millisecond instead.
+ */
+class GearmanIOThread : public IThread {
+public:
+	GearmanIOThread();
+	~GearmanIOThread();
+public:
+	bool Start();
+	void Stop();
+
+	/* Game thread */
+	bool Submit(gearman_task_ctx *task);
+	void Schedule(gearman_client_ctx *client);
+	void Close(gearman_client_ctx *client);
+	bool Attach(gearman_worker_ctx *worker);
+	void Close(gearman_worker_ctx *worker);
+	bool SetTimeout(gearman_task_ctx *task);
+	bool Cancel(gearman_task_ctx *task);
+public: //IThread
+	void RunThread(IThreadHandle *pHandle);
+	void OnTerminate(IThreadHandle *pHandle, bool cancel);
+private:
+	bool RunClient(gearman_client_ctx *client);
+	void AddServers(gearman_client_ctx *client);
+	bool ReplaySpool(gearman_client_ctx *client);
+	bool RunWorkers();
+	bool RunWorker(gearman_worker_ctx *worker);
+	bool RunJobCommand(gearman_worker_ctx *worker, gearman_job_cmd &cmd);
+	void UpdateFunctions(gearman_worker_ctx *worker);
+	void QueueJob(gearman_worker_ctx *worker, gearman_job_st *job);
+	void DropJobCommands(gearman_worker_ctx *worker);
+	void SubmitTask(gearman_client_ctx *client, gearman_task_ctx *task);
+	GearmanServer *PickServer(gearman_client_ctx *client);
+	GearmanServer *PickShard(gearman_client_ctx *client, gearman_task_ctx *task);
+	void FailTask(gearman_task_ctx *task, const char *error);
+	void FailInflight(gearman_client_ctx *client, const char *error);
+	void DetachTask(gearman_task_ctx *task);
+	void FailServer(gearman_client_ctx *client, GearmanServer *server, const char *error);
+	void CheckServers(gearman_client_ctx *client);
+	void ArmTimer(gearman_task_ctx *task);
+	bool RunTimers();
+	void ExpireTask(gearman_task_ctx *task);
+	void CancelTask(gearman_task_ctx *task);
+	bool PushTaskRequest(gearman_task_ctx *task);
+	void FreeClient(gearman_client_ctx *client);
+private:
+	MPSCRing<gearman_client_ctx *> m_Ready;	/* Clients with work, each at most once (see scheduled) */
+	MPSCRing<gearman_worker_ctx *> m_NewWorkers;
+	MPSCRing<gearman_task_ctx *> m_TaskRequests;	/* Each holds a reference to the task */
+	GearmanTimerWheel m_Timers;				/* Deadlines of the linked tasks of this thread's clients */
+	CVector<gearman_worker_ctx *> m_Workers;	/* Owned by this thread while it runs */
+	CVector<gearman_job_ctx *> m_Grabbed;		/* Jobs of the worker being run, queued after its lock is released */
+	GearmanDispatcher::ResultSource *m_pResults;
+	IThreadHandle *m_pThread;
+	volatile bool m_Running;
+};
+
+#endif // _INCLUDE_GEARMAN_IOTHREAD_H_
@@ -0,0 +1,235 @@
+#include "server.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+GearmanServer::GearmanServer(gearman_client_st *client, const char *host, in_port_t port) : client(client), host(strdup(host)), port(port),
+	tasks(0), m_State(GearmanServer_Up), m_Failures(0), m_RetryAt(0), m_Latency(0),
+	m_ProbeState(GearmanProbe_None), m_ProbeFd(-1), m_ProbeDeadline(0), m_ProbeReceived(0), m_AddressSize(0) {
+}
+
+GearmanServer::~GearmanServer() {
+	StopProbe();
+	gearman_client_free(client);
+	free(host);
+}
+
+bool GearmanServer::IsUp() const {
+	return m_State == GearmanServer_Up;
+}
+
+bool GearmanServer::IsDue(uint64_t now) const {
+	return m_State == GearmanServer_Down && now >= m_RetryAt;
+}
+
+uint64_t GearmanServer::GetScore() const {
+	const uint64_t latency = (m_Latency != 0) ? m_Latency : GEARMAN_SERVER_DEFAULT_LATENCY;
+	return latency * (tasks + 1);
+}
+
+void GearmanServer::Acknowledged(uint64_t latency) {
+	// Weighs the new sample by 1/8
+	m_Latency = (m_Latency == 0) ? latency : m_Latency - m_Latency / 8 + latency / 8;
+	m_Failures = 0;
+}
+
+void GearmanServer::Failed(uint64_t now) {
+	uint64_t delay = GEARMAN_SERVER_RETRY_MIN;
+	for(unsigned int i = 0; i < m_Failures && delay < GEARMAN_SERVER_RETRY_MAX; i++)
+		delay *= 2;
+	if(delay > GEARMAN_SERVER_RETRY_MAX)
+		delay = GEARMAN_SERVER_RETRY_MAX;
+
+	m_State = GearmanServer_Down;
+	m_Failures++;
+	m_RetryAt = now + delay;
+}
+
+bool GearmanServer::Probe(uint64_t now) {
+	if(m_ProbeState == GearmanProbe_None && !StartProbe(now)) {
+		Failed(now);
+		return false;
+	}
+
+	const int result = StepProbe();
+	if(result < 0 || (result == 0 && now >= m_ProbeDeadline)) {
+		StopProbe();
+		Failed(now);
+		return false;
+	}
+
+	if(result == 0)
+		return false;
+
+	StopProbe();
+
+	// The failures in a row count on from here if it goes down again right away
+	m_State = GearmanServer_Up;
+	m_Latency = 0;
+	return true;
+}
+
+bool GearmanServer::IsProbing() const {
+	return m_ProbeState != GearmanProbe_None;
+}
+
+// libgearman's own connection can't be driven a step at a time outside of run_tasks,
+// so the probe talks to the server over a socket of its own
+bool GearmanServer::StartProbe(uint64_t now) {
+	// Only the first probe of a host name may wait on the resolver, libgearman did too
+	if(m_AddressSize == 0) {
+		char service[8];
+		snprintf(service, sizeof(service), "%u", (unsigned int) port);
+
+		addrinfo hints;
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+
+		addrinfo *result = NULL;
+		if(getaddrinfo(host, service, &hints, &result) != 0 || result == NULL)
+			return false;
+
+		memcpy(&m_Address, result->ai_addr, result->ai_addrlen);
+		m_AddressSize = result->ai_addrlen;
+		freeaddrinfo(result);
+	}
+
+	m_ProbeFd = socket(m_Address.ss_family, SOCK_STREAM, 0);
+	if(m_ProbeFd == -1)
+		return false;
+
+	if(fcntl(m_ProbeFd, F_SETFL, fcntl(m_ProbeFd, F_GETFL, 0) | O_NONBLOCK) == -1
+		|| (connect(m_ProbeFd, (sockaddr *) &m_Address, m_AddressSize) == -1 && errno != EINPROGRESS)) {
+		close(m_ProbeFd);
+		m_ProbeFd = -1;
+		return false;
+	}
+
+	m_ProbeState = GearmanProbe_Connecting;
+	m_ProbeDeadline = now + GEARMAN_SERVER_PROBE_TIMEOUT;
+	m_ProbeReceived = 0;
+	return true;
+}
+
+// 1 once the server answered, 0 while waiting for it, -1 if the probe failed
+int GearmanServer::StepProbe() {
+	if(m_ProbeState == GearmanProbe_Connecting) {
+		pollfd pfd;
+		pfd.fd = m_ProbeFd;
+		pfd.events = POLLOUT;
+		pfd.revents = 0;
+
+		const int ready = poll(&pfd, 1, 0);
+		if(ready <= 0)
+			return (ready == 0 || errno == EINTR) ? 0 : -1;
+
+		int error = 0;
+		socklen_t errorSize = sizeof(error);
+		if(getsockopt(m_ProbeFd, SOL_SOCKET, SO_ERROR, &error, &errorSize) == -1 || error != 0)
+			return -1;
+
+		// An ECHO_REQ without data, the header is "\0REQ", the command and the data size
+		const unsigned char request[12] = {0, 'R', 'E', 'Q', 0, 0, 0, GEARMAN_COMMAND_ECHO_REQ, 0, 0, 0, 0};
+
+		// A new connection's send buffer always has room for it
+		if(send(m_ProbeFd, request, sizeof(request), MSG_NOSIGNAL) != (ssize_t) sizeof(request))
+			return -1;
+
+		m_ProbeState = GearmanProbe_Echoing;
+	}
+
+	const ssize_t received = recv(m_ProbeFd, m_ProbeReply + m_ProbeReceived, sizeof(m_ProbeReply) - m_ProbeReceived, 0);
+	if(received == 0)
+		return -1;
+	if(received < 0)
+		return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+
+	m_ProbeReceived += received;
+	if(m_ProbeReceived < sizeof(m_ProbeReply))
+		return 0;
+
+	const uint32_t command = ((uint32_t) m_ProbeReply[4] << 24) | ((uint32_t) m_ProbeReply[5] << 16) | ((uint32_t) m_ProbeReply[6] << 8) | m_ProbeReply[7];
+	if(memcmp(m_ProbeReply, "\0RES", 4) != 0 || command != GEARMAN_COMMAND_ECHO_RES)
+		return -1;
+
+	return 1;
+}
+
+void GearmanServer::StopProbe() {
+	if(m_ProbeFd != -1)
+		close(m_ProbeFd);
+
+	m_ProbeFd = -1;
+	m_ProbeState = GearmanProbe_None;
+}
+
+// FNV-1a, finished with MurmurHash3's mixer so similar keys spread over the whole ring
+uint32_t GearmanRing::HashOf(const void *key, size_t size) {
+	const unsigned char *c = (const unsigned char *) key;
+	uint32_t hash = 2166136261u;
+	for(size_t i = 0; i < size; i++) {
+		hash ^= c[i];
+		hash *= 16777619u;
+	}
+
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6bu;
+	hash ^= hash >> 13;
+	hash *= 0xc2b2ae35u;
+	hash ^= hash >> 16;
+	return hash;
+}
+
+void GearmanRing::Add(GearmanServer *server) {
+	char name[300];
+
+	for(unsigned int i = 0; i < GEARMAN_RING_POINTS; i++) {
+		int length = snprintf(name, sizeof(name), "%s:%u-%u", server->host, (unsigned int) server->port, i);
+
+		gearman_ring_point point;
+		point.hash = HashOf(name, (length < (int) sizeof(name)) ? length : sizeof(name) - 1);
+		point.server = server;
+
+		// Servers are added rarely, keep the points sorted as they come
+		size_t j = m_Points.size();
+		m_Points.push_back(point);
+		while(j > 0 && m_Points[j - 1].hash > point.hash) {
+			m_Points[j] = m_Points[j - 1];
+			j--;
+		}
+		m_Points[j] = point;
+	}
+}
+
+void GearmanRing::Clear() {
+	m_Points.clear();
+}
+
+GearmanServer *GearmanRing::Find(uint32_t hash) const {
+	const size_t count = m_Points.size();
+	if(count == 0)
+		return NULL;
+
+	// The first point at or after hash, wrapping around to the start
+	size_t low = 0, high = count;
+	while(low < high) {
+		size_t middle = (low + high) / 2;
+		if(m_Points[middle].hash < hash)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	for(size_t i = 0; i < count; i++) {
+		GearmanServer *server = m_Points[(low + i) % count].server;
+		if(server->IsUp())
+			return server;
+	}
+	return NULL;
+}
@@ -0,0 +1,123 @@
+#ifndef _INCLUDE_GEARMAN_SERVER_H_
+#define _INCLUDE_GEARMAN_SERVER_H_
+
+#include "smsdk_ext.h"
+
+#include <libgearman-1.0/gearman.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <sh_vector.h>
+
+/* How long a server may take to acknowledge a task before it's treated as down (ms) */
+#define GEARMAN_SERVER_CONNECT_TIMEOUT	1000
+
+/* How long a probe of a down server has to get the server's answer (microseconds) */
+#define GEARMAN_SERVER_PROBE_TIMEOUT	1000000
+
+/* How long a down server is skipped before it's probed, doubling with every failure
+   in a row up to the maximum (microseconds) */
+#define GEARMAN_SERVER_RETRY_MIN		1000000
+#define GEARMAN_SERVER_RETRY_MAX		30000000
+
+/* Latency assumed for a server until it acknowledged a task (microseconds) */
+#define GEARMAN_SERVER_DEFAULT_LATENCY	1000
+
+/* Points every server gets on a GearmanRing */
+#define GEARMAN_RING_POINTS				160
+
+enum GearmanServerState {
+	GearmanServer_Up,				/* Takes tasks */
+	GearmanServer_Down				/* Skipped until retryAt, then probed */
+};
+
+enum GearmanProbeState {
+	GearmanProbe_None,
+	GearmanProbe_Connecting,		/* Waiting for the socket to connect */
+	GearmanProbe_Echoing			/* ECHO_REQ sent, waiting for ECHO_RES */
+};
+
+/**
+ * One job server of a client, with its own libgearman client so a dead server only
+ * holds up the tasks that were handed to it.
+ *
+ * A circuit breaker: a connection error, or a task the server didn't acknowledge in
+ * time, takes it down. Once its retry time passed it's probed with an echo, which
+ * either brings it back up or doubles the time until the next probe. The probe has its
+ * own non-blocking socket and advances a step every time it's looked at, so it never
+ * holds up the I/O thread.
+ *
+ * Owned by the client's I/O thread.
+ */
+class GearmanServer {
+public:
+	GearmanServer(gearman_client_st *client, const char *host, in_port_t port);
+	~GearmanServer();
+public:
+	bool IsUp() const;
+	bool IsDue(uint64_t now) const;
+
+	/* Lower is better, weighs the average latency by the tasks waiting on the server */
+	uint64_t GetScore() const;
+
+	/* The server acknowledged a task latency microseconds after it was sent */
+	void Acknowledged(uint64_t latency);
+	void Failed(uint64_t now);
+
+	/* Starts a probe, or checks on the one running, without blocking. True once the
+	   server answered, a probe without an answer in GEARMAN_SERVER_PROBE_TIMEOUT fails. */
+	bool Probe(uint64_t now);
+	bool IsProbing() const;
+public:
+	gearman_client_st *client;		/* Has only this server */
+	char *host;
+	in_port_t port;
+	unsigned int tasks;				/* Handed to client and not finished yet */
+private:
+	GearmanServerState m_State;
+	unsigned int m_Failures;		/* In a row */
+	uint64_t m_RetryAt;
+	uint64_t m_Latency;				/* Exponentially weighted average, microseconds */
+private:
+	bool StartProbe(uint64_t now);
+	int StepProbe();
+	void StopProbe();
+private:
+	GearmanProbeState m_ProbeState;
+	int m_ProbeFd;
+	uint64_t m_ProbeDeadline;
+	unsigned char m_ProbeReply[12];	/* The reply's header, read as it comes */
+	size_t m_ProbeReceived;
+	sockaddr_storage m_Address;		/* Resolved by the first probe */
+	socklen_t m_AddressSize;
+};
+
+struct gearman_ring_point {
+	uint32_t hash;
+	GearmanServer *server;
+};
+
+/**
+ * Consistent hash ring over a client's servers, for GearmanClient_SetSharding.
+ *
+ * A server's points only depend on its address, so every client (on any game server)
+ * with the same servers maps a key to the same one. Adding a server only moves the
+ * keys that land on its points, and keys of a server that is down go to the next up
+ * server on the ring, returning once it's back.
+ *
+ * Owned by the client's I/O thread.
+ */
+class GearmanRing {
+public:
+	void Add(GearmanServer *server);
+	void Clear();
+
+	/* The first up server at or after hash, NULL if none is up */
+	GearmanServer *Find(uint32_t hash) const;
+
+	static uint32_t HashOf(const void *key, size_t size);
+private:
+	SourceHook::CVector<gearman_ring_point> m_Points;	/* Sorted by hash */
+};
+
+#endif // _INCLUDE_GEARMAN_SERVER_H_
@@ -0,0 +1,211 @@
+#ifndef _INCLUDE_SM_POOL_H
+#define _INCLUDE_SM_POOL_H
+
+#include <new>
+#include <stdlib.h>
+#include <sched.h>
+
+/*
+	Typed slab pool.
+
+	Objects are carved out of slabs of SlabSize and recycled through a free list, so
+	allocating one is a pointer pop instead of a trip through malloc. Every thread keeps
+	a small cache of free objects of its own; only when that runs dry (or overflows) is
+	the shared list touched, half a cache at a time, under a spinlock.
+
+	Objects may be freed on a different thread than the one that allocated them. The
+	cache is per type, so there should be only one pool for each T.
+
+	Slabs are only returned to the system when the pool is destroyed.
+*/
+
+template <class T, size_t SlabSize = 64, size_t CacheSize = 32>
+class ObjectPool
+{
+private:
+	union Node
+	{
+		Node *next;
+		double align;
+		void *alignp;
+		char obj[sizeof(T)];
+	};
+	struct Slab
+	{
+		Slab *next;
+		Node nodes[SlabSize];
+	};
+	struct ThreadCache
+	{
+		Node *head;
+		size_t count;
+	};
+public:
+	ObjectPool() : m_Slabs(NULL), m_Free(NULL), m_Lock(0), m_SlabCount(0), m_Live(0), m_Peak(0), m_Allocs(0)
+	{
+	}
+
+	~ObjectPool()
+	{
+		Slab *slab = m_Slabs;
+		while (slab != NULL)
+		{
+			Slab *next = slab->next;
+			free(slab);
+			slab = next;
+		}
+	}
+
+	T *Alloc()
+	{
+		ThreadCache &cache = Cache();
+		if (cache.head == NULL)
+		{
+			Refill(cache);
+		}
+
+		Node *node = cache.head;
+		cache.head = node->next;
+		cache.count--;
+
+		unsigned int live = __sync_add_and_fetch(&m_Live, 1);
+		unsigned int peak = m_Peak;
+		while (live > peak && !__sync_bool_compare_and_swap(&m_Peak, peak, live))
+		{
+			peak = m_Peak;
+		}
+		__sync_add_and_fetch(&m_Allocs, 1);
+
+		return new (node->obj) T();
+	}
+
+	void Free(T *obj)
+	{
+		if (obj == NULL)
+		{
+			return;
+		}
+
+		obj->~T();
+
+		ThreadCache &cache = Cache();
+		Node *node = reinterpret_cast<Node *>(obj);
+		node->next = cache.head;
+		cache.head = node;
+		cache.count++;
+
+		__sync_sub_and_fetch(&m_Live, 1);
+
+		if (cache.count > CacheSize)
+		{
+			Flush(cache);
+		}
+	}
+public:
+	/* Objects currently handed out */
+	unsigned int GetLive() const
+	{
+		return m_Live;
+	}
+
+	/* Most objects handed out at once */
+	unsigned int GetPeak() const
+	{
+		return m_Peak;
+	}
+
+	/* Alloc calls since the pool was created */
+	unsigned int GetAllocs() const
+	{
+		return m_Allocs;
+	}
+
+	/* Objects the slabs have room for */
+	size_t GetCapacity() const
+	{
+		return m_SlabCount * SlabSize;
+	}
+
+	size_t GetBytes() const
+	{
+		return m_SlabCount * sizeof(Slab);
+	}
+private:
+	static ThreadCache &Cache()
+	{
+		static __thread ThreadCache cache;
+		return cache;
+	}
+
+	void Lock()
+	{
+		while (__sync_lock_test_and_set(&m_Lock, 1))
+		{
+			sched_yield();
+		}
+	}
+
+	void Unlock()
+	{
+		__sync_lock_release(&m_Lock);
+	}
+
+	void Refill(ThreadCache &cache)
+	{
+		Lock();
+
+		if (m_Free == NULL)
+		{
+			Slab *slab = (Slab *)malloc(sizeof(Slab));
+			slab->next = m_Slabs;
+			m_Slabs = slab;
+			m_SlabCount++;
+
+			for (size_t i = 0; i < SlabSize; i++)
+			{
+				slab->nodes[i].next = m_Free;
+				m_Free = &slab->nodes[i];
+			}
+		}
+
+		for (size_t i = 0; i < CacheSize / 2 && m_Free != NULL; i++)
+		{
+			Node *node = m_Free;
+			m_Free = node->next;
+			node->next = cache.head;
+			cache.head = node;
+			cache.count++;
+		}
+
+		Unlock();
+	}
+
+	void Flush(ThreadCache &cache)
+	{
+		Lock();
+
+		while (cache.count > CacheSize / 2)
+		{
+			Node *node = cache.head;
+			cache.head = node->next;
+			cache.count--;
+			node->next = m_Free;
+			m_Free = node;
+		}
+
+		Unlock();
+	}
+private:
+	ObjectPool(const ObjectPool &);
+	ObjectPool & operator =(const ObjectPool &);
+private:
+	Slab *m_Slabs;
+	Node *m_Free;
+	volatile int m_Lock;
+	volatile size_t m_SlabCount;
+	volatile unsigned int m_Live;
+	volatile unsigned int m_Peak;
+	volatile unsigned int m_Allocs;
+};
+
+#endif //_INCLUDE_SM_POOL_H
@@ -0,0 +1,311 @@
+#ifndef _INCLUDE_SM_RING_H
+#define _INCLUDE_SM_RING_H
+
+#include <new>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sched.h>
+
+/*
+	Bounded lock-free ring buffers.
+
+	MPSCRing is the cell-sequence ring by Dmitry Vyukov: every slot carries a sequence
+	number telling producers and consumers whose turn it is, so pushes from any number
+	of threads only contend on one CAS. Popping is also safe from several threads, which
+	is what lets RingOverflow_DropOldest evict from the producer side.
+
+	SPSCRing is the plain head/tail ring for exactly one producer and one consumer.
+	It has no CAS at all. RingOverflow_DropOldest would make the producer a second
+	consumer, so SPSCRing treats it as RingOverflow_Reject.
+
+	Capacities are rounded up to a power of two. The hot indices sit on their own cache
+	lines so producers and the consumer don't false-share.
+*/
+
+#define RING_CACHE_LINE		64
+
+enum RingOverflow {
+	RingOverflow_Block,			/* Spin (yielding) until there is room */
+	RingOverflow_DropOldest,	/* Evict the oldest element, handing it to the drop callback */
+	RingOverflow_Reject			/* Fail the push */
+};
+
+static inline size_t Ring_RoundCapacity(size_t capacity)
+{
+	size_t size = 2;
+	while (size < capacity)
+	{
+		size <<= 1;
+	}
+	return size;
+}
+
+template <class T>
+class MPSCRing
+{
+public:
+	typedef void (*DropFn)(T &obj);
+private:
+	struct Cell
+	{
+		volatile size_t seq;
+		T obj;
+	};
+public:
+	MPSCRing(size_t capacity, RingOverflow policy = RingOverflow_Block, DropFn drop = NULL) :
+		m_Policy(policy), m_Drop(drop), m_Enqueue(0), m_Dequeue(0)
+	{
+		m_Capacity = Ring_RoundCapacity(capacity);
+		m_Mask = m_Capacity - 1;
+		m_Cells = (Cell *)malloc(sizeof(Cell) * m_Capacity);
+		for (size_t i = 0; i < m_Capacity; i++)
+		{
+			new (&m_Cells[i].obj) T();
+			m_Cells[i].seq = i;
+		}
+	}
+
+	~MPSCRing()
+	{
+		for (size_t i = 0; i < m_Capacity; i++)
+		{
+			m_Cells[i].obj.~T();
+		}
+		free(m_Cells);
+	}
+
+	bool push(const T &obj)
+	{
+		for (;;)
+		{
+			if (try_push(obj))
+			{
+				return true;
+			}
+
+			switch (m_Policy)
+			{
+			case RingOverflow_Block:
+				sched_yield();
+				break;
+			case RingOverflow_DropOldest:
+				{
+					T old;
+					if (pop(old) && m_Drop != NULL)
+					{
+						m_Drop(old);
+					}
+					break;
+				}
+			case RingOverflow_Reject:
+				return false;
+			}
+		}
+	}
+
+	bool try_push(const T &obj)
+	{
+		size_t pos = m_Enqueue;
+		Cell *cell;
+
+		for (;;)
+		{
+			cell = &m_Cells[pos & m_Mask];
+			size_t seq = cell->seq;
+			__sync_synchronize();
+			intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+			if (diff == 0)
+			{
+				if (__sync_bool_compare_and_swap(&m_Enqueue, pos, pos + 1))
+				{
+					break;
+				}
+				pos = m_Enqueue;
+			}
+			else if (diff < 0)
+			{
+				/* Full */
+				return false;
+			}
+			else
+			{
+				pos = m_Enqueue;
+			}
+		}
+
+		cell->obj = obj;
+		__sync_synchronize();
+		cell->seq = pos + 1;
+		return true;
+	}
+
+	bool pop(T &out)
+	{
+		size_t pos = m_Dequeue;
+		Cell *cell;
+
+		for (;;)
+		{
+			cell = &m_Cells[pos & m_Mask];
+			size_t seq = cell->seq;
+			__sync_synchronize();
+			intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+
+			if (diff == 0)
+			{
+				if (__sync_bool_compare_and_swap(&m_Dequeue, pos, pos + 1))
+				{
+					break;
+				}
+				pos = m_Dequeue;
+			}
+			else if (diff < 0)
+			{
+				/* Empty */
+				return false;
+			}
+			else
+			{
+				pos = m_Dequeue;
+			}
+		}
+
+		out = cell->obj;
+		__sync_synchronize();
+		cell->seq = pos + m_Mask + 1;
+		return true;
+	}
+
+	/* Only exact when no other thread is pushing or popping */
+	size_t size() const
+	{
+		size_t enq = m_Enqueue;
+		size_t deq = m_Dequeue;
+		return (enq > deq) ? (enq - deq) : 0;
+	}
+
+	bool empty() const
+	{
+		return (size() == 0);
+	}
+
+	size_t capacity() const
+	{
+		return m_Capacity;
+	}
+private:
+	MPSCRing(const MPSCRing &);
+	MPSCRing & operator =(const MPSCRing &);
+private:
+	Cell *m_Cells;
+	size_t m_Capacity;
+	size_t m_Mask;
+	RingOverflow m_Policy;
+	DropFn m_Drop;
+	char m_Pad0[RING_CACHE_LINE];
+	volatile size_t m_Enqueue;
+	char m_Pad1[RING_CACHE_LINE - sizeof(size_t)];
+	volatile size_t m_Dequeue;
+	char m_Pad2[RING_CACHE_LINE - sizeof(size_t)];
+};
+
+template <class T>
+class SPSCRing
+{
+public:
+	SPSCRing(size_t capacity, RingOverflow policy = RingOverflow_Block) :
+		m_Policy(policy), m_Head(0), m_Tail(0)
+	{
+		m_Capacity = Ring_RoundCapacity(capacity);
+		m_Mask = m_Capacity - 1;
+		m_Objs = (T *)malloc(sizeof(T) * m_Capacity);
+		for (size_t i = 0; i < m_Capacity; i++)
+		{
+			new (&m_Objs[i]) T();
+		}
+	}
+
+	~SPSCRing()
+	{
+		for (size_t i = 0; i < m_Capacity; i++)
+		{
+			m_Objs[i].~T();
+		}
+		free(m_Objs);
+	}
+
+	/* Producer only */
+	bool push(const T &obj)
+	{
+		while (!try_push(obj))
+		{
+			if (m_Policy != RingOverflow_Block)
+			{
+				return false;
+			}
+			sched_yield();
+		}
+		return true;
+	}
+
+	bool try_push(const T &obj)
+	{
+		size_t head = m_Head;
+		if (head - m_Tail >= m_Capacity)
+		{
+			return false;
+		}
+
+		m_Objs[head & m_Mask] = obj;
+		__sync_synchronize();
+		m_Head = head + 1;
+		return true;
+	}
+
+	/* Consumer only */
+	bool pop(T &out)
+	{
+		size_t tail = m_Tail;
+		if (tail == m_Head)
+		{
+			return false;
+		}
+		__sync_synchronize();
+
+		out = m_Objs[tail & m_Mask];
+		__sync_synchronize();
+		m_Tail = tail + 1;
+		return true;
+	}
+
+	size_t size() const
+	{
+		return m_Head - m_Tail;
+	}
+
+	bool empty() const
+	{
+		return (m_Head == m_Tail);
+	}
+
+	size_t capacity() const
+	{
+		return m_Capacity;
+	}
+private:
+	SPSCRing(const SPSCRing &);
+	SPSCRing & operator =(const SPSCRing &);
+private:
+	T *m_Objs;
+	size_t m_Capacity;
+	size_t m_Mask;
+	RingOverflow m_Policy;
+	char m_Pad0[RING_CACHE_LINE];
+	volatile size_t m_Head;
+	char m_Pad1[RING_CACHE_LINE - sizeof(size_t)];
+	volatile size_t m_Tail;
+	char m_Pad2[RING_CACHE_LINE - sizeof(size_t)];
+};
+
+#endif //_INCLUDE_SM_RING_H
@@ -0,0 +1,400 @@
+#include "spool.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "dispatch.h"
+
+#define GEARMAN_SPOOL_START		sizeof(gearman_spool_header)
+
+GearmanSpool::GearmanSpool(int fd, char *map, size_t size) : m_Fd(fd), m_Map(map), m_Size(size), m_Read(GEARMAN_SPOOL_START),
+	m_Round(0), m_Pending(0), m_Reading(false), m_RoundFailed(false), m_Rate(GEARMAN_SPOOL_DEFAULT_RATE), m_Tokens(0.0),
+	m_LastRefill(0), m_RetryAt(0), m_RetryDelay(0), m_Stats(NULL), m_Depth(0), m_Bytes(0), m_Spooled(0), m_Replayed(0),
+	m_SampleTime(0), m_SampleReplayed(0), m_SampleRate(0) {
+}
+
+GearmanSpool::~GearmanSpool() {
+	munmap(m_Map, m_Size);
+
+	// Also drops the lock
+	close(m_Fd);
+}
+
+GearmanSpool *GearmanSpool::Open(const char *name, char *error, size_t maxlength) {
+	char path[PLATFORM_MAX_PATH];
+
+	// Fails harmlessly when it's already there
+	smutils->BuildPath(Path_SM, path, sizeof(path), "data/gearman");
+	mkdir(path, 0755);
+
+	smutils->BuildPath(Path_SM, path, sizeof(path), "data/gearman/%s.spool", name);
+
+	int fd = open(path, O_RDWR | O_CREAT, 0644);
+	if(fd < 0) {
+		snprintf(error, maxlength, "Unable to open %s: %s", path, strerror(errno));
+		return NULL;
+	}
+
+	if(flock(fd, LOCK_EX | LOCK_NB) != 0) {
+		snprintf(error, maxlength, "Spool \"%s\" is already in use", name);
+		close(fd);
+		return NULL;
+	}
+
+	struct stat st;
+	if(fstat(fd, &st) != 0) {
+		snprintf(error, maxlength, "Unable to read %s: %s", path, strerror(errno));
+		close(fd);
+		return NULL;
+	}
+
+	size_t size = (size_t) st.st_size;
+	const bool fresh = (size == 0);
+
+	if(!fresh && size < GEARMAN_SPOOL_START) {
+		snprintf(error, maxlength, "%s is not a gearman spool", path);
+		close(fd);
+		return NULL;
+	}
+
+	if(fresh) {
+		size = GEARMAN_SPOOL_INITIAL_SIZE;
+		if(ftruncate(fd, size) != 0) {
+			snprintf(error, maxlength, "Unable to size %s: %s", path, strerror(errno));
+			close(fd);
+			return NULL;
+		}
+	}
+
+	void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if(map == MAP_FAILED) {
+		snprintf(error, maxlength, "Unable to map %s: %s", path, strerror(errno));
+		close(fd);
+		return NULL;
+	}
+
+	GearmanSpool *spool = new GearmanSpool(fd, (char *) map, size);
+	gearman_spool_header *header = spool->Header();
+
+	if(fresh) {
+		header->magic = GEARMAN_SPOOL_MAGIC;
+		header->version = GEARMAN_SPOOL_VERSION;
+		header->head = GEARMAN_SPOOL_START;
+		header->tail = GEARMAN_SPOOL_START;
+		header->records = 0;
+		header->reserved = 0;
+		spool->Flush(0, GEARMAN_SPOOL_START, true);
+	} else if(header->magic != GEARMAN_SPOOL_MAGIC || header->version != GEARMAN_SPOOL_VERSION) {
+		snprintf(error, maxlength, "%s is not a gearman spool", path);
+		delete spool;
+		return NULL;
+	}
+
+	spool->Recover();
+	return spool;
+}
+
+void GearmanSpool::Close() {
+	Flush(0, m_Size, true);
+	delete this;
+}
+
+gearman_spool_header *GearmanSpool::Header() const {
+	return (gearman_spool_header *) m_Map;
+}
+
+// Only records that were completely written before the header took them in count. A
+// tail that doesn't hold up (the file was cut short or edited) is dropped.
+void GearmanSpool::Recover() {
+	gearman_spool_header *header = Header();
+
+	// A file cut short keeps the records before the cut
+	if(header->tail > m_Size)
+		header->tail = m_Size;
+
+	if(header->head < GEARMAN_SPOOL_START || header->head > header->tail) {
+		g_pSM->LogError(myself, "[SM] Gearman spool header is damaged, dropping %u records", header->records);
+		header->head = GEARMAN_SPOOL_START;
+		header->tail = GEARMAN_SPOOL_START;
+	}
+
+	uint64_t offset = header->head;
+	uint32_t records = 0;
+
+	while(offset < header->tail) {
+		const uint64_t left = header->tail - offset;
+		const gearman_spool_record *record = (const gearman_spool_record *) (m_Map + offset);
+
+		if(left < sizeof(gearman_spool_record) || record->size < sizeof(gearman_spool_record) || record->size % 8 != 0 || record->size > left)
+			break;
+
+		const char *function = (const char *) (record + 1);
+		const char *unique = function + record->functionSize + 1;
+		if(sizeof(gearman_spool_record) + record->functionSize + record->uniqueSize + 2 + (uint64_t) record->workloadSize > record->size
+			|| function[record->functionSize] != '\0' || unique[record->uniqueSize] != '\0')
+			break;
+
+		offset += record->size;
+		records++;
+	}
+
+	if(offset != header->tail) {
+		g_pSM->LogError(myself, "[SM] Gearman spool has a damaged record, dropping %u bytes after it", (unsigned int) (header->tail - offset));
+		header->tail = offset;
+	}
+
+	header->records = records;
+	if(header->head == header->tail) {
+		header->head = GEARMAN_SPOOL_START;
+		header->tail = GEARMAN_SPOOL_START;
+	}
+	Flush(0, GEARMAN_SPOOL_START, true);
+
+	m_Read = header->head;
+	m_Depth = records;
+	m_Bytes = (unsigned int) (header->tail - header->head);
+}
+
+// msync wants whole pages. Asynchronous is enough for a crashing server, the pages are
+// shared with the kernel already; a synchronous flush also survives losing the machine.
+void GearmanSpool::Flush(uint64_t offset, size_t size, bool sync) {
+	const uint64_t page = (uint64_t) sysconf(_SC_PAGESIZE);
+	const uint64_t start = offset - (offset % page);
+
+	msync(m_Map + start, (size_t) (offset + size - start), sync ? MS_SYNC : MS_ASYNC);
+}
+
+void GearmanSpool::SetRate(unsigned int rate) {
+	m_Rate = (rate > 0) ? rate : 1;
+}
+
+void GearmanSpool::SetStats(gearman_function_stats *stats) {
+	m_Stats = stats;
+}
+
+gearman_function_stats *GearmanSpool::GetStats() const {
+	return m_Stats;
+}
+
+bool GearmanSpool::Append(const char *function, const char *unique, const char *workload, size_t workloadSize, unsigned int priority) {
+	const size_t functionSize = strlen(function);
+	const size_t uniqueSize = (unique != NULL) ? strlen(unique) : 0;
+
+	if(functionSize > 0xFFFF || uniqueSize > 0xFFFF || workloadSize > GEARMAN_SPOOL_MAX_SIZE)
+		return false;
+
+	const size_t size = (sizeof(gearman_spool_record) + functionSize + uniqueSize + 2 + workloadSize + 7) & ~((size_t) 7);
+	if(!Reserve(size))
+		return false;
+
+	gearman_spool_header *header = Header();
+	gearman_spool_record *record = (gearman_spool_record *) (m_Map + header->tail);
+	record->size = (uint32_t) size;
+	record->workloadSize = (uint32_t) workloadSize;
+	record->functionSize = (uint16_t) functionSize;
+	record->uniqueSize = (uint16_t) uniqueSize;
+	record->priority = (uint8_t) priority;
+	memset(record->reserved, 0, sizeof(record->reserved));
+
+	char *c = (char *) (record + 1);
+	memcpy(c, function, functionSize + 1);
+	c += functionSize + 1;
+	if(unique != NULL)
+		memcpy(c, unique, uniqueSize);
+	c[uniqueSize] = '\0';
+	c += uniqueSize + 1;
+	memcpy(c, workload, workloadSize);
+
+	Flush(header->tail, size, false);
+
+	// The record only exists once the header says so
+	header->tail += size;
+	header->records++;
+	Flush(0, GEARMAN_SPOOL_START, false);
+
+	__sync_add_and_fetch(&m_Depth, 1);
+	__sync_add_and_fetch(&m_Bytes, (unsigned int) size);
+	__sync_add_and_fetch(&m_Spooled, 1);
+	return true;
+}
+
+// Makes room for size bytes at the tail
+bool GearmanSpool::Reserve(size_t size) {
+	gearman_spool_header *header = Header();
+
+	if(header->tail + size <= m_Size)
+		return true;
+
+	// Move the records to the front when they fit into the part that was already
+	// replayed. The copy doesn't touch them, so a crash halfway leaves the header
+	// pointing at intact records.
+	const uint64_t live = header->tail - header->head;
+	const uint64_t shift = header->head - GEARMAN_SPOOL_START;
+
+	if(shift >= live && GEARMAN_SPOOL_START + live + size <= m_Size) {
+		memcpy(m_Map + GEARMAN_SPOOL_START, m_Map + header->head, (size_t) live);
+		Flush(GEARMAN_SPOOL_START, (size_t) live, true);
+
+		header->head = GEARMAN_SPOOL_START;
+		header->tail = GEARMAN_SPOOL_START + live;
+		Flush(0, GEARMAN_SPOOL_START, true);
+
+		m_Read -= shift;
+		return true;
+	}
+
+	return Grow(header->tail + size);
+}
+
+bool GearmanSpool::Grow(size_t size) {
+	size_t newSize = m_Size;
+	while(newSize < size)
+		newSize *= 2;
+
+	if(newSize > GEARMAN_SPOOL_MAX_SIZE)
+		return false;
+
+	if(ftruncate(m_Fd, newSize) != 0)
+		return false;
+
+	void *map = mremap(m_Map, m_Size, newSize, MREMAP_MAYMOVE);
+	if(map == MAP_FAILED)
+		return false;
+
+	m_Map = (char *) map;
+	m_Size = newSize;
+	return true;
+}
+
+unsigned int GearmanSpool::BeginReplay(uint64_t now) {
+	// A round has to be over before the next one starts
+	if(m_Pending > 0 || now < m_RetryAt || m_Read >= Header()->tail)
+		return 0;
+
+	if(m_LastRefill != 0)
+		m_Tokens += (double) (now - m_LastRefill) * m_Rate / 1000000.0;
+	m_LastRefill = now;
+
+	if(m_Tokens > m_Rate)
+		m_Tokens = m_Rate;
+
+	unsigned int budget = (unsigned int) m_Tokens;
+
+	// After a failed round one task finds out whether a server is back
+	if(m_RetryDelay != 0 && budget > 1)
+		budget = 1;
+
+	if(budget > 0)
+		m_Reading = true;
+
+	return budget;
+}
+
+bool GearmanSpool::Next(gearman_spool_entry &entry) {
+	if(!m_Reading || m_Read >= Header()->tail)
+		return false;
+
+	const gearman_spool_record *record = (const gearman_spool_record *) (m_Map + m_Read);
+	entry.function = (const char *) (record + 1);
+	entry.unique = entry.function + record->functionSize + 1;
+	entry.workload = entry.unique + record->uniqueSize + 1;
+	entry.workloadSize = record->workloadSize;
+	entry.priority = record->priority;
+
+	m_Read += record->size;
+	m_Tokens -= 1.0;
+	m_Round++;
+	m_Pending++;
+	return true;
+}
+
+void GearmanSpool::EndReplay() {
+	m_Reading = false;
+
+	// Everything may have failed while it was being submitted
+	if(m_Round > 0 && m_Pending == 0)
+		FinishRound();
+}
+
+void GearmanSpool::Replayed(bool success) {
+	if(!success)
+		m_RoundFailed = true;
+
+	if(--m_Pending == 0 && !m_Reading)
+		FinishRound();
+}
+
+void GearmanSpool::FinishRound() {
+	gearman_spool_header *header = Header();
+
+	if(m_RoundFailed) {
+		// Start over from the head, later
+		m_Read = header->head;
+		m_RetryDelay = (m_RetryDelay == 0) ? GEARMAN_SPOOL_RETRY_MIN : m_RetryDelay * 2;
+		if(m_RetryDelay > GEARMAN_SPOOL_RETRY_MAX)
+			m_RetryDelay = GEARMAN_SPOOL_RETRY_MAX;
+		m_RetryAt = Gearman_GetMicroseconds() + m_RetryDelay;
+	} else {
+		header->head = m_Read;
+		header->records -= m_Round;
+		if(header->head == header->tail) {
+			header->head = GEARMAN_SPOOL_START;
+			header->tail = GEARMAN_SPOOL_START;
+			m_Read = GEARMAN_SPOOL_START;
+		}
+		Flush(0, GEARMAN_SPOOL_START, false);
+
+		m_RetryDelay = 0;
+		m_Depth = header->records;
+		m_Bytes = (unsigned int) (header->tail - header->head);
+		__sync_add_and_fetch(&m_Replayed, m_Round);
+	}
+
+	m_Round = 0;
+	m_RoundFailed = false;
+}
+
+void GearmanSpool::Recovered() {
+	m_RetryAt = 0;
+}
+
+bool GearmanSpool::HasWork() const {
+	return m_Pending > 0 || m_Read < Header()->tail;
+}
+
+unsigned int GearmanSpool::GetDepth() const {
+	return m_Depth;
+}
+
+unsigned int GearmanSpool::GetBytes() const {
+	return m_Bytes;
+}
+
+unsigned int GearmanSpool::GetSpooled() const {
+	return m_Spooled;
+}
+
+unsigned int GearmanSpool::GetReplayed() const {
+	return m_Replayed;
+}
+
+unsigned int GearmanSpool::GetReplayRate() {
+	const uint64_t now = Gearman_GetMicroseconds();
+	const unsigned int replayed = m_Replayed;
+
+	if(m_SampleTime == 0) {
+		m_SampleTime = now;
+		m_SampleReplayed = replayed;
+	} else if(now - m_SampleTime >= 1000000) {
+		m_SampleRate = (unsigned int) ((uint64_t) (replayed - m_SampleReplayed) * 1000000 / (now - m_SampleTime));
+		m_SampleTime = now;
+		m_SampleReplayed = replayed;
+	}
+
+	return m_SampleRate;
+}
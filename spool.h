@@ -0,0 +1,149 @@
+#ifndef _INCLUDE_GEARMAN_SPOOL_H_
+#define _INCLUDE_GEARMAN_SPOOL_H_
+
+#include "smsdk_ext.h"
+
+#include "stats.h"
+
+/* Spool files grow by doubling, from this up to the maximum */
+#define GEARMAN_SPOOL_INITIAL_SIZE	(1024 * 1024)
+#define GEARMAN_SPOOL_MAX_SIZE		(64 * 1024 * 1024)
+
+/* Records a spool replays per second unless the plugin asks for another rate */
+#define GEARMAN_SPOOL_DEFAULT_RATE	500
+
+/* How long replay waits after a failed attempt, doubling up to the maximum (microseconds) */
+#define GEARMAN_SPOOL_RETRY_MIN		1000000
+#define GEARMAN_SPOOL_RETRY_MAX		30000000
+
+#define GEARMAN_SPOOL_MAGIC			0x4c4f5053	/* "SPOL" */
+#define GEARMAN_SPOOL_VERSION		1
+
+/* What GearmanClient_GetSpoolInfo reports, matches GearmanSpoolInfo in gearman.inc */
+enum GearmanSpoolInfo {
+	GearmanSpoolInfo_Depth,			/* Records waiting, including the ones being replayed */
+	GearmanSpoolInfo_Bytes,
+	GearmanSpoolInfo_Spooled,		/* Since it was opened */
+	GearmanSpoolInfo_Replayed,		/* Since it was opened, acknowledged by a server */
+	GearmanSpoolInfo_ReplayRate		/* Records per second */
+};
+
+/* At the start of the file. head and tail are file offsets. */
+struct gearman_spool_header {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t head;				/* First record no server acknowledged yet */
+	uint64_t tail;				/* End of the last complete record */
+	uint32_t records;			/* Between head and tail */
+	uint32_t reserved;
+};
+
+/* Followed by the function and unique, both NUL terminated, then the workload */
+struct gearman_spool_record {
+	uint32_t size;				/* The whole record, a multiple of 8 */
+	uint32_t workloadSize;
+	uint16_t functionSize;		/* Without the terminators */
+	uint16_t uniqueSize;
+	uint8_t priority;
+	uint8_t reserved[3];
+};
+
+/* A record read back for replay, pointing into the mapping until the next Append */
+struct gearman_spool_entry {
+	const char *function;
+	const char *unique;			/* "" for none */
+	const char *workload;
+	size_t workloadSize;
+	unsigned int priority;
+};
+
+/**
+ * Background tasks a client couldn't get to any server, kept in a memory-mapped file
+ * under SourceMod's data directory so they outlive a reload or a crash.
+ *
+ * Records are appended at the tail and replayed from the head in order. Replay goes in
+ * rounds of at most a second's worth of records (see SetRate). The head only moves past
+ * a round once every task in it was queued by a server, if any of them failed the round
+ * is replayed from the start later, so a task can reach the server more than once.
+ *
+ * Opened on the game thread, then only the owning client's I/O thread touches it apart
+ * from the counters, which any thread can read. The file is locked while open, so only
+ * one client (or server process) can use a spool at a time.
+ */
+class GearmanSpool {
+public:
+	/* Game thread, NULL with error set on failure */
+	static GearmanSpool *Open(const char *name, char *error, size_t maxlength);
+	void Close();
+public:
+	/* Game thread, before the spool is handed to a client */
+	void SetRate(unsigned int rate);
+	void SetStats(gearman_function_stats *stats);
+	gearman_function_stats *GetStats() const;
+
+	/* False if the spool is full or the task can't be stored */
+	bool Append(const char *function, const char *unique, const char *workload, size_t workloadSize, unsigned int priority);
+
+	/* Starts a round, returns how many records Next may read in it (0 to skip) */
+	unsigned int BeginReplay(uint64_t now);
+	bool Next(gearman_spool_entry &entry);
+	void EndReplay();
+
+	/* Every record handed out by Next is reported back once */
+	void Replayed(bool success);
+
+	/* A server took something from the client, try replaying right away */
+	void Recovered();
+
+	/* Records are waiting or being replayed */
+	bool HasWork() const;
+
+	/* Any thread */
+	unsigned int GetDepth() const;
+	unsigned int GetBytes() const;
+	unsigned int GetSpooled() const;
+	unsigned int GetReplayed() const;
+
+	/* Game thread, records per second since the previous sample at least a second ago */
+	unsigned int GetReplayRate();
+private:
+	GearmanSpool(int fd, char *map, size_t size);
+	~GearmanSpool();
+
+	gearman_spool_header *Header() const;
+	bool Reserve(size_t size);
+	bool Grow(size_t size);
+	void Recover();
+	void Flush(uint64_t offset, size_t size, bool sync);
+	void FinishRound();
+private:
+	int m_Fd;
+	char *m_Map;
+	size_t m_Size;
+
+	uint64_t m_Read;			/* Next record to replay */
+	unsigned int m_Round;		/* Records read this round */
+	unsigned int m_Pending;		/* Of those, not reported back yet */
+	bool m_Reading;				/* Between BeginReplay and EndReplay */
+	bool m_RoundFailed;
+
+	unsigned int m_Rate;
+	double m_Tokens;
+	uint64_t m_LastRefill;
+	uint64_t m_RetryAt;
+	uint64_t m_RetryDelay;		/* 0 unless the last round failed */
+
+	gearman_function_stats *m_Stats;	/* Counts the replayed tasks */
+
+	volatile unsigned int m_Depth;
+	volatile unsigned int m_Bytes;
+	volatile unsigned int m_Spooled;
+	volatile unsigned int m_Replayed;
+
+	/* Game thread, see GetReplayRate */
+	uint64_t m_SampleTime;
+	unsigned int m_SampleReplayed;
+	unsigned int m_SampleRate;
+};
+
+#endif // _INCLUDE_GEARMAN_SPOOL_H_
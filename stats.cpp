@@ -0,0 +1,193 @@
+#include "stats.h"
+
+#include <string.h>
+
+#define GEARMAN_STATS_SLOTS		(GEARMAN_STATS_MAX_FUNCTIONS * 2)
+
+GearmanStats g_Stats;
+
+GearmanHistogram::GearmanHistogram() {
+	Reset();
+}
+
+unsigned int GearmanHistogram::BucketOf(uint64_t usec) {
+	const unsigned int linear = 2 << GEARMAN_HISTOGRAM_SUB_BITS;
+	if(usec < linear)
+		return (unsigned int) usec;
+
+	unsigned int shift = 63 - __builtin_clzll(usec);
+	if(shift > GEARMAN_HISTOGRAM_MAX_SHIFT)
+		return GEARMAN_HISTOGRAM_BUCKETS - 1;
+
+	// Which power of two, then which eighth of it
+	const unsigned int sub = (unsigned int) (usec >> (shift - GEARMAN_HISTOGRAM_SUB_BITS)) & ((1 << GEARMAN_HISTOGRAM_SUB_BITS) - 1);
+	return linear + ((shift - GEARMAN_HISTOGRAM_SUB_BITS - 1) << GEARMAN_HISTOGRAM_SUB_BITS) + sub;
+}
+
+// Highest value that lands in bucket
+uint64_t GearmanHistogram::BucketLimit(unsigned int bucket) {
+	const unsigned int linear = 2 << GEARMAN_HISTOGRAM_SUB_BITS;
+	if(bucket < linear)
+		return bucket;
+
+	const unsigned int shift = ((bucket - linear) >> GEARMAN_HISTOGRAM_SUB_BITS) + GEARMAN_HISTOGRAM_SUB_BITS + 1;
+	const uint64_t sub = (bucket - linear) & ((1 << GEARMAN_HISTOGRAM_SUB_BITS) - 1);
+	const unsigned int width = shift - GEARMAN_HISTOGRAM_SUB_BITS;
+
+	return (((1 << GEARMAN_HISTOGRAM_SUB_BITS) + sub + 1) << width) - 1;
+}
+
+void GearmanHistogram::Record(uint64_t usec) {
+	__sync_add_and_fetch(&m_Buckets[BucketOf(usec)], 1);
+
+	const unsigned int value = (usec > 0xFFFFFFFF) ? 0xFFFFFFFF : (unsigned int) usec;
+	unsigned int max = m_Max;
+	while(value > max && !__sync_bool_compare_and_swap(&m_Max, max, value))
+		max = m_Max;
+}
+
+void GearmanHistogram::Reset() {
+	for(unsigned int i = 0; i < GEARMAN_HISTOGRAM_BUCKETS; i++)
+		m_Buckets[i] = 0;
+	m_Max = 0;
+}
+
+unsigned int GearmanHistogram::GetCount() const {
+	unsigned int count = 0;
+	for(unsigned int i = 0; i < GEARMAN_HISTOGRAM_BUCKETS; i++)
+		count += m_Buckets[i];
+	return count;
+}
+
+unsigned int GearmanHistogram::GetMax() const {
+	return m_Max;
+}
+
+unsigned int GearmanHistogram::GetPercentile(float percentile) const {
+	// Buckets keep changing while we look, work off one copy
+	unsigned int buckets[GEARMAN_HISTOGRAM_BUCKETS];
+	uint64_t count = 0;
+	for(unsigned int i = 0; i < GEARMAN_HISTOGRAM_BUCKETS; i++) {
+		buckets[i] = m_Buckets[i];
+		count += buckets[i];
+	}
+
+	if(count == 0)
+		return 0;
+
+	if(percentile < 0.0f)
+		percentile = 0.0f;
+	else if(percentile > 100.0f)
+		percentile = 100.0f;
+
+	uint64_t rank = (uint64_t) (percentile / 100.0f * count + 0.5f);
+	if(rank < 1)
+		rank = 1;
+
+	uint64_t seen = 0;
+	unsigned int bucket = 0;
+	for(; bucket < GEARMAN_HISTOGRAM_BUCKETS - 1; bucket++) {
+		seen += buckets[bucket];
+		if(seen >= rank)
+			break;
+	}
+
+	// The bucket's limit can be past anything that was actually recorded
+	uint64_t limit = BucketLimit(bucket);
+	if(limit > m_Max)
+		limit = m_Max;
+	return (unsigned int) limit;
+}
+
+GearmanStats::GearmanStats() : m_Table(NULL) {
+}
+
+GearmanStats::~GearmanStats() {
+	Clear();
+}
+
+// FNV-1a
+size_t GearmanStats::SlotOf(const char *name) const {
+	uint32_t hash = 2166136261u;
+	for(const unsigned char *c = (const unsigned char *) name; *c != '\0'; c++) {
+		hash ^= *c;
+		hash *= 16777619u;
+	}
+
+	size_t slot = hash & (GEARMAN_STATS_SLOTS - 1);
+	while(m_Table[slot] != NULL && strcmp(m_Table[slot]->name, name) != 0)
+		slot = (slot + 1) & (GEARMAN_STATS_SLOTS - 1);
+	return slot;
+}
+
+gearman_function_stats *GearmanStats::Find(const char *name) {
+	if(m_Table == NULL) {
+		m_Table = new gearman_function_stats *[GEARMAN_STATS_SLOTS];
+		memset(m_Table, 0, sizeof(gearman_function_stats *) * GEARMAN_STATS_SLOTS);
+	}
+
+	size_t slot = SlotOf(name);
+	if(m_Table[slot] != NULL)
+		return m_Table[slot];
+
+	if(m_Functions.size() >= GEARMAN_STATS_MAX_FUNCTIONS) {
+		gearman_function_stats *overflow = Lookup(GEARMAN_STATS_OVERFLOW);
+		if(overflow != NULL)
+			return overflow;
+
+		// The table has room for one more than the maximum, this is it
+		name = GEARMAN_STATS_OVERFLOW;
+		slot = SlotOf(name);
+	}
+
+	gearman_function_stats *stats = new gearman_function_stats;
+	stats->name = strdup(name);
+	for(unsigned int i = 0; i < GearmanStat_Count; i++)
+		stats->counters[i] = 0;
+
+	m_Table[slot] = stats;
+	m_Functions.push_back(stats);
+	return stats;
+}
+
+gearman_function_stats *GearmanStats::Lookup(const char *name) const {
+	if(m_Table == NULL)
+		return NULL;
+
+	return m_Table[SlotOf(name)];
+}
+
+size_t GearmanStats::GetCount() const {
+	return m_Functions.size();
+}
+
+gearman_function_stats *GearmanStats::GetAt(size_t index) const {
+	if(index >= m_Functions.size())
+		return NULL;
+
+	return m_Functions[index];
+}
+
+void GearmanStats::Reset() {
+	for(size_t i = 0; i < m_Functions.size(); i++) {
+		gearman_function_stats *stats = m_Functions[i];
+		for(unsigned int j = 0; j < GearmanStat_Count; j++) {
+			if(j != GearmanStat_InFlight)
+				stats->counters[j] = 0;
+		}
+		for(unsigned int j = 0; j < GearmanLatency_Count; j++)
+			stats->latency[j].Reset();
+	}
+}
+
+// Only once no task can refer to an entry anymore
+void GearmanStats::Clear() {
+	for(size_t i = 0; i < m_Functions.size(); i++) {
+		free(m_Functions[i]->name);
+		delete m_Functions[i];
+	}
+	m_Functions.clear();
+
+	delete [] m_Table;
+	m_Table = NULL;
+}
@@ -0,0 +1,106 @@
+#ifndef _INCLUDE_GEARMAN_STATS_H_
+#define _INCLUDE_GEARMAN_STATS_H_
+
+#include "smsdk_ext.h"
+
+#include <sh_vector.h>
+
+/* Values below 16us get a bucket each, then every power of two is split into 8 */
+#define GEARMAN_HISTOGRAM_SUB_BITS	3
+#define GEARMAN_HISTOGRAM_MAX_SHIFT	35		/* Anything above ~9.5 hours lands in the last bucket */
+#define GEARMAN_HISTOGRAM_BUCKETS	((2 << GEARMAN_HISTOGRAM_SUB_BITS) + (GEARMAN_HISTOGRAM_MAX_SHIFT - GEARMAN_HISTOGRAM_SUB_BITS) * (1 << GEARMAN_HISTOGRAM_SUB_BITS))
+
+/* Function names tracked, later ones are counted together under GEARMAN_STATS_OVERFLOW */
+#define GEARMAN_STATS_MAX_FUNCTIONS	1024
+#define GEARMAN_STATS_OVERFLOW		"(other)"
+
+enum GearmanStat {
+	GearmanStat_Submitted,
+	GearmanStat_Completed,
+	GearmanStat_Failed,
+	GearmanStat_Exceptions,		/* Also counted as failed */
+	GearmanStat_InFlight,
+	GearmanStat_Coalesced,		/* Waited for an identical task instead of being sent */
+	GearmanStat_CacheHits,		/* Answered from GearmanCache, also counted as submitted and completed */
+	GearmanStat_CacheMisses,	/* Cached function, but sent to the server */
+	GearmanStat_CacheEvictions,	/* Results dropped for the memory limit before they expired */
+	GearmanStat_Spooled,		/* Background tasks no server took, kept in the client's GearmanSpool */
+	GearmanStat_TimedOut,		/* Failed for their deadline, also counted as failed */
+
+	GearmanStat_Count
+};
+
+enum GearmanLatency {
+	GearmanLatency_Queue,		/* Submitted until the server created the job */
+	GearmanLatency_Run,			/* Created until it completed or failed */
+	GearmanLatency_Dispatch,	/* Completed until the plugin's callback ran */
+
+	GearmanLatency_Count
+};
+
+/**
+ * Log-linear latency histogram in microseconds, precise to within 1/8 of the value.
+ *
+ * Recording is a single atomic increment, so any thread can record while another
+ * one reads percentiles.
+ */
+class GearmanHistogram {
+public:
+	GearmanHistogram();
+public:
+	void Record(uint64_t usec);
+	void Reset();
+
+	unsigned int GetCount() const;
+	unsigned int GetMax() const;
+
+	/* Upper bound of the bucket the percentile (0 - 100) falls in, 0 without samples */
+	unsigned int GetPercentile(float percentile) const;
+private:
+	static unsigned int BucketOf(uint64_t usec);
+	static uint64_t BucketLimit(unsigned int bucket);
+private:
+	volatile unsigned int m_Buckets[GEARMAN_HISTOGRAM_BUCKETS];
+	volatile unsigned int m_Max;
+};
+
+struct gearman_function_stats {
+	char *name;
+	volatile int counters[GearmanStat_Count];
+	GearmanHistogram latency[GearmanLatency_Count];
+};
+
+/**
+ * Counters and latencies for each function name tasks were submitted for.
+ *
+ * Entries are looked up and created on the game thread only, and live until the
+ * extension unloads. A task keeps a pointer to its function's entry, so the I/O
+ * threads record into it without any lookup or lock.
+ */
+class GearmanStats {
+public:
+	GearmanStats();
+	~GearmanStats();
+public:
+	/* Creates the entry if there's none yet */
+	gearman_function_stats *Find(const char *name);
+
+	/* NULL if nothing was submitted for name */
+	gearman_function_stats *Lookup(const char *name) const;
+
+	size_t GetCount() const;
+	gearman_function_stats *GetAt(size_t index) const;
+
+	/* Everything but the in-flight gauges, which would go wrong otherwise */
+	void Reset();
+	void Clear();
+private:
+	size_t SlotOf(const char *name) const;
+private:
+	gearman_function_stats **m_Table;	/* Open addressing, twice the maximum entries */
+	SourceHook::CVector<gearman_function_stats *> m_Functions;
+};
+
+extern GearmanStats g_Stats;
+
+#endif // _INCLUDE_GEARMAN_STATS_H_
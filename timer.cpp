@@ -0,0 +1,84 @@
+#include "timer.h"
+
+#include "dispatch.h"
+
+GearmanTimerWheel::GearmanTimerWheel() : m_Tick(Gearman_GetMicroseconds() / GEARMAN_TIMER_TICK) {
+	for(unsigned int i = 0; i < GEARMAN_TIMER_SLOTS; i++) {
+		m_Slots[i].prev = &m_Slots[i];
+		m_Slots[i].next = &m_Slots[i];
+		m_Slots[i].deadline = 0;
+		m_Slots[i].owner = NULL;
+		m_Slots[i].armed = false;
+	}
+}
+
+void GearmanTimerWheel::Init(gearman_timer *timer, void *owner) {
+	timer->prev = NULL;
+	timer->next = NULL;
+	timer->deadline = 0;
+	timer->owner = owner;
+	timer->armed = false;
+}
+
+void GearmanTimerWheel::Schedule(gearman_timer *timer, uint64_t deadline) {
+	Cancel(timer);
+
+	// The first tick that starts after the deadline, so timers fire late rather than early.
+	// Already due ones go into the next slot Advance looks at.
+	uint64_t tick = deadline / GEARMAN_TIMER_TICK + 1;
+	if(tick <= m_Tick)
+		tick = m_Tick + 1;
+
+	gearman_timer *slot = &m_Slots[tick & (GEARMAN_TIMER_SLOTS - 1)];
+	timer->deadline = deadline;
+	timer->prev = slot->prev;
+	timer->next = slot;
+	slot->prev->next = timer;
+	slot->prev = timer;
+	timer->armed = true;
+}
+
+void GearmanTimerWheel::Cancel(gearman_timer *timer) {
+	if(!timer->armed)
+		return;
+
+	timer->prev->next = timer->next;
+	timer->next->prev = timer->prev;
+	timer->prev = NULL;
+	timer->next = NULL;
+	timer->armed = false;
+}
+
+gearman_timer *GearmanTimerWheel::Advance(uint64_t now) {
+	const uint64_t tick = now / GEARMAN_TIMER_TICK;
+	gearman_timer *expired = NULL;
+
+	if(tick <= m_Tick)
+		return NULL;
+
+	// After a full turn every slot has been passed once
+	uint64_t count = tick - m_Tick;
+	if(count > GEARMAN_TIMER_SLOTS)
+		count = GEARMAN_TIMER_SLOTS;
+
+	for(uint64_t i = 1; i <= count; i++) {
+		gearman_timer *slot = &m_Slots[(m_Tick + i) & (GEARMAN_TIMER_SLOTS - 1)];
+		gearman_timer *timer = slot->next;
+
+		while(timer != slot) {
+			gearman_timer *next = timer->next;
+
+			// Later turns stay where they are
+			if(timer->deadline <= now) {
+				Cancel(timer);
+				timer->next = expired;
+				expired = timer;
+			}
+
+			timer = next;
+		}
+	}
+
+	m_Tick = tick;
+	return expired;
+}
@@ -0,0 +1,45 @@
+#ifndef _INCLUDE_GEARMAN_TIMER_H_
+#define _INCLUDE_GEARMAN_TIMER_H_
+
+#include "smsdk_ext.h"
+
+/* Slots of a GearmanTimerWheel, a power of two, and the time each covers (microseconds).
+   One turn of the wheel is 2.56 seconds, later deadlines wait for their turn in the slot. */
+#define GEARMAN_TIMER_SLOTS		256
+#define GEARMAN_TIMER_TICK		10000
+
+/* Embedded in whatever it times, owner points back at that */
+struct gearman_timer {
+	gearman_timer *prev;
+	gearman_timer *next;
+	uint64_t deadline;
+	void *owner;
+	bool armed;
+};
+
+/**
+ * Hashed timer wheel. Scheduling and cancelling are O(1), Advance only looks at the
+ * slots that passed since the last call.
+ *
+ * Not thread safe, every I/O thread has its own for the tasks of its clients.
+ */
+class GearmanTimerWheel {
+public:
+	GearmanTimerWheel();
+public:
+	static void Init(gearman_timer *timer, void *owner);
+
+	/* Moves the timer if it was already scheduled */
+	void Schedule(gearman_timer *timer, uint64_t deadline);
+
+	/* Does nothing unless the timer is scheduled */
+	static void Cancel(gearman_timer *timer);
+
+	/* Takes every timer that is due off the wheel, chained through next */
+	gearman_timer *Advance(uint64_t now);
+private:
+	gearman_timer m_Slots[GEARMAN_TIMER_SLOTS];	/* Sentinels of circular lists */
+	uint64_t m_Tick;							/* The last tick Advance went through */
+};
+
+#endif // _INCLUDE_GEARMAN_TIMER_H_
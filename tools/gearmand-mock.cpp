@@ -0,0 +1,865 @@
+/**
+ * Minimal gearmand for benchmarking the extension on one machine.
+ *
+ * Speaks the part of the binary protocol libgearman uses for clients and workers:
+ * SUBMIT_JOB (all priorities, background too), CAN_DO/CANT_DO, PRE_SLEEP and NOOP,
+ * GRAB_JOB (plain, UNIQ and ALL), the WORK_* results, GET_STATUS, ECHO and OPTION_REQ.
+ * Nothing is persisted, there's no text admin protocol, and it only listens on 127.0.0.1.
+ *
+ * With -e, jobs for functions no connected worker can do are completed right away with
+ * their workload as the result, so clients can be measured without running a worker.
+ *
+ * With -s, the server answers jobs for these functions itself (unless a worker took the
+ * name), for the extension's checks (sourcepawn/scripting/gearman-checks.sp):
+ *   mock_echo       WORK_COMPLETE with the workload
+ *   mock_fail       WORK_FAIL
+ *   mock_exception  WORK_EXCEPTION with the workload (WORK_FAIL without the exceptions option)
+ *   mock_data       The workload in two WORK_DATA packets, then an empty WORK_COMPLETE
+ *   mock_hang       Never answered
+ *
+ * Usage: gearmand-mock [-p port] [-e] [-s] [-v]
+ */
+
+#include <libgearman-1.0/protocol.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#define MOCK_MAX_CONNECTIONS	1024
+#define MOCK_MAX_PACKET			(64 * 1024 * 1024)
+#define MOCK_JOB_BUCKETS		4096
+#define MOCK_HANDLE_PREFIX		"H:mock:"
+
+struct mock_buffer {
+	char *data;
+	size_t size;
+	size_t capacity;
+};
+
+struct mock_job {
+	unsigned int id;
+	char handle[32];
+	char *function;
+	char *unique;
+	char *workload;
+	size_t workloadSize;
+	int client;				/* Connection that waits for results, -1 for background jobs */
+	int worker;				/* Connection running it, -1 while queued */
+	uint32_t numerator;
+	uint32_t denominator;
+
+	mock_job *next;			/* Queue order */
+	mock_job *hashNext;		/* Bucket chain, by id */
+};
+
+struct mock_conn {
+	int fd;
+	mock_buffer in;
+	mock_buffer out;
+	char **functions;		/* CAN_DO */
+	size_t functionCount;
+	bool sleeping;			/* PRE_SLEEP, wake it with a NOOP */
+	bool exceptions;		/* OPTION_REQ exceptions */
+};
+
+struct mock_queue {
+	mock_job *head;
+	mock_job *tail;
+};
+
+enum mock_script {
+	Script_None,
+	Script_Echo,
+	Script_Fail,
+	Script_Exception,
+	Script_Data,
+	Script_Hang
+};
+
+static const struct {
+	const char *function;
+	mock_script script;
+} g_Scripts[] = {
+	{"mock_echo", Script_Echo},
+	{"mock_fail", Script_Fail},
+	{"mock_exception", Script_Exception},
+	{"mock_data", Script_Data},
+	{"mock_hang", Script_Hang}
+};
+
+enum {
+	Priority_High,
+	Priority_Normal,
+	Priority_Low,
+	Priority_Count
+};
+
+static mock_conn g_Conns[MOCK_MAX_CONNECTIONS];
+static mock_queue g_Queues[Priority_Count];
+static mock_job *g_Jobs[MOCK_JOB_BUCKETS];
+static unsigned int g_NextJobId = 1;
+static bool g_Echo = false;
+static bool g_Scripted = false;
+static bool g_Verbose = false;
+static volatile bool g_Running = true;
+
+static struct {
+	unsigned long long submitted;
+	unsigned long long completed;
+	unsigned long long failed;
+	unsigned long long echoed;
+} g_Counters;
+
+// Buffers
+
+static void Buffer_Reserve(mock_buffer *buffer, size_t extra) {
+	if(buffer->size + extra <= buffer->capacity)
+		return;
+
+	size_t capacity = buffer->capacity ? buffer->capacity : 4096;
+	while(capacity < buffer->size + extra)
+		capacity *= 2;
+
+	char *data = (char *) realloc(buffer->data, capacity);
+	if(data == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+
+	buffer->data = data;
+	buffer->capacity = capacity;
+}
+
+static void Buffer_Append(mock_buffer *buffer, const void *data, size_t size) {
+	Buffer_Reserve(buffer, size);
+	memcpy(buffer->data + buffer->size, data, size);
+	buffer->size += size;
+}
+
+static void Buffer_Consume(mock_buffer *buffer, size_t size) {
+	memmove(buffer->data, buffer->data + size, buffer->size - size);
+	buffer->size -= size;
+}
+
+static void Buffer_Free(mock_buffer *buffer) {
+	free(buffer->data);
+	buffer->data = NULL;
+	buffer->size = 0;
+	buffer->capacity = 0;
+}
+
+static char *Mock_Strndup(const char *str, size_t size) {
+	char *copy = (char *) malloc(size + 1);
+	memcpy(copy, str, size);
+	copy[size] = '\0';
+	return copy;
+}
+
+// Packets
+
+struct mock_arg {
+	const char *data;
+	size_t size;
+};
+
+static void Mock_Send(int conn, gearman_command_t command, const mock_arg *args, size_t argCount) {
+	mock_buffer *out = &g_Conns[conn].out;
+
+	uint32_t size = 0;
+	for(size_t i = 0; i < argCount; i++)
+		size += args[i].size + ((i + 1 < argCount) ? 1 : 0);
+
+	uint32_t header[3];
+	memcpy(&header[0], "\0RES", 4);
+	header[1] = htonl(command);
+	header[2] = htonl(size);
+	Buffer_Append(out, header, sizeof(header));
+
+	for(size_t i = 0; i < argCount; i++) {
+		Buffer_Append(out, args[i].data, args[i].size);
+		if(i + 1 < argCount)
+			Buffer_Append(out, "", 1);
+	}
+}
+
+static void Mock_Send0(int conn, gearman_command_t command) {
+	Mock_Send(conn, command, NULL, 0);
+}
+
+static void Mock_Send1(int conn, gearman_command_t command, const char *data, size_t size) {
+	mock_arg arg = {data, size};
+	Mock_Send(conn, command, &arg, 1);
+}
+
+static void Mock_SendError(int conn, const char *code, const char *text) {
+	mock_arg args[2] = {{code, strlen(code)}, {text, strlen(text)}};
+	Mock_Send(conn, GEARMAN_COMMAND_ERROR, args, 2);
+}
+
+// Splits a packet body into count arguments, the last one takes the rest (and may hold NULs)
+static bool Mock_ParseArgs(const char *body, size_t size, mock_arg *args, size_t count) {
+	size_t offset = 0;
+	for(size_t i = 0; i + 1 < count; i++) {
+		const char *end = (const char *) memchr(body + offset, '\0', size - offset);
+		if(end == NULL)
+			return false;
+
+		args[i].data = body + offset;
+		args[i].size = end - (body + offset);
+		offset += args[i].size + 1;
+	}
+
+	args[count - 1].data = body + offset;
+	args[count - 1].size = size - offset;
+	return true;
+}
+
+static uint32_t Mock_ParseNumber(const mock_arg &arg) {
+	char number[16];
+	size_t size = (arg.size < sizeof(number) - 1) ? arg.size : sizeof(number) - 1;
+	memcpy(number, arg.data, size);
+	number[size] = '\0';
+	return (uint32_t) strtoul(number, NULL, 10);
+}
+
+// Jobs
+
+static mock_job *Job_Find(const char *handle, size_t size) {
+	const size_t prefix = strlen(MOCK_HANDLE_PREFIX);
+	if(size <= prefix || size >= 32 || memcmp(handle, MOCK_HANDLE_PREFIX, prefix) != 0)
+		return NULL;
+
+	char number[32];
+	memcpy(number, handle + prefix, size - prefix);
+	number[size - prefix] = '\0';
+
+	unsigned int id = (unsigned int) strtoul(number, NULL, 10);
+	for(mock_job *job = g_Jobs[id % MOCK_JOB_BUCKETS]; job != NULL; job = job->hashNext) {
+		if(job->id == id)
+			return job;
+	}
+	return NULL;
+}
+
+static void Job_Free(mock_job *job) {
+	mock_job **link = &g_Jobs[job->id % MOCK_JOB_BUCKETS];
+	while(*link != job)
+		link = &(*link)->hashNext;
+	*link = job->hashNext;
+
+	free(job->function);
+	free(job->unique);
+	free(job->workload);
+	free(job);
+}
+
+static void Queue_Push(mock_queue *queue, mock_job *job) {
+	job->next = NULL;
+	if(queue->tail != NULL)
+		queue->tail->next = job;
+	else
+		queue->head = job;
+	queue->tail = job;
+}
+
+static bool Conn_CanDo(int conn, const char *function) {
+	mock_conn *c = &g_Conns[conn];
+	for(size_t i = 0; i < c->functionCount; i++) {
+		if(strcmp(c->functions[i], function) == 0)
+			return true;
+	}
+	return false;
+}
+
+// First queued job the worker can do, highest priority first
+static mock_job *Queue_Take(int conn) {
+	for(int i = 0; i < Priority_Count; i++) {
+		mock_job *prev = NULL;
+		for(mock_job *job = g_Queues[i].head; job != NULL; prev = job, job = job->next) {
+			if(!Conn_CanDo(conn, job->function))
+				continue;
+
+			if(prev != NULL)
+				prev->next = job->next;
+			else
+				g_Queues[i].head = job->next;
+			if(g_Queues[i].tail == job)
+				g_Queues[i].tail = prev;
+
+			job->next = NULL;
+			return job;
+		}
+	}
+	return NULL;
+}
+
+static bool Mock_AnyWorkerCanDo(const char *function) {
+	for(int i = 0; i < MOCK_MAX_CONNECTIONS; i++) {
+		if(g_Conns[i].fd >= 0 && Conn_CanDo(i, function))
+			return true;
+	}
+	return false;
+}
+
+static void Mock_WakeWorkers(const char *function) {
+	for(int i = 0; i < MOCK_MAX_CONNECTIONS; i++) {
+		mock_conn *c = &g_Conns[i];
+		if(c->fd >= 0 && c->sleeping && Conn_CanDo(i, function)) {
+			c->sleeping = false;
+			Mock_Send0(i, GEARMAN_COMMAND_NOOP);
+		}
+	}
+}
+
+static mock_script Mock_FindScript(const char *function) {
+	if(!g_Scripted || Mock_AnyWorkerCanDo(function))
+		return Script_None;
+
+	for(size_t i = 0; i < sizeof(g_Scripts) / sizeof(g_Scripts[0]); i++) {
+		if(strcmp(g_Scripts[i].function, function) == 0)
+			return g_Scripts[i].script;
+	}
+	return Script_None;
+}
+
+// Answers the job the way its script says, the job is freed after
+static void Mock_RunScript(mock_job *job, mock_script script) {
+	const int conn = job->client;
+	mock_arg handle = {job->handle, strlen(job->handle)};
+	mock_arg workload = {job->workload, job->workloadSize};
+
+	switch(script) {
+	case Script_Echo:
+		g_Counters.completed++;
+		if(conn >= 0) {
+			mock_arg args[2] = {handle, workload};
+			Mock_Send(conn, GEARMAN_COMMAND_WORK_COMPLETE, args, 2);
+		}
+		break;
+	case Script_Fail:
+		g_Counters.failed++;
+		if(conn >= 0)
+			Mock_Send(conn, GEARMAN_COMMAND_WORK_FAIL, &handle, 1);
+		break;
+	case Script_Exception:
+		g_Counters.failed++;
+		if(conn >= 0 && g_Conns[conn].exceptions) {
+			mock_arg args[2] = {handle, workload};
+			Mock_Send(conn, GEARMAN_COMMAND_WORK_EXCEPTION, args, 2);
+		} else if(conn >= 0) {
+			Mock_Send(conn, GEARMAN_COMMAND_WORK_FAIL, &handle, 1);
+		}
+		break;
+	case Script_Data:
+		g_Counters.completed++;
+		if(conn >= 0) {
+			const size_t half = job->workloadSize / 2;
+			mock_arg first[2] = {handle, {job->workload, half}};
+			mock_arg second[2] = {handle, {job->workload + half, job->workloadSize - half}};
+			mock_arg done[2] = {handle, {"", 0}};
+			Mock_Send(conn, GEARMAN_COMMAND_WORK_DATA, first, 2);
+			Mock_Send(conn, GEARMAN_COMMAND_WORK_DATA, second, 2);
+			Mock_Send(conn, GEARMAN_COMMAND_WORK_COMPLETE, done, 2);
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+// Requests
+
+static void Mock_Submit(int conn, const char *body, size_t size, int priority, bool background) {
+	mock_arg args[3];
+	if(!Mock_ParseArgs(body, size, args, 3)) {
+		Mock_SendError(conn, "INVALID_PACKET", "Bad SUBMIT_JOB");
+		return;
+	}
+
+	mock_job *job = (mock_job *) calloc(1, sizeof(mock_job));
+	job->id = g_NextJobId++;
+	snprintf(job->handle, sizeof(job->handle), MOCK_HANDLE_PREFIX "%u", job->id);
+	job->function = Mock_Strndup(args[0].data, args[0].size);
+	job->unique = Mock_Strndup(args[1].data, args[1].size);
+	job->workload = Mock_Strndup(args[2].data, args[2].size);
+	job->workloadSize = args[2].size;
+	job->client = background ? -1 : conn;
+	job->worker = -1;
+
+	job->hashNext = g_Jobs[job->id % MOCK_JOB_BUCKETS];
+	g_Jobs[job->id % MOCK_JOB_BUCKETS] = job;
+
+	g_Counters.submitted++;
+	Mock_Send1(conn, GEARMAN_COMMAND_JOB_CREATED, job->handle, strlen(job->handle));
+
+	// Hung jobs wait in the queue for a worker that never comes
+	const mock_script script = Mock_FindScript(job->function);
+	if(script != Script_None && script != Script_Hang) {
+		Mock_RunScript(job, script);
+		Job_Free(job);
+		return;
+	}
+
+	if(g_Echo && script == Script_None && !Mock_AnyWorkerCanDo(job->function)) {
+		if(job->client >= 0) {
+			mock_arg result[2] = {{job->handle, strlen(job->handle)}, {job->workload, job->workloadSize}};
+			Mock_Send(job->client, GEARMAN_COMMAND_WORK_COMPLETE, result, 2);
+		}
+		g_Counters.echoed++;
+		Job_Free(job);
+		return;
+	}
+
+	Queue_Push(&g_Queues[priority], job);
+	Mock_WakeWorkers(job->function);
+}
+
+static void Mock_Grab(int conn, gearman_command_t command) {
+	mock_job *job = Queue_Take(conn);
+	if(job == NULL) {
+		Mock_Send0(conn, GEARMAN_COMMAND_NO_JOB);
+		return;
+	}
+
+	job->worker = conn;
+
+	mock_arg handle = {job->handle, strlen(job->handle)};
+	mock_arg function = {job->function, strlen(job->function)};
+	mock_arg unique = {job->unique, strlen(job->unique)};
+	mock_arg workload = {job->workload, job->workloadSize};
+
+	if(command == GEARMAN_COMMAND_GRAB_JOB) {
+		mock_arg args[3] = {handle, function, workload};
+		Mock_Send(conn, GEARMAN_COMMAND_JOB_ASSIGN, args, 3);
+	} else if(command == GEARMAN_COMMAND_GRAB_JOB_UNIQ) {
+		mock_arg args[4] = {handle, function, unique, workload};
+		Mock_Send(conn, GEARMAN_COMMAND_JOB_ASSIGN_UNIQ, args, 4);
+	} else {
+		mock_arg reducer = {"", 0};
+		mock_arg args[5] = {handle, function, unique, reducer, workload};
+		Mock_Send(conn, GEARMAN_COMMAND_JOB_ASSIGN_ALL, args, 5);
+	}
+}
+
+static void Mock_Work(int conn, gearman_command_t command, const char *body, size_t size) {
+	const size_t argCount = (command == GEARMAN_COMMAND_WORK_FAIL) ? 1 : (command == GEARMAN_COMMAND_WORK_STATUS) ? 3 : 2;
+
+	mock_arg args[3];
+	if(!Mock_ParseArgs(body, size, args, argCount))
+		return;
+
+	mock_job *job = Job_Find(args[0].data, args[0].size);
+	if(job == NULL || job->worker != conn)
+		return;
+
+	if(command == GEARMAN_COMMAND_WORK_STATUS) {
+		job->numerator = Mock_ParseNumber(args[1]);
+		job->denominator = Mock_ParseNumber(args[2]);
+	}
+
+	if(job->client >= 0) {
+		if(command == GEARMAN_COMMAND_WORK_EXCEPTION && !g_Conns[job->client].exceptions)
+			Mock_Send(job->client, GEARMAN_COMMAND_WORK_FAIL, args, 1);
+		else
+			Mock_Send(job->client, command, args, argCount);
+	}
+
+	switch(command) {
+	case GEARMAN_COMMAND_WORK_COMPLETE:
+		g_Counters.completed++;
+		Job_Free(job);
+		break;
+	case GEARMAN_COMMAND_WORK_FAIL:
+	case GEARMAN_COMMAND_WORK_EXCEPTION:
+		g_Counters.failed++;
+		Job_Free(job);
+		break;
+	default:
+		break;
+	}
+}
+
+static void Mock_Status(int conn, const char *body, size_t size) {
+	mock_job *job = Job_Find(body, size);
+
+	char numerator[16] = "0", denominator[16] = "0";
+	if(job != NULL) {
+		snprintf(numerator, sizeof(numerator), "%u", job->numerator);
+		snprintf(denominator, sizeof(denominator), "%u", job->denominator);
+	}
+
+	mock_arg args[5] = {
+		{body, size},
+		{job != NULL ? "1" : "0", 1},
+		{job != NULL && job->worker >= 0 ? "1" : "0", 1},
+		{numerator, strlen(numerator)},
+		{denominator, strlen(denominator)}
+	};
+	Mock_Send(conn, GEARMAN_COMMAND_STATUS_RES, args, 5);
+}
+
+static void Mock_CanDo(int conn, const char *body, size_t size, bool can) {
+	mock_conn *c = &g_Conns[conn];
+
+	// CAN_DO_TIMEOUT has the timeout after the name
+	const char *end = (const char *) memchr(body, '\0', size);
+	if(end != NULL)
+		size = end - body;
+
+	for(size_t i = 0; i < c->functionCount; i++) {
+		if(strlen(c->functions[i]) == size && memcmp(c->functions[i], body, size) == 0) {
+			if(!can) {
+				free(c->functions[i]);
+				c->functions[i] = c->functions[--c->functionCount];
+			}
+			return;
+		}
+	}
+
+	if(can) {
+		c->functions = (char **) realloc(c->functions, sizeof(char *) * (c->functionCount + 1));
+		c->functions[c->functionCount++] = Mock_Strndup(body, size);
+	}
+}
+
+static void Mock_ResetAbilities(int conn) {
+	mock_conn *c = &g_Conns[conn];
+	for(size_t i = 0; i < c->functionCount; i++)
+		free(c->functions[i]);
+	free(c->functions);
+	c->functions = NULL;
+	c->functionCount = 0;
+}
+
+static bool Mock_Handle(int conn, gearman_command_t command, const char *body, size_t size) {
+	switch(command) {
+	case GEARMAN_COMMAND_SUBMIT_JOB:
+		Mock_Submit(conn, body, size, Priority_Normal, false);
+		break;
+	case GEARMAN_COMMAND_SUBMIT_JOB_HIGH:
+		Mock_Submit(conn, body, size, Priority_High, false);
+		break;
+	case GEARMAN_COMMAND_SUBMIT_JOB_LOW:
+		Mock_Submit(conn, body, size, Priority_Low, false);
+		break;
+	case GEARMAN_COMMAND_SUBMIT_JOB_BG:
+		Mock_Submit(conn, body, size, Priority_Normal, true);
+		break;
+	case GEARMAN_COMMAND_SUBMIT_JOB_HIGH_BG:
+		Mock_Submit(conn, body, size, Priority_High, true);
+		break;
+	case GEARMAN_COMMAND_SUBMIT_JOB_LOW_BG:
+		Mock_Submit(conn, body, size, Priority_Low, true);
+		break;
+	case GEARMAN_COMMAND_CAN_DO:
+	case GEARMAN_COMMAND_CAN_DO_TIMEOUT:
+		Mock_CanDo(conn, body, size, true);
+		break;
+	case GEARMAN_COMMAND_CANT_DO:
+		Mock_CanDo(conn, body, size, false);
+		break;
+	case GEARMAN_COMMAND_RESET_ABILITIES:
+		Mock_ResetAbilities(conn);
+		break;
+	case GEARMAN_COMMAND_PRE_SLEEP:
+		g_Conns[conn].sleeping = true;
+		for(int i = 0; i < Priority_Count; i++) {
+			for(mock_job *job = g_Queues[i].head; job != NULL; job = job->next) {
+				if(Conn_CanDo(conn, job->function)) {
+					g_Conns[conn].sleeping = false;
+					Mock_Send0(conn, GEARMAN_COMMAND_NOOP);
+					return true;
+				}
+			}
+		}
+		break;
+	case GEARMAN_COMMAND_GRAB_JOB:
+	case GEARMAN_COMMAND_GRAB_JOB_UNIQ:
+	case GEARMAN_COMMAND_GRAB_JOB_ALL:
+		Mock_Grab(conn, command);
+		break;
+	case GEARMAN_COMMAND_WORK_DATA:
+	case GEARMAN_COMMAND_WORK_WARNING:
+	case GEARMAN_COMMAND_WORK_STATUS:
+	case GEARMAN_COMMAND_WORK_COMPLETE:
+	case GEARMAN_COMMAND_WORK_FAIL:
+	case GEARMAN_COMMAND_WORK_EXCEPTION:
+		Mock_Work(conn, command, body, size);
+		break;
+	case GEARMAN_COMMAND_GET_STATUS:
+		Mock_Status(conn, body, size);
+		break;
+	case GEARMAN_COMMAND_ECHO_REQ:
+		Mock_Send1(conn, GEARMAN_COMMAND_ECHO_RES, body, size);
+		break;
+	case GEARMAN_COMMAND_OPTION_REQ:
+		if(size == 10 && memcmp(body, "exceptions", 10) == 0) {
+			g_Conns[conn].exceptions = true;
+			Mock_Send1(conn, GEARMAN_COMMAND_OPTION_RES, body, size);
+		} else {
+			Mock_SendError(conn, "UNKNOWN_OPTION", "Unknown option");
+		}
+		break;
+	case GEARMAN_COMMAND_SET_CLIENT_ID:
+		break;
+	default:
+		if(g_Verbose)
+			fprintf(stderr, "Connection %d: unsupported command %d\n", conn, command);
+		Mock_SendError(conn, "UNKNOWN_COMMAND", "Not supported by the mock server");
+		break;
+	}
+
+	return true;
+}
+
+// Connections
+
+static void Conn_Close(int conn) {
+	mock_conn *c = &g_Conns[conn];
+
+	close(c->fd);
+	c->fd = -1;
+	Buffer_Free(&c->in);
+	Buffer_Free(&c->out);
+	Mock_ResetAbilities(conn);
+	c->sleeping = false;
+	c->exceptions = false;
+
+	// Jobs it was running go back to the front of their queue, results for it are dropped
+	for(int i = 0; i < MOCK_JOB_BUCKETS; i++) {
+		for(mock_job *job = g_Jobs[i]; job != NULL; job = job->hashNext) {
+			if(job->client == conn)
+				job->client = -1;
+			if(job->worker == conn) {
+				job->worker = -1;
+				job->next = g_Queues[Priority_High].head;
+				g_Queues[Priority_High].head = job;
+				if(g_Queues[Priority_High].tail == NULL)
+					g_Queues[Priority_High].tail = job;
+				Mock_WakeWorkers(job->function);
+			}
+		}
+	}
+
+	if(g_Verbose)
+		fprintf(stderr, "Connection %d closed\n", conn);
+}
+
+// Returns false once the connection has to go
+static bool Conn_Read(int conn) {
+	mock_conn *c = &g_Conns[conn];
+
+	for(;;) {
+		Buffer_Reserve(&c->in, 65536);
+		ssize_t got = read(c->fd, c->in.data + c->in.size, c->in.capacity - c->in.size);
+		if(got > 0) {
+			c->in.size += got;
+			continue;
+		}
+		if(got == 0)
+			return false;
+		if(errno == EAGAIN || errno == EWOULDBLOCK)
+			break;
+		if(errno != EINTR)
+			return false;
+	}
+
+	size_t offset = 0;
+	while(c->in.size - offset >= 12) {
+		const char *header = c->in.data + offset;
+		if(memcmp(header, "\0REQ", 4) != 0) {
+			if(g_Verbose)
+				fprintf(stderr, "Connection %d: not a binary request, closing\n", conn);
+			return false;
+		}
+
+		uint32_t command, size;
+		memcpy(&command, header + 4, 4);
+		memcpy(&size, header + 8, 4);
+		command = ntohl(command);
+		size = ntohl(size);
+
+		if(size > MOCK_MAX_PACKET)
+			return false;
+		if(c->in.size - offset < 12 + size)
+			break;
+
+		Mock_Handle(conn, (gearman_command_t) command, header + 12, size);
+		offset += 12 + size;
+	}
+
+	Buffer_Consume(&c->in, offset);
+	return true;
+}
+
+static bool Conn_Write(int conn) {
+	mock_conn *c = &g_Conns[conn];
+
+	while(c->out.size > 0) {
+		ssize_t sent = write(c->fd, c->out.data, c->out.size);
+		if(sent > 0) {
+			Buffer_Consume(&c->out, sent);
+			continue;
+		}
+		if(sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			break;
+		if(sent < 0 && errno == EINTR)
+			continue;
+		return false;
+	}
+	return true;
+}
+
+static void Mock_Accept(int listener) {
+	for(;;) {
+		int fd = accept(listener, NULL, NULL);
+		if(fd < 0)
+			return;
+
+		int conn = 0;
+		while(conn < MOCK_MAX_CONNECTIONS && g_Conns[conn].fd >= 0)
+			conn++;
+
+		if(conn == MOCK_MAX_CONNECTIONS) {
+			close(fd);
+			continue;
+		}
+
+		int one = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+		g_Conns[conn].fd = fd;
+		if(g_Verbose)
+			fprintf(stderr, "Connection %d opened\n", conn);
+	}
+}
+
+static void Mock_Stop(int sig) {
+	g_Running = false;
+}
+
+int main(int argc, char **argv) {
+	int port = GEARMAN_DEFAULT_TCP_PORT;
+
+	int opt;
+	while((opt = getopt(argc, argv, "p:esv")) != -1) {
+		switch(opt) {
+		case 'p':
+			port = atoi(optarg);
+			break;
+		case 'e':
+			g_Echo = true;
+			break;
+		case 's':
+			g_Scripted = true;
+			break;
+		case 'v':
+			g_Verbose = true;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-p port] [-e] [-s] [-v]\n", argv[0]);
+			fprintf(stderr, "  -e  Complete jobs no worker can do with their workload\n");
+			fprintf(stderr, "  -s  Answer jobs for the mock_* functions as scripted\n");
+			fprintf(stderr, "  -v  Log connections and unsupported commands\n");
+			return 1;
+		}
+	}
+
+	for(int i = 0; i < MOCK_MAX_CONNECTIONS; i++)
+		g_Conns[i].fd = -1;
+
+	int listener = socket(AF_INET, SOCK_STREAM, 0);
+	int one = 1;
+	setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if(bind(listener, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(listener, 128) != 0) {
+		perror("Unable to listen");
+		return 1;
+	}
+	fcntl(listener, F_SETFL, fcntl(listener, F_GETFL) | O_NONBLOCK);
+
+	signal(SIGINT, Mock_Stop);
+	signal(SIGTERM, Mock_Stop);
+	signal(SIGPIPE, SIG_IGN);
+
+	printf("Mock gearmand listening on 127.0.0.1:%d%s%s\n", port, g_Echo ? ", echoing jobs without a worker" : "",
+		g_Scripted ? ", answering mock_* jobs" : "");
+	fflush(stdout);
+
+	static struct pollfd fds[MOCK_MAX_CONNECTIONS + 1];
+	static int fdConns[MOCK_MAX_CONNECTIONS + 1];
+
+	while(g_Running) {
+		nfds_t count = 0;
+		fds[count].fd = listener;
+		fds[count].events = POLLIN;
+		fdConns[count++] = -1;
+
+		for(int i = 0; i < MOCK_MAX_CONNECTIONS; i++) {
+			if(g_Conns[i].fd < 0)
+				continue;
+
+			fds[count].fd = g_Conns[i].fd;
+			fds[count].events = POLLIN | (g_Conns[i].out.size > 0 ? POLLOUT : 0);
+			fdConns[count++] = i;
+		}
+
+		if(poll(fds, count, 1000) < 0) {
+			if(errno == EINTR)
+				continue;
+			perror("poll");
+			break;
+		}
+
+		for(nfds_t i = 0; i < count; i++) {
+			if(fds[i].revents == 0)
+				continue;
+
+			int conn = fdConns[i];
+			if(conn < 0) {
+				Mock_Accept(listener);
+				continue;
+			}
+
+			if(g_Conns[conn].fd < 0)
+				continue;
+
+			bool open = true;
+			if(fds[i].revents & (POLLIN | POLLHUP | POLLERR))
+				open = Conn_Read(conn);
+			if(open && (fds[i].revents & POLLOUT))
+				open = Conn_Write(conn);
+
+			if(!open)
+				Conn_Close(conn);
+		}
+
+		// Replies queued while handling other connections go out now instead of after the next poll
+		for(int i = 0; i < MOCK_MAX_CONNECTIONS; i++) {
+			if(g_Conns[i].fd >= 0 && g_Conns[i].out.size > 0 && !Conn_Write(i))
+				Conn_Close(i);
+		}
+	}
+
+	printf("Submitted %llu, completed %llu, failed %llu, echoed %llu\n", g_Counters.submitted, g_Counters.completed,
+		g_Counters.failed, g_Counters.echoed);
+	return 0;
+}
@@ -0,0 +1,19 @@
+/* Minimal stand-in for the SourceMod header of the same name, see harness.cpp */
+
+#ifndef _INCLUDE_SOURCEMOD_MODULE_INTERFACE_H_
+#define _INCLUDE_SOURCEMOD_MODULE_INTERFACE_H_
+
+#include <IShareSys.h>
+
+namespace SourceMod
+{
+	class IExtensionInterface
+	{
+	public:
+		virtual bool OnExtensionLoad(IExtension *me, IShareSys *sys, char *error, size_t maxlength, bool late) = 0;
+		virtual void OnExtensionUnload() = 0;
+		virtual void OnExtensionsAllLoaded() = 0;
+	};
+}
+
+#endif //_INCLUDE_SOURCEMOD_MODULE_INTERFACE_H_
@@ -0,0 +1,68 @@
+/* Minimal stand-in for the SourceMod header of the same name, see harness.cpp */
+
+#ifndef _INCLUDE_SOURCEMOD_HANDLESYSTEM_INTERFACE_H_
+#define _INCLUDE_SOURCEMOD_HANDLESYSTEM_INTERFACE_H_
+
+#include <IShareSys.h>
+
+#define SMINTERFACE_HANDLESYSTEM_NAME		"IHandleSys"
+#define SMINTERFACE_HANDLESYSTEM_VERSION	5
+
+#define BAD_HANDLE			0
+#define NO_HANDLE_TYPE		0
+
+namespace SourceMod
+{
+	typedef unsigned int HandleType_t;
+	typedef unsigned int Handle_t;
+
+	enum HandleError
+	{
+		HandleError_None = 0,
+		HandleError_Changed,
+		HandleError_Type,
+		HandleError_Freed,
+		HandleError_Index,
+		HandleError_Access,
+		HandleError_Limit,
+		HandleError_Identity,
+		HandleError_Owner,
+		HandleError_Version,
+		HandleError_Parameter,
+		HandleError_NoInherit
+	};
+
+	struct HandleSecurity
+	{
+		HandleSecurity() : pOwner(NULL), pIdentity(NULL)
+		{
+		}
+		HandleSecurity(IdentityToken_t *owner, IdentityToken_t *identity) : pOwner(owner), pIdentity(identity)
+		{
+		}
+		IdentityToken_t *pOwner;
+		IdentityToken_t *pIdentity;
+	};
+
+	struct TypeAccess;
+	struct HandleAccess;
+
+	class IHandleTypeDispatch
+	{
+	public:
+		virtual void OnHandleDestroy(HandleType_t type, void *object) = 0;
+	};
+
+	class IHandleSys : public SMInterface
+	{
+	public:
+		virtual HandleType_t CreateType(const char *name, IHandleTypeDispatch *dispatch, HandleType_t parent,
+			const TypeAccess *typeAccess, const HandleAccess *hndlAccess, IdentityToken_t *ident, HandleError *err) = 0;
+		virtual bool RemoveType(HandleType_t type, IdentityToken_t *ident) = 0;
+		virtual Handle_t CreateHandle(HandleType_t type, void *object, IdentityToken_t *owner, IdentityToken_t *ident, HandleError *err) = 0;
+		virtual HandleError FreeHandle(Handle_t handle, const HandleSecurity *pSecurity) = 0;
+		virtual HandleError ReadHandle(Handle_t handle, HandleType_t type, const HandleSecurity *pSecurity, void **object) = 0;
+	};
+}
+
+#endif //_INCLUDE_SOURCEMOD_HANDLESYSTEM_INTERFACE_H_
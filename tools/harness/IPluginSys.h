@@ -0,0 +1,35 @@
+/* Minimal stand-in for the SourceMod header of the same name, see harness.cpp */
+
+#ifndef _INCLUDE_SOURCEMOD_PLUGINSYSTEM_H_
+#define _INCLUDE_SOURCEMOD_PLUGINSYSTEM_H_
+
+#include <IHandleSys.h>
+
+#define SMINTERFACE_PLUGINSYSTEM_NAME		"IPluginManager"
+#define SMINTERFACE_PLUGINSYSTEM_VERSION	4
+
+namespace SourceMod
+{
+	class IPlugin
+	{
+	public:
+		virtual SourcePawn::IPluginContext *GetBaseContext() = 0;
+	};
+
+	class IPluginsListener
+	{
+	public:
+		virtual void OnPluginUnloaded(IPlugin *plugin)
+		{
+		}
+	};
+
+	class IPluginManager : public SMInterface
+	{
+	public:
+		virtual void AddPluginsListener(IPluginsListener *listener) = 0;
+		virtual void RemovePluginsListener(IPluginsListener *listener) = 0;
+	};
+}
+
+#endif //_INCLUDE_SOURCEMOD_PLUGINSYSTEM_H_
@@ -0,0 +1,36 @@
+/* Minimal stand-in for the SourceMod header of the same name, see harness.cpp */
+
+#ifndef _INCLUDE_SOURCEMOD_MAIN_MENU_INTERFACE_H_
+#define _INCLUDE_SOURCEMOD_MAIN_MENU_INTERFACE_H_
+
+#include <IShareSys.h>
+
+#define SMINTERFACE_ROOTCONSOLE_NAME		"IRootConsole"
+#define SMINTERFACE_ROOTCONSOLE_VERSION		2
+
+namespace SourceMod
+{
+	class ICommandArgs
+	{
+	public:
+		virtual const char *Arg(int n) const = 0;
+		virtual int ArgC() const = 0;
+	};
+
+	class IRootConsoleCommand
+	{
+	public:
+		virtual void OnRootConsoleCommand(const char *cmdname, const ICommandArgs *args) = 0;
+	};
+
+	class IRootConsole : public SMInterface
+	{
+	public:
+		virtual bool AddRootConsoleCommand3(const char *cmd, const char *text, IRootConsoleCommand *pHandler) = 0;
+		virtual bool RemoveRootConsoleCommand(const char *cmd, IRootConsoleCommand *pHandler) = 0;
+		virtual void ConsolePrint(const char *fmt, ...) = 0;
+		virtual void DrawGenericOption(const char *cmd, const char *text) = 0;
+	};
+}
+
+#endif //_INCLUDE_SOURCEMOD_MAIN_MENU_INTERFACE_H_
@@ -0,0 +1,32 @@
+/* Minimal stand-in for the SourceMod header of the same name, see harness.cpp */
+
+#ifndef _INCLUDE_SOURCEMOD_SHARESYS_INTERFACE_H_
+#define _INCLUDE_SOURCEMOD_SHARESYS_INTERFACE_H_
+
+#include <sp_vm_api.h>
+
+namespace SourceMod
+{
+	class IExtension
+	{
+	public:
+		virtual IdentityToken_t *GetIdentity() = 0;
+	};
+
+	class SMInterface
+	{
+	public:
+		virtual unsigned int GetInterfaceVersion() = 0;
+		virtual const char *GetInterfaceName() = 0;
+	};
+
+	class IShareSys
+	{
+	public:
+		virtual bool RequestInterface(const char *iface, unsigned int version, IExtension *myself, SMInterface **pIface) = 0;
+		virtual void AddNatives(IExtension *myself, const sp_nativeinfo_t *natives) = 0;
+		virtual void RegisterLibrary(IExtension *myself, const char *name) = 0;
+	};
+}
+
+#endif //_INCLUDE_SOURCEMOD_SHARESYS_INTERFACE_H_
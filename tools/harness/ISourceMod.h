@@ -0,0 +1,35 @@
+/* Minimal stand-in for the SourceMod header of the same name, see harness.cpp */
+
+#ifndef _INCLUDE_SOURCEMOD_MAIN_HELPER_INTERFACE_H_
+#define _INCLUDE_SOURCEMOD_MAIN_HELPER_INTERFACE_H_
+
+#include <IHandleSys.h>
+
+#define SMINTERFACE_SOURCEMOD_NAME		"ISourceMod"
+#define SMINTERFACE_SOURCEMOD_VERSION	14
+
+namespace SourceMod
+{
+	typedef void (*GAME_FRAME_HOOK)(bool simulating);
+
+	enum PathType
+	{
+		Path_None = 0,
+		Path_Game,
+		Path_SM,
+		Path_SM_Rel
+	};
+
+	class ISourceMod : public SMInterface
+	{
+	public:
+		virtual size_t BuildPath(PathType type, char *buffer, size_t maxlength, const char *format, ...) = 0;
+		virtual void LogMessage(IExtension *pExt, const char *format, ...) = 0;
+		virtual void LogError(IExtension *pExt, const char *format, ...) = 0;
+		virtual void AddGameFrameHook(GAME_FRAME_HOOK hook) = 0;
+		virtual void RemoveGameFrameHook(GAME_FRAME_HOOK hook) = 0;
+		virtual const char *GetCoreConfigValue(const char *key) = 0;
+	};
+}
+
+#endif //_INCLUDE_SOURCEMOD_MAIN_HELPER_INTERFACE_H_
@@ -0,0 +1,72 @@
+/* Minimal stand-in for the SourceMod header of the same name, see harness.cpp */
+
+#ifndef _INCLUDE_SOURCEMOD_THREADER_H
+#define _INCLUDE_SOURCEMOD_THREADER_H
+
+#include <IShareSys.h>
+
+#define SMINTERFACE_THREADER_NAME		"IThreader"
+#define SMINTERFACE_THREADER_VERSION	3
+
+namespace SourceMod
+{
+	enum ThreadFlags
+	{
+		Thread_Default = 0,
+		Thread_AutoRelease = 1,
+		Thread_CreateSuspended = 2
+	};
+
+	enum ThreadPriority
+	{
+		ThreadPrio_Minimum = -8,
+		ThreadPrio_Low = -3,
+		ThreadPrio_Normal = 0,
+		ThreadPrio_High = 3,
+		ThreadPrio_Maximum = 8
+	};
+
+	struct ThreadParams
+	{
+		ThreadParams() : flags(Thread_Default), prio(ThreadPrio_Normal)
+		{
+		}
+		ThreadFlags flags;
+		ThreadPriority prio;
+	};
+
+	class IThreadHandle;
+
+	class IThread
+	{
+	public:
+		virtual void RunThread(IThreadHandle *pHandle) = 0;
+		virtual void OnTerminate(IThreadHandle *pHandle, bool cancel) = 0;
+	};
+
+	class IThreadHandle
+	{
+	public:
+		virtual bool WaitForThread() = 0;
+		virtual void DestroyThis() = 0;
+	};
+
+	class IMutex
+	{
+	public:
+		virtual bool TryLock() = 0;
+		virtual void Lock() = 0;
+		virtual void Unlock() = 0;
+		virtual void DestroyThis() = 0;
+	};
+
+	class IThreader : public SMInterface
+	{
+	public:
+		virtual IThreadHandle *MakeThread(IThread *pThread, const ThreadParams *params) = 0;
+		virtual IMutex *MakeMutex() = 0;
+		virtual void ThreadSleep(unsigned int ms) = 0;
+	};
+}
+
+#endif //_INCLUDE_SOURCEMOD_THREADER_H
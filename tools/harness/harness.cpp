@@ -0,0 +1,1038 @@
+/**
+ * Runs the extension without SourceMod, for benchmarking it from the command line.
+ *
+ * The headers next to this file stand in for the SourceMod SDK and declare only what
+ * the extension uses. This file implements them: a handle table, pthreads for
+ * IThreader, one fake plugin whose memory is a flat buffer, and a game frame loop.
+ * The natives are called the way a plugin would call them, with their arguments in
+ * the plugin's memory, so the copies the extension makes are part of the numbers.
+ *
+ * The benchmark is sourcepawn/scripting/gearman-bench.sp without the server: tasks
+ * are submitted concurrency at a time, every callback submits the next one, and
+ * the round trip from submitting to the callback is measured per task. Run it against
+ * tools/gearmand-mock -e (make bench does), or against a gearmand with -w.
+ *
+ * Usage: gearman-harness [-h host] [-p port] [-n tasks] [-c concurrency] [-s workload bytes]
+ *                        [-t io threads] [-r tickrate] [-T timeout seconds] [-w]
+ */
+
+#include "smsdk_ext.h"
+#include <IThreader.h>
+
+#include <libgearman-1.0/gearman.h>
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#define HARNESS_MEMORY			(4 * 1024 * 1024)
+#define HARNESS_MAX_HANDLES		65536
+#define HARNESS_MAX_TYPES		16
+#define HARNESS_MAX_PARAMS		16
+#define HARNESS_MAX_WORKLOAD	4096
+#define HARNESS_ROOT			"/tmp/gearman-harness"
+
+/* Same values as gearman.inc */
+enum {
+	GearmanResp_Data,
+	GearmanResp_Warning,
+	GearmanResp_Complete,
+	GearmanResp_Exception
+};
+
+enum {
+	GearmanPriority_Low,
+	GearmanPriority_Normal,
+	GearmanPriority_High
+};
+
+enum {
+	GearmanLatency_Queue,
+	GearmanLatency_Run,
+	GearmanLatency_Dispatch
+};
+
+static uint64_t Harness_Now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Identities, only compared by address
+
+static char g_ExtensionToken;
+static char g_PluginToken;
+
+#define EXTENSION_IDENTITY	((IdentityToken_t *) &g_ExtensionToken)
+#define PLUGIN_IDENTITY		((IdentityToken_t *) &g_PluginToken)
+
+class HarnessExtension : public IExtension {
+public:
+	IdentityToken_t *GetIdentity() {
+		return EXTENSION_IDENTITY;
+	}
+};
+
+// ISourceMod
+
+static const char *g_IOThreads = NULL;
+
+class HarnessSourceMod : public ISourceMod {
+public:
+	HarnessSourceMod() : m_FrameHook(NULL) {
+	}
+public:
+	unsigned int GetInterfaceVersion() {
+		return SMINTERFACE_SOURCEMOD_VERSION;
+	}
+	const char *GetInterfaceName() {
+		return SMINTERFACE_SOURCEMOD_NAME;
+	}
+	size_t BuildPath(PathType type, char *buffer, size_t maxlength, const char *format, ...) {
+		char path[PLATFORM_MAX_PATH];
+		va_list ap;
+		va_start(ap, format);
+		vsnprintf(path, sizeof(path), format, ap);
+		va_end(ap);
+
+		int len = snprintf(buffer, maxlength, "%s/%s", HARNESS_ROOT, path);
+		return (len < 0) ? 0 : ((size_t) len < maxlength ? (size_t) len : maxlength - 1);
+	}
+	void LogMessage(IExtension *pExt, const char *format, ...) {
+		va_list ap;
+		va_start(ap, format);
+		Log("", format, ap);
+		va_end(ap);
+	}
+	void LogError(IExtension *pExt, const char *format, ...) {
+		va_list ap;
+		va_start(ap, format);
+		Log("error: ", format, ap);
+		va_end(ap);
+	}
+	void AddGameFrameHook(GAME_FRAME_HOOK hook) {
+		m_FrameHook = hook;
+	}
+	void RemoveGameFrameHook(GAME_FRAME_HOOK hook) {
+		if(m_FrameHook == hook)
+			m_FrameHook = NULL;
+	}
+	const char *GetCoreConfigValue(const char *key) {
+		if(strcmp(key, "GearmanIOThreads") == 0)
+			return g_IOThreads;
+		return NULL;
+	}
+public:
+	void RunFrame() {
+		if(m_FrameHook != NULL)
+			m_FrameHook(true);
+	}
+private:
+	void Log(const char *prefix, const char *format, va_list ap) {
+		fprintf(stderr, "[%s] %s", SMEXT_CONF_LOGTAG, prefix);
+		vfprintf(stderr, format, ap);
+		fprintf(stderr, "\n");
+	}
+private:
+	GAME_FRAME_HOOK m_FrameHook;
+};
+
+// IHandleSys, game thread only like SourceMod's. Handles carry a serial so stale ones
+// don't read a reused slot.
+
+struct harness_handle {
+	HandleType_t type;		/* 0 for a free slot */
+	void *object;
+	IdentityToken_t *owner;
+	unsigned int serial;
+};
+
+class HarnessHandleSys : public IHandleSys {
+public:
+	HarnessHandleSys() : m_TypeCount(0), m_Used(0), m_NextSerial(1) {
+		memset(m_Types, 0, sizeof(m_Types));
+		memset(m_Handles, 0, sizeof(m_Handles));
+	}
+public:
+	unsigned int GetInterfaceVersion() {
+		return SMINTERFACE_HANDLESYSTEM_VERSION;
+	}
+	const char *GetInterfaceName() {
+		return SMINTERFACE_HANDLESYSTEM_NAME;
+	}
+	HandleType_t CreateType(const char *name, IHandleTypeDispatch *dispatch, HandleType_t parent,
+		const TypeAccess *typeAccess, const HandleAccess *hndlAccess, IdentityToken_t *ident, HandleError *err) {
+		if(m_TypeCount + 1 >= HARNESS_MAX_TYPES) {
+			if(err != NULL)
+				*err = HandleError_Limit;
+			return NO_HANDLE_TYPE;
+		}
+
+		m_Types[++m_TypeCount] = dispatch;
+		return m_TypeCount;
+	}
+	bool RemoveType(HandleType_t type, IdentityToken_t *ident) {
+		if(type == NO_HANDLE_TYPE || type > m_TypeCount || m_Types[type] == NULL)
+			return false;
+
+		// SourceMod frees what's left of the type first
+		for(unsigned int i = 1; i < HARNESS_MAX_HANDLES; i++) {
+			if(m_Handles[i].type == type)
+				Destroy(i);
+		}
+
+		m_Types[type] = NULL;
+		return true;
+	}
+	Handle_t CreateHandle(HandleType_t type, void *object, IdentityToken_t *owner, IdentityToken_t *ident, HandleError *err) {
+		if(type == NO_HANDLE_TYPE || type > m_TypeCount || m_Types[type] == NULL) {
+			if(err != NULL)
+				*err = HandleError_Type;
+			return BAD_HANDLE;
+		}
+
+		for(unsigned int i = 1; i < HARNESS_MAX_HANDLES; i++) {
+			unsigned int index = (m_Used + i) % HARNESS_MAX_HANDLES;
+			if(index == 0 || m_Handles[index].type != NO_HANDLE_TYPE)
+				continue;
+
+			harness_handle &handle = m_Handles[index];
+			handle.type = type;
+			handle.object = object;
+			handle.owner = owner;
+			handle.serial = m_NextSerial;
+			m_NextSerial = (m_NextSerial % 0x7FFF) + 1;
+			m_Used = index;
+			return (handle.serial << 16) | index;
+		}
+
+		if(err != NULL)
+			*err = HandleError_Limit;
+		return BAD_HANDLE;
+	}
+	HandleError FreeHandle(Handle_t handle, const HandleSecurity *pSecurity) {
+		harness_handle *entry;
+		HandleError err = Find(handle, &entry);
+		if(err != HandleError_None)
+			return err;
+
+		Destroy(handle & 0xFFFF);
+		return HandleError_None;
+	}
+	HandleError ReadHandle(Handle_t handle, HandleType_t type, const HandleSecurity *pSecurity, void **object) {
+		harness_handle *entry;
+		HandleError err = Find(handle, &entry);
+		if(err != HandleError_None)
+			return err;
+
+		if(entry->type != type)
+			return HandleError_Type;
+
+		*object = entry->object;
+		return HandleError_None;
+	}
+public:
+	// What SourceMod does with a plugin's handles once it unloaded
+	void FreeOwned(IdentityToken_t *owner) {
+		for(unsigned int i = 1; i < HARNESS_MAX_HANDLES; i++) {
+			if(m_Handles[i].type != NO_HANDLE_TYPE && m_Handles[i].owner == owner)
+				Destroy(i);
+		}
+	}
+private:
+	HandleError Find(Handle_t handle, harness_handle **entry) {
+		unsigned int index = handle & 0xFFFF;
+		if(handle == BAD_HANDLE || index == 0)
+			return HandleError_Index;
+
+		*entry = &m_Handles[index];
+		if((*entry)->type == NO_HANDLE_TYPE)
+			return HandleError_Freed;
+		if((*entry)->serial != (handle >> 16))
+			return HandleError_Changed;
+
+		return HandleError_None;
+	}
+	void Destroy(unsigned int index) {
+		// Freed before the dispatch runs, it may free other handles
+		harness_handle handle = m_Handles[index];
+		m_Handles[index].type = NO_HANDLE_TYPE;
+		m_Handles[index].object = NULL;
+
+		IHandleTypeDispatch *dispatch = m_Types[handle.type];
+		if(dispatch != NULL)
+			dispatch->OnHandleDestroy(handle.type, handle.object);
+	}
+private:
+	IHandleTypeDispatch *m_Types[HARNESS_MAX_TYPES];
+	unsigned int m_TypeCount;
+	harness_handle m_Handles[HARNESS_MAX_HANDLES];
+	unsigned int m_Used;
+	unsigned int m_NextSerial;
+};
+
+// IThreader
+
+class HarnessMutex : public IMutex {
+public:
+	HarnessMutex() {
+		// Recursive, like SourceMod's on POSIX
+		pthread_mutexattr_t attr;
+		pthread_mutexattr_init(&attr);
+		pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+		pthread_mutex_init(&m_Mutex, &attr);
+		pthread_mutexattr_destroy(&attr);
+	}
+public:
+	bool TryLock() {
+		return (pthread_mutex_trylock(&m_Mutex) == 0);
+	}
+	void Lock() {
+		pthread_mutex_lock(&m_Mutex);
+	}
+	void Unlock() {
+		pthread_mutex_unlock(&m_Mutex);
+	}
+	void DestroyThis() {
+		pthread_mutex_destroy(&m_Mutex);
+		delete this;
+	}
+private:
+	pthread_mutex_t m_Mutex;
+};
+
+class HarnessThread : public IThreadHandle {
+public:
+	HarnessThread(IThread *pThread) : m_pThread(pThread), m_Joined(false) {
+	}
+public:
+	bool Start() {
+		return (pthread_create(&m_Thread, NULL, Run, this) == 0);
+	}
+	bool WaitForThread() {
+		if(m_Joined)
+			return false;
+
+		pthread_join(m_Thread, NULL);
+		m_Joined = true;
+		return true;
+	}
+	void DestroyThis() {
+		if(!m_Joined)
+			pthread_detach(m_Thread);
+		delete this;
+	}
+private:
+	static void *Run(void *arg) {
+		HarnessThread *thread = (HarnessThread *) arg;
+		thread->m_pThread->RunThread(thread);
+		thread->m_pThread->OnTerminate(thread, false);
+		return NULL;
+	}
+private:
+	IThread *m_pThread;
+	pthread_t m_Thread;
+	bool m_Joined;
+};
+
+class HarnessThreader : public IThreader {
+public:
+	unsigned int GetInterfaceVersion() {
+		return SMINTERFACE_THREADER_VERSION;
+	}
+	const char *GetInterfaceName() {
+		return SMINTERFACE_THREADER_NAME;
+	}
+	IThreadHandle *MakeThread(IThread *pThread, const ThreadParams *params) {
+		HarnessThread *thread = new HarnessThread(pThread);
+		if(!thread->Start()) {
+			delete thread;
+			return NULL;
+		}
+		return thread;
+	}
+	IMutex *MakeMutex() {
+		return new HarnessMutex();
+	}
+	void ThreadSleep(unsigned int ms) {
+		usleep(ms * 1000);
+	}
+};
+
+// The plugin. Its memory is one flat buffer, locals are offsets into it. Arguments
+// are put on a stack at the top that unwinds after every call.
+
+class HarnessContext;
+
+typedef cell_t (*HarnessCallback)(HarnessContext *ctx, const cell_t *params);
+
+class HarnessFunction : public IPluginFunction {
+public:
+	HarnessFunction() : m_pContext(NULL), m_Callback(NULL), m_Count(0) {
+	}
+	void Init(HarnessContext *ctx, HarnessCallback callback) {
+		m_pContext = ctx;
+		m_Callback = callback;
+	}
+public:
+	int PushCell(cell_t cell);
+	int PushString(const char *string);
+	int PushStringEx(char *buffer, size_t length, int sz_flags, int cp_flags);
+	int Execute(cell_t *result);
+private:
+	void Begin();
+	int Push(cell_t cell);
+private:
+	HarnessContext *m_pContext;
+	HarnessCallback m_Callback;
+	cell_t m_Params[HARNESS_MAX_PARAMS + 1];
+	unsigned int m_Count;
+	size_t m_Mark;
+};
+
+class HarnessContext : public IPluginContext {
+public:
+	HarnessContext() : m_Top(4), m_Errors(0), m_FunctionCount(0) {
+		m_Memory = (char *) calloc(1, HARNESS_MEMORY);
+	}
+	~HarnessContext() {
+		free(m_Memory);
+	}
+public:
+	IPluginFunction *GetFunctionById(funcid_t func_id) {
+		if(func_id == 0 || func_id > m_FunctionCount)
+			return NULL;
+		return &m_Functions[func_id - 1];
+	}
+	int ThrowNativeError(const char *msg, ...) {
+		va_list ap;
+		va_start(ap, msg);
+		fprintf(stderr, "Native error: ");
+		vfprintf(stderr, msg, ap);
+		fprintf(stderr, "\n");
+		va_end(ap);
+
+		m_Errors++;
+		return 0;
+	}
+	int LocalToString(cell_t local_addr, char **addr) {
+		if(local_addr < 0 || (size_t) local_addr >= HARNESS_MEMORY)
+			return SP_ERROR_INVALID_ADDRESS;
+		*addr = m_Memory + local_addr;
+		return SP_ERROR_NONE;
+	}
+	int LocalToPhysAddr(cell_t local_addr, cell_t **phys_addr) {
+		if(local_addr < 0 || (size_t) local_addr >= HARNESS_MEMORY)
+			return SP_ERROR_INVALID_ADDRESS;
+		*phys_addr = (cell_t *) (m_Memory + local_addr);
+		return SP_ERROR_NONE;
+	}
+	int StringToLocal(cell_t local_addr, size_t bytes, const char *source) {
+		return StringToLocalUTF8(local_addr, bytes, source, NULL);
+	}
+	int StringToLocalUTF8(cell_t local_addr, size_t maxbytes, const char *source, size_t *wrtnbytes) {
+		if(local_addr < 0 || maxbytes == 0 || (size_t) local_addr + maxbytes > HARNESS_MEMORY)
+			return SP_ERROR_INVALID_ADDRESS;
+
+		size_t len = strlen(source);
+		if(len >= maxbytes)
+			len = maxbytes - 1;
+
+		memcpy(m_Memory + local_addr, source, len);
+		m_Memory[local_addr + len] = '\0';
+		if(wrtnbytes != NULL)
+			*wrtnbytes = len;
+		return SP_ERROR_NONE;
+	}
+	IdentityToken_t *GetIdentity() {
+		return PLUGIN_IDENTITY;
+	}
+public:
+	funcid_t AddFunction(HarnessCallback callback) {
+		m_Functions[m_FunctionCount].Init(this, callback);
+		return ++m_FunctionCount;
+	}
+	cell_t Copy(const void *data, size_t size) {
+		size_t aligned = (size + sizeof(cell_t) - 1) & ~(sizeof(cell_t) - 1);
+		if(m_Top + aligned > HARNESS_MEMORY) {
+			fprintf(stderr, "Plugin memory exhausted\n");
+			abort();
+		}
+
+		cell_t local = (cell_t) m_Top;
+		memcpy(m_Memory + m_Top, data, size);
+		m_Top += aligned;
+		return local;
+	}
+	cell_t CopyString(const char *str) {
+		return Copy(str, strlen(str) + 1);
+	}
+	char *GetString(cell_t local) {
+		return m_Memory + local;
+	}
+	size_t Mark() const {
+		return m_Top;
+	}
+	void Unwind(size_t mark) {
+		m_Top = mark;
+	}
+	unsigned int GetErrors() const {
+		return m_Errors;
+	}
+private:
+	char *m_Memory;
+	size_t m_Top;
+	unsigned int m_Errors;
+	HarnessFunction m_Functions[8];
+	unsigned int m_FunctionCount;
+};
+
+// The arguments' memory is given back once the call returned
+void HarnessFunction::Begin() {
+	if(m_Count == 0)
+		m_Mark = m_pContext->Mark();
+}
+
+int HarnessFunction::Push(cell_t cell) {
+	if(m_Count >= HARNESS_MAX_PARAMS)
+		return SP_ERROR_NATIVE;
+
+	m_Params[++m_Count] = cell;
+	return SP_ERROR_NONE;
+}
+
+int HarnessFunction::PushCell(cell_t cell) {
+	Begin();
+	return Push(cell);
+}
+
+int HarnessFunction::PushString(const char *string) {
+	Begin();
+	return Push(m_pContext->CopyString(string));
+}
+
+// SourceMod copies the buffer into the plugin too
+int HarnessFunction::PushStringEx(char *buffer, size_t length, int sz_flags, int cp_flags) {
+	Begin();
+	return Push(m_pContext->Copy(buffer, length));
+}
+
+int HarnessFunction::Execute(cell_t *result) {
+	// The callback may call natives that call back into this function
+	cell_t params[HARNESS_MAX_PARAMS + 1];
+	memcpy(params, m_Params, sizeof(params));
+	params[0] = m_Count;
+	size_t mark = m_Mark;
+	m_Count = 0;
+
+	cell_t ret = m_Callback(m_pContext, params);
+	if(result != NULL)
+		*result = ret;
+
+	m_pContext->Unwind(mark);
+	return SP_ERROR_NONE;
+}
+
+class HarnessPlugin : public IPlugin {
+public:
+	IPluginContext *GetBaseContext() {
+		return &m_Context;
+	}
+	HarnessContext *GetContext() {
+		return &m_Context;
+	}
+private:
+	HarnessContext m_Context;
+};
+
+// IPluginManager
+
+class HarnessPluginManager : public IPluginManager {
+public:
+	HarnessPluginManager() : m_pListener(NULL) {
+	}
+public:
+	unsigned int GetInterfaceVersion() {
+		return SMINTERFACE_PLUGINSYSTEM_VERSION;
+	}
+	const char *GetInterfaceName() {
+		return SMINTERFACE_PLUGINSYSTEM_NAME;
+	}
+	void AddPluginsListener(IPluginsListener *listener) {
+		m_pListener = listener;
+	}
+	void RemovePluginsListener(IPluginsListener *listener) {
+		if(m_pListener == listener)
+			m_pListener = NULL;
+	}
+public:
+	void Unload(HarnessPlugin *plugin);
+private:
+	IPluginsListener *m_pListener;
+};
+
+// IRootConsole
+
+class HarnessArgs : public ICommandArgs {
+public:
+	HarnessArgs(int argc, const char **argv) : m_Argc(argc), m_Argv(argv) {
+	}
+public:
+	const char *Arg(int n) const {
+		return (n >= 0 && n < m_Argc) ? m_Argv[n] : "";
+	}
+	int ArgC() const {
+		return m_Argc;
+	}
+private:
+	int m_Argc;
+	const char **m_Argv;
+};
+
+class HarnessRootConsole : public IRootConsole {
+public:
+	HarnessRootConsole() : m_pHandler(NULL) {
+	}
+public:
+	unsigned int GetInterfaceVersion() {
+		return SMINTERFACE_ROOTCONSOLE_VERSION;
+	}
+	const char *GetInterfaceName() {
+		return SMINTERFACE_ROOTCONSOLE_NAME;
+	}
+	bool AddRootConsoleCommand3(const char *cmd, const char *text, IRootConsoleCommand *pHandler) {
+		m_pHandler = pHandler;
+		return true;
+	}
+	bool RemoveRootConsoleCommand(const char *cmd, IRootConsoleCommand *pHandler) {
+		if(m_pHandler == pHandler)
+			m_pHandler = NULL;
+		return true;
+	}
+	void ConsolePrint(const char *fmt, ...) {
+		va_list ap;
+		va_start(ap, fmt);
+		vprintf(fmt, ap);
+		va_end(ap);
+		printf("\n");
+	}
+	void DrawGenericOption(const char *cmd, const char *text) {
+		printf("    %-20s - %s\n", cmd, text);
+	}
+public:
+	// "sm gearman <command>"
+	void Run(const char *command) {
+		if(m_pHandler == NULL)
+			return;
+
+		const char *argv[] = {"sm", "gearman", command};
+		HarnessArgs args(3, argv);
+		m_pHandler->OnRootConsoleCommand("gearman", &args);
+	}
+private:
+	IRootConsoleCommand *m_pHandler;
+};
+
+// IShareSys
+
+static HarnessSourceMod g_SourceMod;
+static HarnessHandleSys g_HandleSys;
+static HarnessThreader g_Threader;
+static HarnessPluginManager g_PluginManager;
+static HarnessRootConsole g_RootConsole;
+static HarnessExtension g_Extension;
+
+class HarnessShareSys : public IShareSys {
+public:
+	HarnessShareSys() : m_Natives(NULL) {
+	}
+public:
+	bool RequestInterface(const char *iface, unsigned int version, IExtension *myself, SMInterface **pIface) {
+		SMInterface *interfaces[] = {&g_SourceMod, &g_HandleSys, &g_Threader, &g_PluginManager, &g_RootConsole};
+		for(size_t i = 0; i < sizeof(interfaces) / sizeof(interfaces[0]); i++) {
+			if(strcmp(interfaces[i]->GetInterfaceName(), iface) == 0) {
+				*pIface = interfaces[i];
+				return true;
+			}
+		}
+		return false;
+	}
+	void AddNatives(IExtension *myself, const sp_nativeinfo_t *natives) {
+		m_Natives = natives;
+	}
+	void RegisterLibrary(IExtension *myself, const char *name) {
+	}
+public:
+	SPVM_NATIVE_FUNC FindNative(const char *name) {
+		for(const sp_nativeinfo_t *native = m_Natives; native != NULL && native->name != NULL; native++) {
+			if(strcmp(native->name, name) == 0)
+				return native->func;
+		}
+
+		fprintf(stderr, "The extension has no native %s\n", name);
+		exit(1);
+	}
+private:
+	const sp_nativeinfo_t *m_Natives;
+};
+
+static HarnessShareSys g_ShareSys;
+
+void HarnessPluginManager::Unload(HarnessPlugin *plugin) {
+	if(m_pListener != NULL)
+		m_pListener->OnPluginUnloaded(plugin);
+	g_HandleSys.FreeOwned(plugin->GetContext()->GetIdentity());
+}
+
+// Calling natives like a plugin. Strings go on the plugin's argument stack.
+
+class HarnessCall {
+public:
+	HarnessCall(HarnessContext *ctx, SPVM_NATIVE_FUNC native) : m_pContext(ctx), m_Native(native), m_Count(0) {
+		m_Mark = ctx->Mark();
+	}
+	~HarnessCall() {
+		m_pContext->Unwind(m_Mark);
+	}
+public:
+	HarnessCall &Cell(cell_t cell) {
+		m_Params[++m_Count] = cell;
+		return *this;
+	}
+	HarnessCall &Float(float value) {
+		return Cell(sp_ftoc(value));
+	}
+	HarnessCall &String(const char *str) {
+		return Cell(m_pContext->CopyString(str));
+	}
+	HarnessCall &Local(cell_t local) {
+		return Cell(local);
+	}
+	cell_t Invoke() {
+		m_Params[0] = m_Count;
+		return m_Native(m_pContext, m_Params);
+	}
+private:
+	HarnessContext *m_pContext;
+	SPVM_NATIVE_FUNC m_Native;
+	cell_t m_Params[HARNESS_MAX_PARAMS + 1];
+	unsigned int m_Count;
+	size_t m_Mark;
+};
+
+// The benchmark, see gearman-bench.sp
+
+static struct {
+	SPVM_NATIVE_FUNC ClientCreate;
+	SPVM_NATIVE_FUNC ClientAddServer;
+	SPVM_NATIVE_FUNC ClientAddTaskEx;
+	SPVM_NATIVE_FUNC TaskSetFailCallback;
+	SPVM_NATIVE_FUNC WorkerCreate;
+	SPVM_NATIVE_FUNC WorkerAddServer;
+	SPVM_NATIVE_FUNC WorkerAddFunction;
+	SPVM_NATIVE_FUNC JobSendBinary;
+	SPVM_NATIVE_FUNC StatsReset;
+	SPVM_NATIVE_FUNC StatsGetLatency;
+	SPVM_NATIVE_FUNC GetBacklog;
+	SPVM_NATIVE_FUNC GetFrameTime;
+} g_Natives;
+
+static HarnessPlugin g_Plugin;
+static HarnessContext *g_pContext = g_Plugin.GetContext();
+
+static const char *g_Host = "127.0.0.1";
+static int g_Port = 4730;
+static const char *g_Function = "gearman_bench";
+static bool g_Worker = false;
+
+static cell_t g_Client = BAD_HANDLE;
+static funcid_t g_TaskComplete;
+static funcid_t g_TaskFail;
+static funcid_t g_WorkerEcho;
+
+static bool g_Running;
+static int g_Total = 10000;
+static int g_Submitted;
+static int g_Completed;
+static int g_Failed;
+static int g_Jobs;
+static uint64_t g_DispatchTime;
+static char g_Workload[HARNESS_MAX_WORKLOAD];
+static int g_WorkloadSize = 64;
+static cell_t g_WorkloadLocal;
+
+static uint64_t g_SubmitTime[HARNESS_MAX_HANDLES];	/* By handle slot */
+static uint64_t *g_RoundTrips;
+static int g_RoundTripCount;
+
+static void Bench_Next();
+
+static void Bench_Finished(cell_t task) {
+	if(task != BAD_HANDLE && g_SubmitTime[task & 0xFFFF] != 0) {
+		g_RoundTrips[g_RoundTripCount++] = Harness_Now() - g_SubmitTime[task & 0xFFFF];
+		g_SubmitTime[task & 0xFFFF] = 0;
+	}
+}
+
+// public Task_Complete(Handle:task, const String:data[], const dataSize)
+static cell_t Bench_TaskComplete(HarnessContext *ctx, const cell_t *params) {
+	Bench_Finished(params[1]);
+	g_Completed++;
+	Bench_Next();
+	return 0;
+}
+
+// public Task_Fail(Handle:task, const String:error[])
+static cell_t Bench_TaskFail(HarnessContext *ctx, const cell_t *params) {
+	Bench_Finished(params[1]);
+	if(g_Failed++ == 0)
+		printf("[Bench] First failure: %s\n", ctx->GetString(params[2]));
+	Bench_Next();
+	return 0;
+}
+
+// public GearmanReturn:Worker_Echo(Handle:job, const String:data[], const dataSize)
+static cell_t Bench_WorkerEcho(HarnessContext *ctx, const cell_t *params) {
+	g_Jobs++;
+	HarnessCall(ctx, g_Natives.JobSendBinary).Cell(params[1]).Local(params[2]).Cell(params[3]).Cell(GearmanResp_Complete).Invoke();
+	return GEARMAN_SUCCESS;
+}
+
+static void Bench_Submit() {
+	g_Submitted++;
+
+	cell_t task = HarnessCall(g_pContext, g_Natives.ClientAddTaskEx).Cell(g_Client).String(g_Function).Local(g_WorkloadLocal)
+		.Cell(g_WorkloadSize).Cell(g_TaskComplete).Cell(GearmanPriority_Normal).String("").Invoke();
+	if(task == BAD_HANDLE) {
+		g_Failed++;
+		if(g_Failed == 1)
+			printf("[Bench] First failure: Unable to add the task\n");
+		Bench_Next();
+		return;
+	}
+
+	g_SubmitTime[task & 0xFFFF] = Harness_Now();
+	HarnessCall(g_pContext, g_Natives.TaskSetFailCallback).Cell(task).Cell(g_TaskFail).Invoke();
+}
+
+static void Bench_Next() {
+	if(!g_Running)
+		return;
+
+	if(g_Submitted < g_Total) {
+		Bench_Submit();
+		return;
+	}
+
+	if(g_Completed + g_Failed >= g_Total)
+		g_Running = false;
+}
+
+static void Bench_Setup() {
+	g_Natives.ClientCreate = g_ShareSys.FindNative("GearmanClient_Create");
+	g_Natives.ClientAddServer = g_ShareSys.FindNative("GearmanClient_AddServer");
+	g_Natives.ClientAddTaskEx = g_ShareSys.FindNative("GearmanClient_AddTaskEx");
+	g_Natives.TaskSetFailCallback = g_ShareSys.FindNative("GearmanTask_SetFailCallback");
+	g_Natives.WorkerCreate = g_ShareSys.FindNative("GearmanWorker_Create");
+	g_Natives.WorkerAddServer = g_ShareSys.FindNative("GearmanWorker_AddServer");
+	g_Natives.WorkerAddFunction = g_ShareSys.FindNative("GearmanWorker_AddFunction");
+	g_Natives.JobSendBinary = g_ShareSys.FindNative("GearmanJob_SendBinary");
+	g_Natives.StatsReset = g_ShareSys.FindNative("GearmanStats_Reset");
+	g_Natives.StatsGetLatency = g_ShareSys.FindNative("GearmanStats_GetLatency");
+	g_Natives.GetBacklog = g_ShareSys.FindNative("Gearman_GetBacklog");
+	g_Natives.GetFrameTime = g_ShareSys.FindNative("Gearman_GetFrameTime");
+
+	g_TaskComplete = g_pContext->AddFunction(Bench_TaskComplete);
+	g_TaskFail = g_pContext->AddFunction(Bench_TaskFail);
+	g_WorkerEcho = g_pContext->AddFunction(Bench_WorkerEcho);
+
+	g_Client = HarnessCall(g_pContext, g_Natives.ClientCreate).Invoke();
+	HarnessCall(g_pContext, g_Natives.ClientAddServer).Cell(g_Client).String(g_Host).Cell(g_Port).Invoke();
+
+	if(g_Worker) {
+		cell_t worker = HarnessCall(g_pContext, g_Natives.WorkerCreate).Invoke();
+		HarnessCall(g_pContext, g_Natives.WorkerAddServer).Cell(worker).String(g_Host).Cell(g_Port).Invoke();
+		HarnessCall(g_pContext, g_Natives.WorkerAddFunction).Cell(worker).String(g_Function).Cell(g_WorkerEcho).Invoke();
+	}
+
+	// Stays below the argument stack for the whole run, like a global array
+	for(int i = 0; i < g_WorkloadSize; i++)
+		g_Workload[i] = 'a' + (i % 26);
+	g_Workload[g_WorkloadSize] = '\0';
+	g_WorkloadLocal = g_pContext->Copy(g_Workload, g_WorkloadSize + 1);
+}
+
+static int Bench_CompareLatency(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t *) a;
+	uint64_t y = *(const uint64_t *) b;
+	return (x < y) ? -1 : ((x > y) ? 1 : 0);
+}
+
+static double Bench_Percentile(double percentile) {
+	if(g_RoundTripCount == 0)
+		return 0.0;
+
+	int index = (int) (percentile / 100.0 * g_RoundTripCount);
+	if(index >= g_RoundTripCount)
+		index = g_RoundTripCount - 1;
+	return g_RoundTrips[index] / 1000.0;
+}
+
+static void Bench_PrintLatency(const char *name, int stage) {
+	double p50 = HarnessCall(g_pContext, g_Natives.StatsGetLatency).String(g_Function).Cell(stage).Float(50.0f).Invoke() / 1000.0;
+	double p99 = HarnessCall(g_pContext, g_Natives.StatsGetLatency).String(g_Function).Cell(stage).Float(99.0f).Invoke() / 1000.0;
+	double p999 = HarnessCall(g_pContext, g_Natives.StatsGetLatency).String(g_Function).Cell(stage).Float(99.9f).Invoke() / 1000.0;
+	printf("[Bench]   %-34s p50 %7.3f ms   p99 %7.3f ms   p99.9 %7.3f ms\n", name, p50, p99, p999);
+}
+
+static void Bench_Report(double elapsed) {
+	printf("[Bench] %d completed, %d failed in %.3f seconds: %.0f tasks/sec\n", g_Completed, g_Failed, elapsed,
+		elapsed > 0.0 ? g_Completed / elapsed : 0.0);
+
+	qsort(g_RoundTrips, g_RoundTripCount, sizeof(uint64_t), Bench_CompareLatency);
+	printf("[Bench]   %-34s p50 %7.3f ms   p99 %7.3f ms   p99.9 %7.3f ms\n", "Round trip (submit -> callback)",
+		Bench_Percentile(50.0), Bench_Percentile(99.0), Bench_Percentile(99.9));
+
+	Bench_PrintLatency("Queue (submitted -> created)", GearmanLatency_Queue);
+	Bench_PrintLatency("Run (created -> completed)", GearmanLatency_Run);
+	Bench_PrintLatency("Dispatch (completed -> callback)", GearmanLatency_Dispatch);
+
+	printf("[Bench] Dispatch backlog %d, peak frame %d us\n", HarnessCall(g_pContext, g_Natives.GetBacklog).Invoke(),
+		HarnessCall(g_pContext, g_Natives.GetFrameTime).Cell(1).Invoke());
+
+	int callbacks = g_Completed + g_Failed + g_Jobs;
+	printf("[Bench] Dispatch cost %.2f us per callback over %d callbacks (%d worker jobs)\n",
+		callbacks > 0 ? (double) g_DispatchTime / callbacks : 0.0, callbacks, g_Jobs);
+}
+
+static void Harness_Usage(const char *name) {
+	fprintf(stderr, "Usage: %s [-h host] [-p port] [-n tasks] [-c concurrency] [-s workload bytes]\n", name);
+	fprintf(stderr, "          [-t io threads] [-r tickrate] [-T timeout seconds] [-w]\n");
+	fprintf(stderr, "  -r  Game frames per second, 0 (the default) runs them back to back\n");
+	fprintf(stderr, "  -w  Also register a worker that echoes the workload back\n");
+}
+
+int main(int argc, char **argv) {
+	int concurrency = 100;
+	int tickrate = 0;
+	int timeout = 60;
+
+	int opt;
+	while((opt = getopt(argc, argv, "h:p:n:c:s:t:r:T:w")) != -1) {
+		switch(opt) {
+		case 'h':
+			g_Host = optarg;
+			break;
+		case 'p':
+			g_Port = atoi(optarg);
+			break;
+		case 'n':
+			g_Total = atoi(optarg);
+			break;
+		case 'c':
+			concurrency = atoi(optarg);
+			break;
+		case 's':
+			g_WorkloadSize = atoi(optarg);
+			break;
+		case 't':
+			g_IOThreads = optarg;
+			break;
+		case 'r':
+			tickrate = atoi(optarg);
+			break;
+		case 'T':
+			timeout = atoi(optarg);
+			break;
+		case 'w':
+			g_Worker = true;
+			break;
+		default:
+			Harness_Usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if(g_Total < 1 || concurrency < 1 || concurrency >= HARNESS_MAX_HANDLES / 2 || g_WorkloadSize < 0
+		|| g_WorkloadSize >= HARNESS_MAX_WORKLOAD || tickrate < 0 || timeout < 1) {
+		Harness_Usage(argv[0]);
+		return 1;
+	}
+
+	mkdir(HARNESS_ROOT, 0755);
+	mkdir(HARNESS_ROOT "/data", 0755);
+
+	char error[256];
+	if(!g_pExtensionIface->OnExtensionLoad(&g_Extension, &g_ShareSys, error, sizeof(error), false)) {
+		fprintf(stderr, "Unable to load the extension: %s\n", error);
+		return 1;
+	}
+	g_pExtensionIface->OnExtensionsAllLoaded();
+
+	Bench_Setup();
+	g_RoundTrips = (uint64_t *) malloc(sizeof(uint64_t) * g_Total);
+
+	printf("[Bench] %d tasks of %d bytes for \"%s\" on %s:%d, %d at a time, %s\n", g_Total, g_WorkloadSize, g_Function,
+		g_Host, g_Port, concurrency, tickrate > 0 ? "frames at the tickrate" : "frames back to back");
+	if(tickrate > 0)
+		printf("[Bench] Tickrate %d\n", tickrate);
+
+	HarnessCall(g_pContext, g_Natives.StatsReset).Invoke();
+	g_Running = true;
+
+	const uint64_t start = Harness_Now();
+	const uint64_t deadline = start + (uint64_t) timeout * 1000000;
+	const uint64_t interval = (tickrate > 0) ? 1000000 / tickrate : 0;
+	uint64_t nextFrame = start;
+
+	for(int i = 0; i < concurrency && g_Submitted < g_Total; i++)
+		Bench_Submit();
+
+	while(g_Running) {
+		g_SourceMod.RunFrame();
+		if(g_Running)
+			g_DispatchTime += HarnessCall(g_pContext, g_Natives.GetFrameTime).Cell(0).Invoke();
+
+		uint64_t now = Harness_Now();
+		if(now >= deadline) {
+			printf("[Bench] Timed out after %d seconds\n", timeout);
+			break;
+		}
+
+		// The I/O threads need the CPU more than an idle frame does
+		if(interval == 0) {
+			sched_yield();
+			continue;
+		}
+
+		nextFrame += interval;
+		if(nextFrame > now)
+			usleep((useconds_t) (nextFrame - now));
+		else
+			nextFrame = now;
+	}
+
+	const double elapsed = (Harness_Now() - start) / 1000000.0;
+	const bool finished = !g_Running;
+	g_Running = false;
+
+	Bench_Report(elapsed);
+	printf("\n");
+	g_RootConsole.Run("stats");
+
+	if(g_pContext->GetErrors() > 0)
+		printf("[Bench] %u native errors\n", g_pContext->GetErrors());
+
+	g_PluginManager.Unload(&g_Plugin);
+	g_pExtensionIface->OnExtensionUnload();
+	free(g_RoundTrips);
+
+	return (finished && g_Failed == 0 && g_pContext->GetErrors() == 0) ? 0 : 1;
+}
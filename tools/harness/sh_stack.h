@@ -0,0 +1,43 @@
+/* Minimal stand-in for the SourceHook header of the same name, see harness.cpp */
+
+#ifndef __SH_STACK_H__
+#define __SH_STACK_H__
+
+#include <sh_vector.h>
+
+namespace SourceHook
+{
+	template <class T>
+	class CStack
+	{
+	public:
+		void push(const T &val)
+		{
+			m_Elements.push_back(val);
+		}
+
+		void pop()
+		{
+			m_Elements.pop_back();
+		}
+
+		T &front()
+		{
+			return m_Elements.back();
+		}
+
+		bool empty() const
+		{
+			return m_Elements.empty();
+		}
+
+		size_t size() const
+		{
+			return m_Elements.size();
+		}
+	private:
+		CVector<T> m_Elements;
+	};
+}
+
+#endif //__SH_STACK_H__
@@ -0,0 +1,141 @@
+/* Minimal stand-in for the SourceHook header of the same name, see harness.cpp */
+
+#ifndef __SHVECTOR_H__
+#define __SHVECTOR_H__
+
+#include <stdlib.h>
+#include <new>
+
+namespace SourceHook
+{
+	template <class T>
+	class CVector
+	{
+	public:
+		typedef T *iterator;
+
+		CVector() : m_Data(NULL), m_Size(0), m_Capacity(0)
+		{
+		}
+
+		CVector(const CVector &other) : m_Data(NULL), m_Size(0), m_Capacity(0)
+		{
+			*this = other;
+		}
+
+		~CVector()
+		{
+			clear();
+			free(m_Data);
+		}
+
+		CVector & operator =(const CVector &other)
+		{
+			if (this != &other)
+			{
+				clear();
+				for (size_t i = 0; i < other.m_Size; i++)
+				{
+					push_back(other.m_Data[i]);
+				}
+			}
+			return *this;
+		}
+
+		bool push_back(const T &elem)
+		{
+			if (m_Size == m_Capacity)
+			{
+				size_t capacity = m_Capacity ? m_Capacity * 2 : 8;
+				T *data = (T *)malloc(sizeof(T) * capacity);
+				if (data == NULL)
+				{
+					return false;
+				}
+				/* elem may live in the old storage */
+				new (&data[m_Size]) T(elem);
+				for (size_t i = 0; i < m_Size; i++)
+				{
+					new (&data[i]) T(m_Data[i]);
+					m_Data[i].~T();
+				}
+				free(m_Data);
+				m_Data = data;
+				m_Capacity = capacity;
+				m_Size++;
+				return true;
+			}
+			new (&m_Data[m_Size++]) T(elem);
+			return true;
+		}
+
+		void pop_back()
+		{
+			m_Data[--m_Size].~T();
+		}
+
+		iterator erase(iterator where)
+		{
+			for (iterator it = where; it + 1 < end(); ++it)
+			{
+				*it = *(it + 1);
+			}
+			pop_back();
+			return where;
+		}
+
+		void clear()
+		{
+			while (m_Size > 0)
+			{
+				pop_back();
+			}
+		}
+
+		size_t size() const
+		{
+			return m_Size;
+		}
+
+		bool empty() const
+		{
+			return (m_Size == 0);
+		}
+
+		T &operator[](size_t pos)
+		{
+			return m_Data[pos];
+		}
+
+		const T &operator[](size_t pos) const
+		{
+			return m_Data[pos];
+		}
+
+		T &front()
+		{
+			return m_Data[0];
+		}
+
+		T &back()
+		{
+			return m_Data[m_Size - 1];
+		}
+
+		iterator begin()
+		{
+			return m_Data;
+		}
+
+		iterator end()
+		{
+			return m_Data + m_Size;
+		}
+	private:
+		T *m_Data;
+		size_t m_Size;
+		size_t m_Capacity;
+	};
+}
+
+#endif //__SHVECTOR_H__
@@ -0,0 +1,13 @@
+/* Minimal stand-in for the SourceMod header of the same name, see harness.cpp */
+
+#ifndef _INCLUDE_SOURCEMOD_PLATFORM_H_
+#define _INCLUDE_SOURCEMOD_PLATFORM_H_
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#define PLATFORM_MAX_PATH		4096
+#define PLATFORM_EXTERN_C		extern "C" __attribute__((visibility("default")))
+
+#endif //_INCLUDE_SOURCEMOD_PLATFORM_H_
@@ -0,0 +1,45 @@
+/* Minimal stand-in for the SourcePawn header of the same name, see harness.cpp */
+
+#ifndef _INCLUDE_SOURCEPAWN_VM_API_H_
+#define _INCLUDE_SOURCEPAWN_VM_API_H_
+
+#include "sp_vm_types.h"
+
+namespace SourceMod
+{
+	class IdentityToken_t;
+}
+
+namespace SourcePawn
+{
+	class IPluginFunction
+	{
+	public:
+		virtual int PushCell(cell_t cell) = 0;
+		virtual int PushString(const char *string) = 0;
+		virtual int PushStringEx(char *buffer, size_t length, int sz_flags, int cp_flags) = 0;
+		virtual int Execute(cell_t *result) = 0;
+	};
+
+	class IPluginContext
+	{
+	public:
+		virtual IPluginFunction *GetFunctionById(funcid_t func_id) = 0;
+		virtual int ThrowNativeError(const char *msg, ...) = 0;
+		virtual int LocalToString(cell_t local_addr, char **addr) = 0;
+		virtual int LocalToPhysAddr(cell_t local_addr, cell_t **phys_addr) = 0;
+		virtual int StringToLocal(cell_t local_addr, size_t bytes, const char *source) = 0;
+		virtual int StringToLocalUTF8(cell_t local_addr, size_t maxbytes, const char *source, size_t *wrtnbytes) = 0;
+		virtual SourceMod::IdentityToken_t *GetIdentity() = 0;
+	};
+
+	typedef cell_t (*SPVM_NATIVE_FUNC)(IPluginContext *, const cell_t *);
+}
+
+typedef struct sp_nativeinfo_s
+{
+	const char *name;
+	SourcePawn::SPVM_NATIVE_FUNC func;
+} sp_nativeinfo_t;
+
+#endif //_INCLUDE_SOURCEPAWN_VM_API_H_
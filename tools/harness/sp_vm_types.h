@@ -0,0 +1,37 @@
+/* Minimal stand-in for the SourcePawn header of the same name, see harness.cpp */
+
+#ifndef _INCLUDE_SOURCEPAWN_VM_TYPES_H
+#define _INCLUDE_SOURCEPAWN_VM_TYPES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef int32_t cell_t;
+typedef uint32_t ucell_t;
+typedef uint32_t funcid_t;
+
+#define SP_ERROR_NONE				0
+#define SP_ERROR_INVALID_ADDRESS	15
+#define SP_ERROR_NATIVE				23
+
+#define SM_PARAM_COPYBACK			(1<<0)
+
+#define SM_PARAM_STRING_UTF8		(1<<0)
+#define SM_PARAM_STRING_COPY		(1<<1)
+#define SM_PARAM_STRING_BINARY		(1<<2)
+
+static inline float sp_ctof(cell_t val)
+{
+	union { cell_t c; float f; } u;
+	u.c = val;
+	return u.f;
+}
+
+static inline cell_t sp_ftoc(float val)
+{
+	union { cell_t c; float f; } u;
+	u.f = val;
+	return u.c;
+}
+
+#endif //_INCLUDE_SOURCEPAWN_VM_TYPES_H
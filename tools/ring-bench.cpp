@@ -0,0 +1,311 @@
+/**
+ * Micro-benchmark for the hand-off queues in sm_ring.h.
+ *
+ * Every producer thread pushes its share of the items to one consumer (the main thread),
+ * the way the I/O threads hand results to the game thread. Three queues are compared:
+ *   mutex+list  A pthread mutex around a linked list, what the extension used before the rings
+ *   mpsc        One MPSCRing shared by all producers
+ *   spsc        One SPSCRing per producer, drained round-robin (the dispatcher's layout)
+ *
+ * The rings use the dispatcher's capacity and RingOverflow_Block. Each line is the best of
+ * a few runs, in pushes per second measured from the start signal to the last pop.
+ *
+ * Usage: ring-bench [-n items] [-r runs]
+ */
+
+#include "sm_ring.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#define BENCH_CAPACITY		16384
+#define BENCH_MAX_PRODUCERS	16
+
+static const int g_Producers[] = {1, 2, 4, 8, 16};
+
+static volatile int g_Start = 0;
+static size_t g_PerProducer = 0;
+
+static double Bench_Now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+}
+
+static void Bench_WaitStart()
+{
+	while (!g_Start)
+	{
+		sched_yield();
+	}
+}
+
+/* mutex+list */
+
+struct ListNode
+{
+	uintptr_t value;
+	ListNode *next;
+};
+
+static pthread_mutex_t g_ListLock = PTHREAD_MUTEX_INITIALIZER;
+static ListNode *g_ListHead = NULL;
+static ListNode *g_ListTail = NULL;
+
+static void List_Push(uintptr_t value)
+{
+	ListNode *node = (ListNode *)malloc(sizeof(ListNode));
+	node->value = value;
+	node->next = NULL;
+
+	pthread_mutex_lock(&g_ListLock);
+	if (g_ListTail == NULL)
+	{
+		g_ListHead = node;
+	}
+	else
+	{
+		g_ListTail->next = node;
+	}
+	g_ListTail = node;
+	pthread_mutex_unlock(&g_ListLock);
+}
+
+static bool List_Pop(uintptr_t &value)
+{
+	pthread_mutex_lock(&g_ListLock);
+	ListNode *node = g_ListHead;
+	if (node == NULL)
+	{
+		pthread_mutex_unlock(&g_ListLock);
+		return false;
+	}
+	g_ListHead = node->next;
+	if (g_ListHead == NULL)
+	{
+		g_ListTail = NULL;
+	}
+	pthread_mutex_unlock(&g_ListLock);
+
+	value = node->value;
+	free(node);
+	return true;
+}
+
+static void *List_Producer(void *arg)
+{
+	uintptr_t id = (uintptr_t)arg;
+	Bench_WaitStart();
+	for (size_t i = 0; i < g_PerProducer; i++)
+	{
+		List_Push(id + 1);
+	}
+	return NULL;
+}
+
+static size_t List_Consume(size_t total, int producers)
+{
+	size_t count = 0;
+	uintptr_t value;
+	while (count < total)
+	{
+		if (List_Pop(value))
+		{
+			count++;
+		}
+		else
+		{
+			sched_yield();
+		}
+	}
+	return count;
+}
+
+/* mpsc */
+
+static MPSCRing<uintptr_t> *g_MPSC = NULL;
+
+static void *MPSC_Producer(void *arg)
+{
+	uintptr_t id = (uintptr_t)arg;
+	Bench_WaitStart();
+	for (size_t i = 0; i < g_PerProducer; i++)
+	{
+		g_MPSC->push(id + 1);
+	}
+	return NULL;
+}
+
+static size_t MPSC_Consume(size_t total, int producers)
+{
+	size_t count = 0;
+	uintptr_t value;
+	while (count < total)
+	{
+		if (g_MPSC->pop(value))
+		{
+			count++;
+		}
+		else
+		{
+			sched_yield();
+		}
+	}
+	return count;
+}
+
+/* spsc */
+
+static SPSCRing<uintptr_t> *g_SPSC[BENCH_MAX_PRODUCERS];
+
+static void *SPSC_Producer(void *arg)
+{
+	uintptr_t id = (uintptr_t)arg;
+	SPSCRing<uintptr_t> *ring = g_SPSC[id];
+	Bench_WaitStart();
+	for (size_t i = 0; i < g_PerProducer; i++)
+	{
+		ring->push(id + 1);
+	}
+	return NULL;
+}
+
+static size_t SPSC_Consume(size_t total, int producers)
+{
+	size_t count = 0;
+	uintptr_t value;
+	while (count < total)
+	{
+		bool any = false;
+		for (int i = 0; i < producers; i++)
+		{
+			while (g_SPSC[i]->pop(value))
+			{
+				count++;
+				any = true;
+			}
+		}
+		if (!any)
+		{
+			sched_yield();
+		}
+	}
+	return count;
+}
+
+struct BenchQueue
+{
+	const char *name;
+	void *(*producer)(void *);
+	size_t (*consume)(size_t total, int producers);
+};
+
+static const BenchQueue g_Queues[] = {
+	{"mutex+list", List_Producer, List_Consume},
+	{"mpsc", MPSC_Producer, MPSC_Consume},
+	{"spsc", SPSC_Producer, SPSC_Consume},
+};
+
+static double Bench_Run(const BenchQueue &queue, int producers, size_t items)
+{
+	pthread_t threads[BENCH_MAX_PRODUCERS];
+
+	g_PerProducer = items / producers;
+	size_t total = g_PerProducer * producers;
+
+	g_MPSC = new MPSCRing<uintptr_t>(BENCH_CAPACITY);
+	for (int i = 0; i < producers; i++)
+	{
+		g_SPSC[i] = new SPSCRing<uintptr_t>(BENCH_CAPACITY);
+	}
+
+	g_Start = 0;
+	for (int i = 0; i < producers; i++)
+	{
+		pthread_create(&threads[i], NULL, queue.producer, (void *)(uintptr_t)i);
+	}
+
+	double start = Bench_Now();
+	__sync_synchronize();
+	g_Start = 1;
+
+	queue.consume(total, producers);
+	double elapsed = Bench_Now() - start;
+
+	for (int i = 0; i < producers; i++)
+	{
+		pthread_join(threads[i], NULL);
+	}
+
+	delete g_MPSC;
+	for (int i = 0; i < producers; i++)
+	{
+		delete g_SPSC[i];
+	}
+
+	return (elapsed > 0.0) ? ((double)total / elapsed) : 0.0;
+}
+
+int main(int argc, char **argv)
+{
+	size_t items = 2000000;
+	int runs = 3;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+		{
+			items = strtoul(argv[++i], NULL, 10);
+		}
+		else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+		{
+			runs = atoi(argv[++i]);
+		}
+		else
+		{
+			fprintf(stderr, "Usage: %s [-n items] [-r runs]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (items < BENCH_MAX_PRODUCERS || runs < 1)
+	{
+		fprintf(stderr, "Need at least %d items and one run\n", BENCH_MAX_PRODUCERS);
+		return 1;
+	}
+
+	printf("%zu items, best of %d runs, ops/sec\n", items, runs);
+	printf("%-10s", "producers");
+	for (size_t q = 0; q < sizeof(g_Queues) / sizeof(g_Queues[0]); q++)
+	{
+		printf(" %14s", g_Queues[q].name);
+	}
+	printf("\n");
+
+	for (size_t p = 0; p < sizeof(g_Producers) / sizeof(g_Producers[0]); p++)
+	{
+		printf("%-10d", g_Producers[p]);
+		for (size_t q = 0; q < sizeof(g_Queues) / sizeof(g_Queues[0]); q++)
+		{
+			double best = 0.0;
+			for (int r = 0; r < runs; r++)
+			{
+				double rate = Bench_Run(g_Queues[q], g_Producers[p], items);
+				if (rate > best)
+				{
+					best = rate;
+				}
+			}
+			printf(" %14.0f", best);
+		}
+		printf("\n");
+		fflush(stdout);
+	}
+
+	return 0;
+}